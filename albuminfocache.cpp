@@ -0,0 +1,175 @@
+#include "albuminfocache.h"
+
+#include <c++utilities/conversion/stringconversion.h>
+#include <c++utilities/io/inifile.h>
+
+#include <QDir>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QRunnable>
+
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+using namespace CppUtilities;
+
+namespace DBusSoundRecorder {
+
+inline QString infoIniPath(const QString &albumDirPath)
+{
+    return albumDirPath + QStringLiteral("/info.ini");
+}
+
+/*!
+ * \brief The AlbumInfoLoader class loads an entry of the AlbumInfoCache in the background.
+ */
+class AlbumInfoLoader : public QRunnable {
+public:
+    AlbumInfoLoader(AlbumInfoCache &cache, const QString &albumDirPath);
+    void run() override;
+
+private:
+    AlbumInfoCache &m_cache;
+    const QString m_albumDirPath;
+};
+
+AlbumInfoLoader::AlbumInfoLoader(AlbumInfoCache &cache, const QString &albumDirPath)
+    : m_cache(cache)
+    , m_albumDirPath(albumDirPath)
+{
+}
+
+void AlbumInfoLoader::run()
+{
+    m_cache.info(m_albumDirPath);
+}
+
+AlbumInfoCache::AlbumInfoCache()
+{
+    m_threadPool.setMaxThreadCount(1);
+}
+
+/*!
+ * \brief Returns the info for the album directory at the specified \a albumDirPath.
+ * \remarks The info.ini file is only parsed if it has not been cached yet or changed since it has been cached.
+ */
+AlbumInfo AlbumInfoCache::info(const QString &albumDirPath)
+{
+    Entry entry;
+    if (isCurrent(albumDirPath, &entry)) {
+        return entry.info;
+    }
+    entry = load(albumDirPath);
+    QMutexLocker locker(&m_mutex);
+    m_entries[albumDirPath] = entry;
+    return entry.info;
+}
+
+/*!
+ * \brief Loads the info for the album directory at the specified \a albumDirPath in the background.
+ * \remarks This function returns immediately.
+ */
+void AlbumInfoCache::warmUp(const QString &albumDirPath)
+{
+    m_threadPool.start(new AlbumInfoLoader(*this, albumDirPath));
+}
+
+/*!
+ * \brief Creates the album directory at the specified \a albumDirPath (including parent directories) if not done yet.
+ * \remarks Once the directory has been created, only its existence is checked for further tracks of the album (instead
+ *          of checking all parent directories). A directory which has been removed or renamed while recording is
+ *          created again.
+ */
+bool AlbumInfoCache::makeAlbumDir(const QString &albumDirPath)
+{
+    QMutexLocker locker(&m_mutex);
+    const auto created = m_createdDirs.contains(albumDirPath);
+    locker.unlock();
+    if (created && QFileInfo(albumDirPath).isDir()) {
+        return true;
+    }
+    if (!QDir().mkpath(albumDirPath)) {
+        return false;
+    }
+    locker.relock();
+    m_createdDirs << albumDirPath;
+    return true;
+}
+
+/*!
+ * \brief Returns whether the cached entry for \a albumDirPath is still up-to-date and assigns it to \a entry if so.
+ */
+bool AlbumInfoCache::isCurrent(const QString &albumDirPath, Entry *entry)
+{
+    const QFileInfo fileInfo(infoIniPath(albumDirPath));
+    QMutexLocker locker(&m_mutex);
+    const auto i = m_entries.constFind(albumDirPath);
+    if (i == m_entries.cend() || i->exists != fileInfo.exists()
+        || (i->exists && (i->lastModified != fileInfo.lastModified() || i->size != fileInfo.size()))) {
+        return false;
+    }
+    *entry = *i;
+    return true;
+}
+
+/*!
+ * \brief Parses the info.ini file within the album directory at the specified \a albumDirPath.
+ * \remarks
+ *  - The info.ini file must be created before recording.
+ *  - Track lengths might be specified for each track in the [length] section (useful to get rid of advertisements at the end).
+ *  - year, genre, total_tracks and total_disks might be specified in the [general] section.
+ */
+AlbumInfoCache::Entry AlbumInfoCache::load(const QString &albumDirPath)
+{
+    const auto path = infoIniPath(albumDirPath);
+    const QFileInfo fileInfo(path);
+    Entry entry{ fileInfo.exists(), fileInfo.lastModified(), fileInfo.size(), AlbumInfo() };
+    if (!entry.exists) {
+        return entry;
+    }
+    auto &info = entry.info;
+    fstream infoFile;
+    infoFile.exceptions(ios_base::badbit | ios_base::failbit);
+    try {
+        infoFile.open(path.toLocal8Bit().data(), ios_base::in);
+        IniFile infoIni;
+        infoIni.parse(infoFile);
+        for (auto &scope : infoIni.data()) {
+            if (scope.first == "length") {
+                // the track number is used for mapping
+                for (const auto &lengthEntry : scope.second) {
+                    try {
+                        // the first entry wins if a track is specified multiple times
+                        const auto trackNumber = stringToNumber<unsigned int>(lengthEntry.first);
+                        if (!info.lengths.contains(trackNumber)) {
+                            info.lengths[trackNumber] = QString::fromLocal8Bit(lengthEntry.second.data());
+                        }
+                    } catch (const ConversionException &) {
+                        cerr << "Warning: Ignoring non-numeric key \"" << lengthEntry.first << "\" in [length] section of info.ini." << endl;
+                    }
+                }
+            } else if (scope.first == "general") {
+                for (const auto &generalEntry : scope.second) {
+                    if (generalEntry.first == "year") {
+                        info.year = QString::fromLocal8Bit(generalEntry.second.data());
+                    } else if (generalEntry.first == "genre") {
+                        info.genre = QString::fromLocal8Bit(generalEntry.second.data());
+                    } else if (generalEntry.first == "total_tracks") {
+                        info.totalTracks = QString::fromLocal8Bit(generalEntry.second.data());
+                    } else if (generalEntry.first == "total_disks") {
+                        info.totalDisks = QString::fromLocal8Bit(generalEntry.second.data());
+                    } else {
+                        cerr << "Warning: Ignoring unknown property \"" << generalEntry.first << "\" in [general] section of info.ini." << endl;
+                    }
+                }
+            } else {
+                cerr << "Warning: Ignoring unknown section [" << scope.first << "] in info.ini." << endl;
+            }
+        }
+    } catch (const std::ios_base::failure &failure) {
+        cerr << "Warning: Can't parse info.ini because an IO error occurred: " << failure.what() << endl;
+    }
+    return entry;
+}
+} // namespace DBusSoundRecorder
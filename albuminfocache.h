@@ -0,0 +1,58 @@
+#ifndef ALBUMINFOCACHE_H
+#define ALBUMINFOCACHE_H
+
+#include <QDateTime>
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+#include <QThreadPool>
+
+namespace DBusSoundRecorder {
+
+/*!
+ * \brief The AlbumInfo struct holds the additional meta info read from an info.ini file within an album directory.
+ */
+struct AlbumInfo {
+    QString year;
+    QString genre;
+    QString totalTracks;
+    QString totalDisks;
+    QHash<unsigned int, QString> lengths;
+};
+
+/*!
+ * \brief The AlbumInfoCache class caches the parsed info.ini files of album directories.
+ *
+ * A cached entry is only read again when the modification time or the size of the file changed. Entries can be
+ * loaded in the background via warmUp() so parsing does not happen on the critical path when the next track starts.
+ * The cache also remembers the album directories which have been created (see makeAlbumDir()). All functions are
+ * thread-safe.
+ */
+class AlbumInfoCache {
+public:
+    AlbumInfoCache();
+
+    AlbumInfo info(const QString &albumDirPath);
+    void warmUp(const QString &albumDirPath);
+    bool makeAlbumDir(const QString &albumDirPath);
+
+private:
+    struct Entry {
+        bool exists;
+        QDateTime lastModified;
+        qint64 size;
+        AlbumInfo info;
+    };
+
+    static Entry load(const QString &albumDirPath);
+    bool isCurrent(const QString &albumDirPath, Entry *entry);
+
+    QMutex m_mutex;
+    QHash<QString, Entry> m_entries;
+    QSet<QString> m_createdDirs;
+    QThreadPool m_threadPool;
+};
+} // namespace DBusSoundRecorder
+
+#endif // ALBUMINFOCACHE_H
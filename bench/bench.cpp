@@ -0,0 +1,427 @@
+#include "../fakeplayer.h"
+#include "../recorder.h"
+
+#include <c++utilities/application/argumentparser.h>
+#include <c++utilities/conversion/stringconversion.h>
+
+#include <QCoreApplication>
+#include <QDBusConnection>
+#include <QEventLoop>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QProcess>
+#include <QTemporaryDir>
+#include <QTimer>
+
+#include <algorithm>
+#include <csignal>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace std;
+using namespace CppUtilities;
+using namespace DBusSoundRecorder;
+
+using Clock = chrono::steady_clock;
+
+/// \brief The environment variable which makes the benchmark binary act as ffmpeg stub.
+static const char *const stubEnvironmentVariable = "DBUS_SOUNDRECORDER_BENCH_STUB";
+
+static volatile sig_atomic_t stubTerminated = 0;
+
+static void terminateStub(int)
+{
+    stubTerminated = 1;
+}
+
+/*!
+ * \brief Behaves like ffmpeg as far as the recorder is concerned without doing any actual work.
+ *
+ * - When reading from stdin (encoder when capturing continuously), the input is consumed until EOF.
+ * - When writing to stdout (continuous capture), silence is written in real time.
+ * - Otherwise (per-track recording), the process runs until terminated or the duration specified via "-t" elapsed.
+ *
+ * The output file is created like ffmpeg would do.
+ */
+static int runStub(int argc, char *argv[])
+{
+    signal(SIGTERM, terminateStub);
+    signal(SIGINT, terminateStub);
+    const vector<string> args(argv + 1, argv + argc);
+    auto readsStdin = false;
+    auto duration = 0.0;
+    auto sampleRate = 44100u, channels = 2u;
+    for (size_t i = 0; i + 1 < args.size(); ++i) {
+        if (args[i] == "-i" && args[i + 1] == "-") {
+            readsStdin = true;
+        } else if (args[i] == "-t") {
+            duration = stod(args[i + 1]);
+        } else if (args[i] == "-ar") {
+            sampleRate = static_cast<unsigned int>(stoul(args[i + 1]));
+        } else if (args[i] == "-ac") {
+            channels = static_cast<unsigned int>(stoul(args[i + 1]));
+        }
+    }
+    const auto output = args.empty() ? string("-") : args.back();
+    if (output != "-") {
+        ofstream file(output, ios_base::out | ios_base::trunc);
+    }
+    if (readsStdin) {
+        char buffer[4096];
+        while (!stubTerminated && read(STDIN_FILENO, buffer, sizeof(buffer)) > 0) {
+        }
+        return 0;
+    }
+    if (output == "-") {
+        const vector<char> silence(sampleRate * channels * 2 / 100, 0);
+        while (!stubTerminated && write(STDOUT_FILENO, silence.data(), silence.size()) >= 0) {
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+        return 0;
+    }
+    const auto start = Clock::now();
+    while (!stubTerminated && (duration <= 0.0 || Clock::now() - start < chrono::duration<double>(duration))) {
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    return 0;
+}
+
+/*!
+ * \brief Returns the milliseconds between \a from and \a to.
+ */
+static double milliseconds(Clock::time_point from, Clock::time_point to)
+{
+    return chrono::duration<double, milli>(to - from).count();
+}
+
+/*!
+ * \brief Returns min, mean, median, 99th percentile and max of the specified \a values.
+ */
+static QJsonObject statistics(vector<double> values)
+{
+    QJsonObject stats{ { QStringLiteral("count"), static_cast<qint64>(values.size()) } };
+    if (values.empty()) {
+        return stats;
+    }
+    sort(values.begin(), values.end());
+    auto sum = 0.0;
+    for (const auto value : values) {
+        sum += value;
+    }
+    const auto percentile = [&values](double p) { return values[min(values.size() - 1, static_cast<size_t>(p * static_cast<double>(values.size())))]; };
+    stats.insert(QStringLiteral("min"), values.front());
+    stats.insert(QStringLiteral("mean"), sum / static_cast<double>(values.size()));
+    stats.insert(QStringLiteral("p50"), percentile(0.5));
+    stats.insert(QStringLiteral("p99"), percentile(0.99));
+    stats.insert(QStringLiteral("max"), values.back());
+    return stats;
+}
+
+/*!
+ * \brief Returns events of a player playing \a tracks tracks each lasting \a interval, followed by stopping playback.
+ * \remarks If \a partialUpdates is set, each song change is sent in two updates (like Spotify does): the first only
+ *          changes the title, the second the album. The indices of the events starting a song change are added to
+ *          \a songChangeEvents; the index of the event stopping playback is returned.
+ */
+static int makeTrackEvents(vector<TraceEvent> &events, vector<int> &songChangeEvents, int tracks, chrono::microseconds interval, bool partialUpdates)
+{
+    const auto metadata = [](int track, int album) {
+        return QVariantMap({ { QStringLiteral("xesam:title"), QStringLiteral("Track %1").arg(track) },
+            { QStringLiteral("xesam:album"), QStringLiteral("Album %1").arg(album) }, { QStringLiteral("xesam:artist"), QStringLiteral("Artist") },
+            { QStringLiteral("xesam:trackNumber"), track + 1 } });
+    };
+    for (auto track = 0; track < tracks; ++track) {
+        TraceEvent event;
+        event.time = interval * track;
+        if (partialUpdates && track) {
+            event.properties = QVariantMap({ { QStringLiteral("Metadata"), metadata(track, track - 1) } });
+            songChangeEvents.emplace_back(static_cast<int>(events.size()));
+            events.emplace_back(event);
+            event.time += chrono::milliseconds(1);
+        } else {
+            songChangeEvents.emplace_back(static_cast<int>(events.size()));
+        }
+        event.properties = QVariantMap({ { QStringLiteral("Metadata"), metadata(track, track) } });
+        if (!track) {
+            event.properties.insert(QStringLiteral("PlaybackStatus"), QStringLiteral("Playing"));
+        }
+        events.emplace_back(event);
+    }
+    TraceEvent stopEvent;
+    stopEvent.time = interval * tracks;
+    stopEvent.properties = QVariantMap({ { QStringLiteral("PlaybackStatus"), QStringLiteral("Stopped") } });
+    events.emplace_back(stopEvent);
+    return static_cast<int>(events.size() - 1);
+}
+
+/*!
+ * \brief The Stream class binds a fake player to a recorder and records the times of the events in between.
+ */
+class Stream {
+public:
+    Stream(const QString &busAddress, const RecorderConfig &config, int tracks, chrono::microseconds interval, bool partialUpdates);
+    ~Stream();
+
+    void start();
+    bool isDone() const;
+
+    const int expectedTracks;
+    vector<Clock::time_point> songChangeTimes;
+    vector<Clock::time_point> startTimes;
+    vector<Clock::time_point> finishTimes;
+    Clock::time_point stopTime;
+
+private:
+    const QString m_connectionName;
+    vector<TraceEvent> m_events;
+    vector<int> m_songChangeEvents;
+    int m_stopEvent;
+    FakePlayer m_player;
+    unique_ptr<Recorder> m_recorder;
+    bool m_replayFinished;
+};
+
+Stream::Stream(const QString &busAddress, const RecorderConfig &config, int tracks, chrono::microseconds interval, bool partialUpdates)
+    : expectedTracks(tracks)
+    , m_connectionName(QStringLiteral("bench-") + config.application)
+    , m_stopEvent(makeTrackEvents(m_events, m_songChangeEvents, tracks, interval, partialUpdates))
+    , m_player(QDBusConnection::connectToBus(busAddress, m_connectionName), config.application)
+    , m_replayFinished(false)
+{
+    if (!m_player.registerService()) {
+        throw runtime_error("unable to register fake player");
+    }
+    m_recorder = make_unique<Recorder>(config);
+    QObject::connect(&m_player, &FakePlayer::eventReplayed, &m_player, [this](int index) {
+        if (find(m_songChangeEvents.cbegin(), m_songChangeEvents.cend(), index) != m_songChangeEvents.cend()) {
+            songChangeTimes.emplace_back(Clock::now());
+        } else if (index == m_stopEvent) {
+            stopTime = Clock::now();
+        }
+    });
+    QObject::connect(&m_player, &FakePlayer::finished, &m_player, [this] { m_replayFinished = true; });
+    QObject::connect(&m_recorder->launcher(), &FfmpegLauncher::recordingStarted, &m_player, [this] { startTimes.emplace_back(Clock::now()); });
+    QObject::connect(&m_recorder->launcher(), &FfmpegLauncher::recordingFinished, &m_player, [this] { finishTimes.emplace_back(Clock::now()); });
+}
+
+Stream::~Stream()
+{
+    m_recorder.reset();
+    QDBusConnection::disconnectFromBus(m_connectionName);
+}
+
+void Stream::start()
+{
+    m_player.replay(m_events);
+}
+
+bool Stream::isDone() const
+{
+    return m_replayFinished && finishTimes.size() >= startTimes.size() && m_recorder->launcher().isIdle();
+}
+
+/*!
+ * \brief The Benchmark class runs the benchmark scenarios.
+ */
+class Benchmark {
+public:
+    Benchmark(const QString &busAddress, const RecorderConfig &config);
+
+    vector<unique_ptr<Stream>> run(int streams, int tracks, chrono::microseconds interval, bool partialUpdates);
+    QJsonObject measureLatency(int tracks);
+    QJsonArray measureBursts(int tracks);
+    QJsonArray measureConcurrency(int tracks, int maxStreams, double threshold, int &maxSustainedStreams);
+
+private:
+    const QString m_busAddress;
+    const RecorderConfig m_config;
+    int m_playerCount;
+};
+
+Benchmark::Benchmark(const QString &busAddress, const RecorderConfig &config)
+    : m_busAddress(busAddress)
+    , m_config(config)
+    , m_playerCount(0)
+{
+}
+
+/*!
+ * \brief Runs \a streams streams concurrently until all of them are done and returns them for evaluation.
+ */
+vector<unique_ptr<Stream>> Benchmark::run(int streams, int tracks, chrono::microseconds interval, bool partialUpdates)
+{
+    vector<unique_ptr<Stream>> result;
+    for (auto i = 0; i < streams; ++i) {
+        auto config = m_config;
+        config.application = QStringLiteral("bench%1").arg(++m_playerCount);
+        result.emplace_back(make_unique<Stream>(m_busAddress, config, tracks, interval, partialUpdates));
+    }
+    // give the watchers the chance to fetch the initial state before starting
+    QEventLoop loop;
+    QTimer::singleShot(100, &loop, &QEventLoop::quit);
+    loop.exec();
+    for (auto &stream : result) {
+        stream->start();
+    }
+    QTimer poll;
+    QObject::connect(&poll, &QTimer::timeout, &loop, [&] {
+        if (all_of(result.cbegin(), result.cend(), [](const unique_ptr<Stream> &stream) { return stream->isDone(); })) {
+            loop.quit();
+        }
+    });
+    poll.start(10);
+    QTimer::singleShot(static_cast<int>(chrono::duration_cast<chrono::milliseconds>(interval * (tracks + 1)).count()) + 20000, &loop, &QEventLoop::quit);
+    loop.exec();
+    return result;
+}
+
+/*!
+ * \brief Measures the time from a song change to the start of the new recording and from stopping playback to the end
+ *        of the last recording.
+ */
+QJsonObject Benchmark::measureLatency(int tracks)
+{
+    const auto streams = run(1, tracks, chrono::milliseconds(300), false);
+    const auto &stream = *streams.front();
+    vector<double> spawnLatencies, stopLatencies;
+    for (size_t i = 0, count = min(stream.songChangeTimes.size(), stream.startTimes.size()); i != count; ++i) {
+        spawnLatencies.emplace_back(milliseconds(stream.songChangeTimes[i], stream.startTimes[i]));
+    }
+    if (stream.stopTime != Clock::time_point() && !stream.finishTimes.empty()) {
+        stopLatencies.emplace_back(milliseconds(stream.stopTime, stream.finishTimes.back()));
+    }
+    return QJsonObject{ { QStringLiteral("signalToSpawn"), statistics(spawnLatencies) }, { QStringLiteral("stop"), statistics(stopLatencies) } };
+}
+
+/*!
+ * \brief Measures how many tracks are missed (or recorded spuriously) when song changes happen in quick succession and
+ *        are sent in partial updates.
+ */
+QJsonArray Benchmark::measureBursts(int tracks)
+{
+    QJsonArray results;
+    for (const auto interval : { 200, 100, 50, 20 }) {
+        const auto streams = run(1, tracks, chrono::milliseconds(interval), true);
+        const auto started = static_cast<int>(streams.front()->startTimes.size());
+        results.append(QJsonObject{ { QStringLiteral("interval"), interval }, { QStringLiteral("expected"), tracks },
+            { QStringLiteral("started"), started }, { QStringLiteral("missedRate"), max(tracks - started, 0) / static_cast<double>(tracks) },
+            { QStringLiteral("spuriousRate"), max(started - tracks, 0) / static_cast<double>(tracks) } });
+    }
+    return results;
+}
+
+/*!
+ * \brief Measures the signal-to-spawn latency for an increasing number of concurrent streams.
+ * \remarks A number of streams is considered sustainable if no track is missed and the 99th percentile of the latency
+ *          does not exceed \a threshold milliseconds.
+ */
+QJsonArray Benchmark::measureConcurrency(int tracks, int maxStreams, double threshold, int &maxSustainedStreams)
+{
+    QJsonArray results;
+    maxSustainedStreams = 0;
+    for (auto streamCount = 1; streamCount <= maxStreams; streamCount *= 2) {
+        const auto streams = run(streamCount, tracks, chrono::milliseconds(300), false);
+        vector<double> latencies;
+        auto missed = 0;
+        for (const auto &stream : streams) {
+            for (size_t i = 0, count = min(stream->songChangeTimes.size(), stream->startTimes.size()); i != count; ++i) {
+                latencies.emplace_back(milliseconds(stream->songChangeTimes[i], stream->startTimes[i]));
+            }
+            missed += max(stream->expectedTracks - static_cast<int>(stream->startTimes.size()), 0);
+        }
+        const auto stats = statistics(latencies);
+        const auto sustained = !missed && stats.value(QStringLiteral("p99")).toDouble() <= threshold;
+        if (sustained) {
+            maxSustainedStreams = streamCount;
+        }
+        results.append(QJsonObject{ { QStringLiteral("streams"), streamCount }, { QStringLiteral("signalToSpawn"), stats },
+            { QStringLiteral("missedRate"), missed / static_cast<double>(streamCount * tracks) }, { QStringLiteral("sustained"), sustained } });
+        if (!sustained) {
+            break;
+        }
+    }
+    return results;
+}
+
+int main(int argc, char *argv[])
+{
+    if (qEnvironmentVariableIsSet(stubEnvironmentVariable)) {
+        return runStub(argc, argv);
+    }
+    // setup the argument parser
+    ArgumentParser parser;
+    HelpArgument helpArg(parser);
+    Argument outputArg("output", 'o', "specifies the file to write the results to (default is stdout)");
+    outputArg.setValueNames({ "path" });
+    outputArg.setRequiredValueCount(1);
+    Argument tracksArg("tracks", '\0', "specifies the number of tracks played per run (default is 20)");
+    tracksArg.setValueNames({ "count" });
+    tracksArg.setRequiredValueCount(1);
+    Argument settleTimeArg("settle-time", '\0', "specifies the settle time of the watcher (default is 100 ms)");
+    settleTimeArg.setValueNames({ "milliseconds" });
+    settleTimeArg.setRequiredValueCount(1);
+    Argument maxStreamsArg("max-streams", '\0', "specifies the maximum number of concurrent streams to try (default is 64)");
+    maxStreamsArg.setValueNames({ "count" });
+    maxStreamsArg.setRequiredValueCount(1);
+    Argument continuousArg("continuous", 'c', "benchmarks capturing continuously instead of spawning a process per track");
+    parser.setMainArguments({ &helpArg, &outputArg, &tracksArg, &settleTimeArg, &maxStreamsArg, &continuousArg });
+    parser.parseArgs(argc, argv);
+    if (helpArg.isPresent()) {
+        return 0;
+    }
+    try {
+        const auto tracks = tracksArg.isPresent() ? stringToNumber<int>(tracksArg.values().front()) : 20;
+        const auto settleTime = settleTimeArg.isPresent() ? stringToNumber<int>(settleTimeArg.values().front()) : 100;
+        const auto maxStreams = maxStreamsArg.isPresent() ? stringToNumber<int>(maxStreamsArg.values().front()) : 64;
+        // use a private bus and this binary as ffmpeg stub
+        QCoreApplication app(argc, argv);
+        QProcess busDaemon;
+        const auto busAddress = startPrivateBus(busDaemon);
+        qputenv("DBUS_SESSION_BUS_ADDRESS", busAddress.toLocal8Bit());
+        qputenv(stubEnvironmentVariable, "1");
+        QTemporaryDir targetDir;
+        if (!targetDir.isValid()) {
+            throw runtime_error("unable to create temporary directory");
+        }
+        RecorderConfig config;
+        config.sink = QStringLiteral("bench");
+        config.ffmpegBinary = QCoreApplication::applicationFilePath();
+        config.targetDir = targetDir.path();
+        config.settleTime = settleTime;
+        config.continuous = continuousArg.isPresent();
+        // run the scenarios
+        Benchmark benchmark(busAddress, config);
+        auto maxSustainedStreams = 0;
+        QJsonObject results{ { QStringLiteral("settleTime"), settleTime }, { QStringLiteral("continuous"), config.continuous },
+            { QStringLiteral("tracks"), tracks } };
+        cerr << "Measuring latency ..." << endl;
+        results.insert(QStringLiteral("latency"), benchmark.measureLatency(tracks));
+        cerr << "Measuring missed tracks under bursts ..." << endl;
+        results.insert(QStringLiteral("bursts"), benchmark.measureBursts(tracks));
+        cerr << "Measuring concurrent streams ..." << endl;
+        results.insert(QStringLiteral("concurrency"), benchmark.measureConcurrency(min(tracks, 10), maxStreams, settleTime + 100.0, maxSustainedStreams));
+        results.insert(QStringLiteral("maxSustainedStreams"), maxSustainedStreams);
+        // write the results
+        const auto json = QJsonDocument(results).toJson();
+        if (outputArg.isPresent()) {
+            QFile output(QString::fromLocal8Bit(outputArg.values().front()));
+            if (!output.open(QIODevice::WriteOnly | QIODevice::Truncate) || output.write(json) != json.size()) {
+                throw runtime_error("unable to write results: " + output.errorString().toStdString());
+            }
+        } else {
+            cout << json.data();
+        }
+    } catch (const runtime_error &e) {
+        cerr << "Fatal error: " << e.what() << endl;
+        return 3;
+    }
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include "covercache.h"
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QFileInfo>
+#include <QMimeDatabase>
+#include <QMutexLocker>
+#include <QSaveFile>
+
+#include <iostream>
+
+using namespace std;
+
+namespace DBusSoundRecorder {
+
+inline ostream &operator<<(ostream &stream, const QString &str)
+{
+    return stream << str.toLocal8Bit().data();
+}
+
+/// \brief The number of images whose data is kept in memory.
+constexpr int maxCachedCovers = 8;
+
+CoverCache::CoverCache()
+{
+}
+
+/*!
+ * \brief Returns the image at the specified \a imagePath and ensures a copy of it exists within \a albumDirPath.
+ * \remarks
+ * - The image is only read and hashed if it has not been cached yet or changed since it has been cached.
+ * - The path of the returned cover refers to the copy within \a albumDirPath. It is empty if the copy could not be
+ *   created.
+ * - Returns an empty cover if the image can not be read or is not an image.
+ */
+Cover CoverCache::cover(const QString &imagePath, const QString &albumDirPath)
+{
+    const QFileInfo fileInfo(imagePath);
+    QMutexLocker locker(&m_mutex);
+    auto i = m_entries.find(imagePath);
+    if (i == m_entries.end() || i->lastModified != fileInfo.lastModified() || i->size != fileInfo.size()) {
+        Entry entry{ fileInfo.lastModified(), fileInfo.size(), Cover() };
+        if (!load(imagePath, entry)) {
+            m_entries.remove(imagePath);
+            m_recentlyUsed.removeOne(imagePath);
+            return Cover();
+        }
+        i = m_entries.insert(imagePath, entry);
+    }
+    auto cover = i->cover;
+    // evict the data of the images which have not been used for the longest time
+    m_recentlyUsed.removeOne(imagePath);
+    m_recentlyUsed.append(imagePath);
+    while (m_recentlyUsed.size() > maxCachedCovers) {
+        m_entries.remove(m_recentlyUsed.takeFirst());
+    }
+    store(cover, albumDirPath);
+    return cover;
+}
+
+/*!
+ * \brief Reads and hashes the image at the specified \a imagePath into \a entry.
+ * \returns Returns whether the file could be read and contains an image.
+ */
+bool CoverCache::load(const QString &imagePath, Entry &entry)
+{
+    QFile file(imagePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        cerr << "Warning: Unable to read cover " << imagePath << ": " << file.errorString() << endl;
+        return false;
+    }
+    auto &cover = entry.cover;
+    cover.data = file.readAll();
+    const auto mimeType = QMimeDatabase().mimeTypeForData(cover.data);
+    if (!mimeType.name().startsWith(QLatin1String("image/"))) {
+        cerr << "Warning: Cover " << imagePath << " is not an image" << endl;
+        return false;
+    }
+    cover.mimeType = mimeType.name();
+    cover.hash = QCryptographicHash::hash(cover.data, QCryptographicHash::Sha1).toHex();
+    cover.suffix = mimeType.preferredSuffix();
+    return true;
+}
+
+/*!
+ * \brief Ensures a copy of \a cover named after its hash exists within \a albumDirPath and assigns its path to \a cover.
+ * \remarks The existence of the copy is only checked once per album directory and image.
+ */
+bool CoverCache::store(Cover &cover, const QString &albumDirPath)
+{
+    cover.path = QStringLiteral("%1/cover-%2.%3").arg(albumDirPath, QString::fromLatin1(cover.hash), cover.suffix);
+    if (m_storedCovers.contains(cover.path)) {
+        return true;
+    }
+    if (!QFileInfo::exists(cover.path)) {
+        QSaveFile file(cover.path);
+        if (!file.open(QIODevice::WriteOnly) || file.write(cover.data) != cover.data.size() || !file.commit()) {
+            cerr << "Warning: Unable to store cover " << cover.path << ": " << file.errorString() << endl;
+            cover.path.clear();
+            return false;
+        }
+    }
+    m_storedCovers << cover.path;
+    return true;
+}
+} // namespace DBusSoundRecorder
@@ -0,0 +1,55 @@
+#ifndef COVERCACHE_H
+#define COVERCACHE_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+
+namespace DBusSoundRecorder {
+
+/*!
+ * \brief The Cover struct holds a cover image.
+ */
+struct Cover {
+    QByteArray data;
+    QByteArray hash;
+    QString mimeType;
+    QString suffix;
+    QString path;
+};
+
+/*!
+ * \brief The CoverCache class caches cover images referenced by players via mpris:artUrl.
+ *
+ * Players usually refer to the same local image for every track of an album. So an image is only read and hashed (via
+ * SHA-1) again if its modification time or size changed. The image is copied into the album directory under its hash
+ * (content-addressed) so it is stored only once per album directory no matter how many tracks refer to it. The data
+ * of the most recently used images is kept in memory for embedding it into the tracks. All functions are thread-safe.
+ */
+class CoverCache {
+public:
+    CoverCache();
+
+    Cover cover(const QString &imagePath, const QString &albumDirPath);
+
+private:
+    struct Entry {
+        QDateTime lastModified;
+        qint64 size;
+        Cover cover;
+    };
+
+    static bool load(const QString &imagePath, Entry &entry);
+    bool store(Cover &cover, const QString &albumDirPath);
+
+    QMutex m_mutex;
+    QHash<QString, Entry> m_entries;
+    QList<QString> m_recentlyUsed;
+    QSet<QString> m_storedCovers;
+};
+} // namespace DBusSoundRecorder
+
+#endif // COVERCACHE_H
@@ -0,0 +1,150 @@
+#include "cutrefiner.h"
+#include "pcmcapture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace DBusSoundRecorder {
+
+CutRefiner::CutRefiner()
+    : m_window(0)
+    , m_silenceThreshold(-50.0)
+{
+}
+
+/*!
+ * \brief Returns the size of the window in bytes of the stream captured by \a capture.
+ */
+qint64 CutRefiner::windowSize(const PcmCapture &capture) const
+{
+    const auto size = static_cast<qint64>(m_window) * capture.byteRate() / 1000;
+    return size - size % capture.frameSize();
+}
+
+/*!
+ * \brief Computes the sum of squares and the peak of the specified interleaved \a samples.
+ * \remarks This is the hot path of refining cuts so it processes eight samples at a time using SSE2 if available.
+ */
+void CutRefiner::analyze(const std::int16_t *samples, std::size_t count, std::uint64_t &sumOfSquares, int &peak)
+{
+    auto sum = std::uint64_t(0);
+    auto maxValue = 0;
+    auto i = std::size_t(0);
+#ifdef __SSE2__
+    const auto zero = _mm_setzero_si128();
+    auto sums = _mm_setzero_si128();
+    auto peaks = _mm_setzero_si128();
+    for (; i + 8 <= count; i += 8) {
+        const auto values = _mm_loadu_si128(reinterpret_cast<const __m128i *>(samples + i));
+        // the sum of two squares only exceeds the signed range for two samples of -32768 so treat it as unsigned
+        const auto squares = _mm_madd_epi16(values, values);
+        sums = _mm_add_epi64(sums, _mm_unpacklo_epi32(squares, zero));
+        sums = _mm_add_epi64(sums, _mm_unpackhi_epi32(squares, zero));
+        // the saturating subtraction maps -32768 to 32767 so the absolute value fits
+        peaks = _mm_max_epi16(peaks, _mm_max_epi16(values, _mm_subs_epi16(zero, values)));
+    }
+    alignas(16) std::uint64_t sumLanes[2];
+    alignas(16) std::int16_t peakLanes[8];
+    _mm_store_si128(reinterpret_cast<__m128i *>(sumLanes), sums);
+    _mm_store_si128(reinterpret_cast<__m128i *>(peakLanes), peaks);
+    sum = sumLanes[0] + sumLanes[1];
+    maxValue = *max_element(begin(peakLanes), end(peakLanes));
+#endif
+    for (; i < count; ++i) {
+        const auto value = static_cast<int>(samples[i]);
+        sum += static_cast<std::uint64_t>(value * value);
+        maxValue = max(maxValue, abs(value));
+    }
+    sumOfSquares = sum;
+    peak = maxValue;
+}
+
+/*!
+ * \brief Returns the index of the analyzed frame with the zero crossing nearest to \a cutFrame.
+ * \remarks Only the first channel is taken into account. Returns -1 if there is no zero crossing.
+ */
+qint64 CutRefiner::nearestZeroCrossing(std::size_t cutFrame, std::size_t frameCount, unsigned int channels) const
+{
+    const auto isCrossing = [&](std::size_t frame) {
+        if (!frame || frame >= frameCount) {
+            return false;
+        }
+        const auto previous = m_samples[(frame - 1) * channels], current = m_samples[frame * channels];
+        return (previous < 0) != (current < 0) || !current;
+    };
+    for (auto distance = std::size_t(0); distance <= max(cutFrame, frameCount - cutFrame); ++distance) {
+        if (distance <= cutFrame && isCrossing(cutFrame - distance)) {
+            return static_cast<qint64>(cutFrame - distance);
+        }
+        if (isCrossing(cutFrame + distance)) {
+            return static_cast<qint64>(cutFrame + distance);
+        }
+    }
+    return -1;
+}
+
+/*!
+ * \brief Returns the refined offset for the specified \a cut within the stream captured by \a capture.
+ * \remarks
+ * - Only data which is still buffered and within [\a lowerBound, \a upperBound] is taken into account. The returned
+ *   offset is within that range as well.
+ * - Returns \a cut unchanged if refining is disabled or the data around it is not available.
+ */
+qint64 CutRefiner::refine(const PcmCapture &capture, qint64 cut, qint64 lowerBound, qint64 upperBound)
+{
+    if (!isEnabled()) {
+        return cut;
+    }
+    const auto &buffer = capture.buffer();
+    const auto frameSize = capture.frameSize();
+    const auto window = windowSize(capture);
+    auto from = max({ cut - window, lowerBound, static_cast<qint64>(buffer.oldestOffset()) });
+    from -= from % frameSize;
+    auto to = min(cut + window, upperBound);
+    to -= to % frameSize;
+    if (from >= to || cut < from || cut > to) {
+        return cut;
+    }
+    // copy the window so blocks crossing the end of the ring buffer can be analyzed in one go
+    m_samples.resize(static_cast<std::size_t>((to - from) / 2));
+    if (!buffer.read(static_cast<std::uint64_t>(from), reinterpret_cast<char *>(m_samples.data()), static_cast<std::size_t>(to - from))) {
+        return cut;
+    }
+    // find the silent block nearest to the cut
+    const auto channels = capture.channels();
+    const auto blockFrames = max<std::size_t>(capture.sampleRate() / 100, 1);
+    const auto frameCount = m_samples.size() / channels;
+    const auto cutFrame = static_cast<std::size_t>((cut - from) / frameSize);
+    const auto threshold = 32768.0 * pow(10.0, m_silenceThreshold / 20.0);
+    const auto maxMeanSquare = threshold * threshold;
+    const auto maxPeak = static_cast<int>(threshold * 4.0);
+    auto bestFrame = qint64(-1);
+    auto bestDistance = frameCount;
+    for (auto block = std::size_t(0); block + blockFrames <= frameCount; block += blockFrames) {
+        auto sumOfSquares = std::uint64_t(0);
+        auto peak = 0;
+        analyze(m_samples.data() + block * channels, blockFrames * channels, sumOfSquares, peak);
+        if (static_cast<double>(sumOfSquares) / static_cast<double>(blockFrames * channels) > maxMeanSquare || peak > maxPeak) {
+            continue;
+        }
+        const auto middle = block + blockFrames / 2;
+        const auto distance = middle > cutFrame ? middle - cutFrame : cutFrame - middle;
+        if (distance < bestDistance) {
+            bestFrame = static_cast<qint64>(middle);
+            bestDistance = distance;
+        }
+    }
+    // fall back to the nearest zero crossing
+    if (bestFrame < 0) {
+        bestFrame = nearestZeroCrossing(cutFrame, frameCount, channels);
+    }
+    return bestFrame < 0 ? cut : from + bestFrame * frameSize;
+}
+} // namespace DBusSoundRecorder
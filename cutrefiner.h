@@ -0,0 +1,80 @@
+#ifndef CUTREFINER_H
+#define CUTREFINER_H
+
+#include <QtGlobal>
+
+#include <cstdint>
+#include <vector>
+
+namespace DBusSoundRecorder {
+
+class PcmCapture;
+
+/*!
+ * \brief The CutRefiner class moves cuts within the continuously captured stream to the nearest silence.
+ *
+ * The time a song change is signaled via D-Bus is off by tens to hundreds of milliseconds depending on the buffering
+ * of the player. So the captured audio around a cut is analyzed in blocks of 10 ms: the cut is moved into the silent
+ * block nearest to it (judged by RMS and peak level). If there is no silence within the window, the cut is moved to
+ * the nearest zero crossing at least so it does not produce a click.
+ */
+class CutRefiner {
+public:
+    CutRefiner();
+
+    bool isEnabled() const;
+    unsigned int window() const;
+    void setWindow(unsigned int milliseconds);
+    double silenceThreshold() const;
+    void setSilenceThreshold(double dbfs);
+    qint64 windowSize(const PcmCapture &capture) const;
+
+    qint64 refine(const PcmCapture &capture, qint64 cut, qint64 lowerBound, qint64 upperBound);
+
+    static void analyze(const std::int16_t *samples, std::size_t count, std::uint64_t &sumOfSquares, int &peak);
+
+private:
+    qint64 nearestZeroCrossing(std::size_t cutFrame, std::size_t frameCount, unsigned int channels) const;
+
+    unsigned int m_window;
+    double m_silenceThreshold;
+    std::vector<std::int16_t> m_samples;
+};
+
+/*!
+ * \brief Returns whether cuts are refined at all.
+ */
+inline bool CutRefiner::isEnabled() const
+{
+    return m_window > 0;
+}
+
+inline unsigned int CutRefiner::window() const
+{
+    return m_window;
+}
+
+/*!
+ * \brief Sets the time in milliseconds a cut might be moved in either direction. Zero disables refining cuts.
+ */
+inline void CutRefiner::setWindow(unsigned int milliseconds)
+{
+    m_window = milliseconds;
+}
+
+inline double CutRefiner::silenceThreshold() const
+{
+    return m_silenceThreshold;
+}
+
+/*!
+ * \brief Sets the RMS level in dBFS below which audio is considered silent (default is -50 dBFS).
+ * \remarks The peak level must not exceed the threshold by more than 12 dB.
+ */
+inline void CutRefiner::setSilenceThreshold(double dbfs)
+{
+    m_silenceThreshold = dbfs;
+}
+} // namespace DBusSoundRecorder
+
+#endif // CUTREFINER_H
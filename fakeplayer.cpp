@@ -0,0 +1,255 @@
+#include "fakeplayer.h"
+#include "playerwatcher.h"
+
+#include <QDBusMessage>
+#include <QProcess>
+#include <QTimer>
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace DBusSoundRecorder {
+
+inline ostream &operator<<(ostream &stream, const QString &str)
+{
+    return stream << str.toLocal8Bit().data();
+}
+
+/*!
+ * \brief Returns the title of the song according to the specified \a properties.
+ */
+inline QString titleFromProperties(const QVariantMap &properties)
+{
+    return properties.value(QStringLiteral("Metadata")).toMap().value(QStringLiteral("xesam:title")).toString();
+}
+
+FakePlayerAdaptor::FakePlayerAdaptor(FakePlayer *player)
+    : QDBusAbstractAdaptor(player)
+    , m_player(player)
+{
+}
+
+QString FakePlayerAdaptor::playbackStatus() const
+{
+    return m_player->properties().value(QStringLiteral("PlaybackStatus"), QStringLiteral("Stopped")).toString();
+}
+
+QVariantMap FakePlayerAdaptor::metadata() const
+{
+    return m_player->properties().value(QStringLiteral("Metadata")).toMap();
+}
+
+qlonglong FakePlayerAdaptor::position() const
+{
+    return m_player->position();
+}
+
+double FakePlayerAdaptor::rate() const
+{
+    return m_player->properties().value(QStringLiteral("Rate"), 1.0).toDouble();
+}
+
+/*!
+ * \brief Does nothing; the playback is only controlled by the trace.
+ */
+void FakePlayerAdaptor::Play()
+{
+}
+
+void FakePlayerAdaptor::Pause()
+{
+}
+
+void FakePlayerAdaptor::Stop()
+{
+}
+
+void FakePlayerAdaptor::PlayPause()
+{
+}
+
+FakePlayer::FakePlayer(const QDBusConnection &connection, const QString &appName, QObject *parent)
+    : QObject(parent)
+    , m_connection(connection)
+    , m_serviceName(QStringLiteral("org.mpris.MediaPlayer2.%1").arg(appName))
+    , m_adaptor(new FakePlayerAdaptor(this))
+    , m_nextEvent(0)
+    , m_speed(1.0)
+    , m_timer(new QTimer(this))
+    , m_position(0)
+{
+    m_timer->setSingleShot(true);
+    m_timer->setTimerType(Qt::PreciseTimer);
+    connect(m_timer, &QTimer::timeout, this, &FakePlayer::replayNextEvent);
+}
+
+/*!
+ * \brief Exports the player on its connection.
+ * \returns Returns whether the player could be exported.
+ */
+bool FakePlayer::registerService()
+{
+    if (!m_connection.registerObject(QStringLiteral("/org/mpris/MediaPlayer2"), this, QDBusConnection::ExportAdaptors)) {
+        cerr << "Error: Unable to register fake player object: " << m_connection.lastError().message() << endl;
+        return false;
+    }
+    if (!m_connection.registerService(m_serviceName)) {
+        cerr << "Error: Unable to register fake player service \"" << m_serviceName << "\": " << m_connection.lastError().message() << endl;
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * \brief Replays the specified \a events; the time between events is divided by \a speed.
+ * \remarks Returns immediately. The finished() signal is emitted after the last event has been replayed.
+ */
+void FakePlayer::replay(const std::vector<TraceEvent> &events, double speed)
+{
+    m_events = events;
+    m_nextEvent = 0;
+    m_speed = speed > 0.0 ? speed : 1.0;
+    m_replayStart = Clock::now();
+    scheduleNextEvent();
+}
+
+/*!
+ * \brief Returns the playback position in microseconds.
+ * \remarks The position advances while the trace says the player is playing (sped up like the replay) like the position
+ *          of a real player would.
+ */
+qlonglong FakePlayer::position() const
+{
+    if (m_properties.value(QStringLiteral("PlaybackStatus")).toString() != QLatin1String("Playing")) {
+        return m_position;
+    }
+    const auto elapsed = chrono::duration_cast<chrono::microseconds>(Clock::now() - m_positionTime).count();
+    return m_position + static_cast<qlonglong>(static_cast<double>(elapsed) * m_speed);
+}
+
+void FakePlayer::setPosition(qlonglong position)
+{
+    m_position = position;
+    m_positionTime = Clock::now();
+}
+
+/*!
+ * \brief Measures the time it takes the specified \a watcher to signal song changes.
+ */
+void FakePlayer::measureSwitchLatency(PlayerWatcher &watcher)
+{
+    connect(&watcher, &PlayerWatcher::nextSong, this, &FakePlayer::songChanged);
+}
+
+/*!
+ * \brief Prints the measured switch latencies.
+ */
+void FakePlayer::printStatistics() const
+{
+    cerr << "Replayed " << m_nextEvent << " of " << m_events.size() << " events, " << m_switchLatencies.size() << " song changes" << endl;
+    if (m_switchLatencies.empty()) {
+        return;
+    }
+    const auto minmax = minmax_element(m_switchLatencies.cbegin(), m_switchLatencies.cend());
+    auto total = chrono::microseconds::zero();
+    for (const auto latency : m_switchLatencies) {
+        total += latency;
+    }
+    cerr << "Switch latency (ms): min " << minmax.first->count() / 1000.0 << ", mean "
+         << total.count() / 1000.0 / static_cast<double>(m_switchLatencies.size()) << ", max " << minmax.second->count() / 1000.0 << endl;
+}
+
+void FakePlayer::scheduleNextEvent()
+{
+    if (m_nextEvent >= m_events.size()) {
+        emit finished();
+        return;
+    }
+    const auto due = m_replayStart + chrono::duration_cast<Clock::duration>(m_events[m_nextEvent].time / m_speed);
+    const auto delay = chrono::duration_cast<chrono::milliseconds>(due - Clock::now()).count();
+    m_timer->start(static_cast<int>(max<decltype(delay)>(delay, 0)));
+}
+
+void FakePlayer::replayNextEvent()
+{
+    // replay all events which are due (several events might have the same time, especially when sped up)
+    const auto now = Clock::now();
+    while (m_nextEvent < m_events.size()
+        && m_replayStart + chrono::duration_cast<Clock::duration>(m_events[m_nextEvent].time / m_speed) <= now) {
+        emitEvent(m_events[m_nextEvent]);
+        emit eventReplayed(static_cast<int>(m_nextEvent++));
+    }
+    scheduleNextEvent();
+}
+
+void FakePlayer::songChanged()
+{
+    if (m_songChangeTime == Clock::time_point()) {
+        return;
+    }
+    m_switchLatencies.emplace_back(chrono::duration_cast<chrono::microseconds>(Clock::now() - m_songChangeTime));
+    m_songChangeTime = Clock::time_point();
+}
+
+/*!
+ * \brief Applies the specified \a event to the properties of the player and emits the corresponding D-Bus signal.
+ */
+void FakePlayer::emitEvent(const TraceEvent &event)
+{
+    if (event.type == TraceEvent::Type::Seeked) {
+        setPosition(event.position);
+        emit m_adaptor->Seeked(event.position);
+        return;
+    }
+    // keep track of the first update of a song change for measuring the latency
+    const auto previousTitle = titleFromProperties(m_properties);
+    setPosition(position());
+    if (event.type == TraceEvent::Type::Properties) {
+        m_properties = event.properties;
+    } else {
+        for (auto i = event.properties.cbegin(), end = event.properties.cend(); i != end; ++i) {
+            m_properties[i.key()] = i.value();
+        }
+    }
+    const auto titleChanged = titleFromProperties(m_properties) != previousTitle;
+    if (m_songChangeTime == Clock::time_point() && titleChanged) {
+        m_songChangeTime = Clock::now();
+    }
+    // a new song starts from the beginning unless the trace says otherwise
+    if (event.properties.contains(QStringLiteral("Position"))) {
+        setPosition(event.properties.value(QStringLiteral("Position")).toLongLong());
+    } else if (titleChanged) {
+        setPosition(0);
+    }
+    // a GetAll reply is replayed as PropertiesChanged signal containing all properties
+    auto message = QDBusMessage::createSignal(
+        QStringLiteral("/org/mpris/MediaPlayer2"), QStringLiteral("org.freedesktop.DBus.Properties"), QStringLiteral("PropertiesChanged"));
+    message << QStringLiteral("org.mpris.MediaPlayer2.Player") << event.properties << event.invalidatedProperties;
+    if (!m_connection.send(message)) {
+        cerr << "Warning: Unable to send PropertiesChanged signal: " << m_connection.lastError().message() << endl;
+    }
+}
+
+/*!
+ * \brief Starts a private D-Bus daemon using the specified \a daemon process.
+ * \returns Returns the address of the bus.
+ * \throws Throws std::runtime_error if the daemon could not be started.
+ * \remarks The daemon is stopped when \a daemon is destroyed.
+ */
+QString startPrivateBus(QProcess &daemon)
+{
+    daemon.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    daemon.start(QStringLiteral("dbus-daemon"), QStringList({ QStringLiteral("--session"), QStringLiteral("--nofork"), QStringLiteral("--print-address") }));
+    if (!daemon.waitForStarted() || !daemon.waitForReadyRead(5000)) {
+        throw runtime_error("unable to start private D-Bus daemon: " + daemon.errorString().toStdString());
+    }
+    const auto address = QString::fromLocal8Bit(daemon.readLine().trimmed());
+    if (address.isEmpty()) {
+        throw runtime_error("private D-Bus daemon did not print its address");
+    }
+    return address;
+}
+} // namespace DBusSoundRecorder
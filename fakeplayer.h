@@ -0,0 +1,113 @@
+#ifndef FAKEPLAYER_H
+#define FAKEPLAYER_H
+
+#include "trace.h"
+
+#include <QDBusAbstractAdaptor>
+#include <QDBusConnection>
+#include <QObject>
+
+#include <chrono>
+#include <vector>
+
+QT_FORWARD_DECLARE_CLASS(QProcess)
+QT_FORWARD_DECLARE_CLASS(QTimer)
+
+namespace DBusSoundRecorder {
+
+class FakePlayer;
+class PlayerWatcher;
+
+/*!
+ * \brief The FakePlayerAdaptor class exports the MPRIS player interface of a FakePlayer.
+ */
+class FakePlayerAdaptor : public QDBusAbstractAdaptor {
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "org.mpris.MediaPlayer2.Player")
+    Q_PROPERTY(QString PlaybackStatus READ playbackStatus)
+    Q_PROPERTY(QVariantMap Metadata READ metadata)
+    Q_PROPERTY(qlonglong Position READ position)
+    Q_PROPERTY(double Rate READ rate)
+
+public:
+    explicit FakePlayerAdaptor(FakePlayer *player);
+
+    QString playbackStatus() const;
+    QVariantMap metadata() const;
+    qlonglong position() const;
+    double rate() const;
+
+public Q_SLOTS:
+    void Play();
+    void Pause();
+    void Stop();
+    void PlayPause();
+
+Q_SIGNALS:
+    void Seeked(qlonglong Position);
+
+private:
+    FakePlayer *m_player;
+};
+
+/*!
+ * \brief The FakePlayer class provides an MPRIS service which replays a trace recorded via PlayerWatcher::setTraceFile().
+ *
+ * Events are replayed with the timing of the trace, optionally sped up. This allows reproducing the D-Bus traffic of a
+ * real player (including its timing at track boundaries) without the player and without audio hardware. The fake
+ * player is supposed to be exported on a private bus (see startPrivateBus()).
+ *
+ * When a PlayerWatcher is specified via measureSwitchLatency(), the time between the first meta data update of a song
+ * change and the PlayerWatcher::nextSong() signal is measured and printed when the replay has finished.
+ */
+class FakePlayer : public QObject {
+    Q_OBJECT
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit FakePlayer(const QDBusConnection &connection, const QString &appName, QObject *parent = nullptr);
+
+    bool registerService();
+    const QVariantMap &properties() const;
+    qlonglong position() const;
+    void replay(const std::vector<TraceEvent> &events, double speed = 1.0);
+    void measureSwitchLatency(PlayerWatcher &watcher);
+    void printStatistics() const;
+
+Q_SIGNALS:
+    void eventReplayed(int index);
+    void finished();
+
+private Q_SLOTS:
+    void replayNextEvent();
+    void songChanged();
+
+private:
+    void emitEvent(const TraceEvent &event);
+    void setPosition(qlonglong position);
+    void scheduleNextEvent();
+
+    QDBusConnection m_connection;
+    const QString m_serviceName;
+    FakePlayerAdaptor *m_adaptor;
+    QVariantMap m_properties;
+    std::vector<TraceEvent> m_events;
+    std::size_t m_nextEvent;
+    double m_speed;
+    QTimer *m_timer;
+    Clock::time_point m_replayStart;
+    Clock::time_point m_songChangeTime;
+    qlonglong m_position;
+    Clock::time_point m_positionTime;
+    std::vector<std::chrono::microseconds> m_switchLatencies;
+};
+
+inline const QVariantMap &FakePlayer::properties() const
+{
+    return m_properties;
+}
+
+QString startPrivateBus(QProcess &daemon);
+} // namespace DBusSoundRecorder
+
+#endif // FAKEPLAYER_H
@@ -1,12 +1,33 @@
 #include "ffmpeglauncher.h"
+#include "albuminfocache.h"
+#include "cutrefiner.h"
+#include "fileverifier.h"
+#include "ffmpegprocess.h"
+#include "fingerprint.h"
+#include "loudnessmeter.h"
+#include "metrics.h"
+#include "pcmcapture.h"
+#include "pcmfanout.h"
 #include "playerwatcher.h"
+#include "processpool.h"
+#include "recordingindex.h"
+#include "recordingjournal.h"
+#include "spoolfile.h"
+#include "stagingarea.h"
+#ifdef DBUS_SOUNDRECORDER_USE_TAGPARSER
+#include "tagwriter.h"
+#endif
 
-#include <c++utilities/conversion/stringconversion.h>
-#include <c++utilities/io/inifile.h>
-
+#include <QCoreApplication>
+#include <QFile>
+#include <QFileInfo>
+#include <QRegularExpression>
 #include <QStringBuilder>
+#include <QTimer>
+#include <QUrl>
 
-#include <fstream>
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 
 using namespace std;
@@ -14,6 +35,19 @@ using namespace CppUtilities;
 
 namespace DBusSoundRecorder {
 
+/// \brief The duration of audio in seconds after which a track is matched against the known fingerprints.
+constexpr double fingerprintMatchTime = 5.0;
+/// \brief The maximum number of sub-fingerprints stored per track (about 12 seconds).
+constexpr std::size_t fingerprintLength = 256;
+/// \brief The distance in milliseconds kept to the oldest buffered data when seeding a segment from the ring buffer.
+/// \remarks The producer overwrites the oldest data next, so the margin needs to exceed the size of the chunks it reads
+///          (20 ms via libpulse, up to a pipe buffer of 64 KiB via ffmpeg).
+constexpr qint64 overwriteMargin = 500;
+/// \brief The time in milliseconds the previous per-track process keeps recording after the next one has been started.
+/// \remarks The process has only been spawned at that point; opening the source and initializing the encoder takes
+///          another 100 to 300 ms.
+constexpr int handoverOverlap = 500;
+
 inline ostream &operator<<(ostream &stream, const QString &str)
 {
     stream << str.toLocal8Bit().data();
@@ -39,6 +73,27 @@ inline QString validFileName(const QString &text)
     return copy;
 }
 
+/*!
+ * \brief Returns the path of the album directory relative to the target directory.
+ */
+QString albumDirPath(const QString &artist, const QString &album)
+{
+    static const QString miscCategory(QStringLiteral("misc"));
+    return QStringLiteral("%1/%2").arg(artist.isEmpty() ? miscCategory : validFileName(artist), artist.isEmpty() ? miscCategory : validFileName(album));
+}
+
+/*!
+ * \brief Parses a duration specified as "[[HH:]MM:]SS[.m...]" as accepted by ffmpeg's "-t" option.
+ */
+TimeSpan parseDuration(const QString &duration)
+{
+    auto seconds = 0.0;
+    for (const auto &part : duration.trimmed().split(QChar(':'))) {
+        seconds = seconds * 60.0 + part.toDouble();
+    }
+    return TimeSpan::fromSeconds(seconds);
+}
+
 FfmpegLauncher::FfmpegLauncher(PlayerWatcher &watcher, QObject *parent)
     : QObject(parent)
     , m_watcher(watcher)
@@ -47,12 +102,265 @@ FfmpegLauncher::FfmpegLauncher(PlayerWatcher &watcher, QObject *parent)
     , m_options()
     , m_targetDir(QStringLiteral("."))
     , m_targetExtension(QStringLiteral(".m4a"))
-    , m_ffmpeg(new QProcess(this))
+    , m_ffmpegBinary(QStringLiteral("ffmpeg"))
+    , m_currentRecorder(nullptr)
+    , m_previousRecorder(nullptr)
+    , m_capture(new PcmCapture(this))
+    , m_fanout(nullptr)
+    , m_cutRefiner(make_unique<CutRefiner>())
+    , m_continuousCapture(false)
+    , m_preroll(0)
+    , m_analyzingLoudness(false)
+    , m_encoderPool(new ProcessPool(this))
+    , m_albumInfoCache(make_shared<AlbumInfoCache>())
+    , m_skipRecorded(false)
+    , m_fingerprinting(false)
+    , m_captureLost(false)
 {
+    connect(&watcher, &PlayerWatcher::albumChanged, this, &FfmpegLauncher::warmUpAlbumInfo);
     connect(&watcher, &PlayerWatcher::nextSong, this, &FfmpegLauncher::nextSong);
     connect(&watcher, &PlayerWatcher::playbackStopped, this, &FfmpegLauncher::stopFfmpeg);
-    connect(m_ffmpeg, &QProcess::started, this, &FfmpegLauncher::ffmpegStarted);
-    connect(m_ffmpeg,
+    connect(&watcher, &PlayerWatcher::positionChanged, this, &FfmpegLauncher::updateSongEnd);
+    connect(&watcher, &PlayerWatcher::metadataUpdated, this, &FfmpegLauncher::updateTags);
+    connect(m_capture, &PcmCapture::pcmAvailable, this, &FfmpegLauncher::dispatchPcm);
+    connect(m_capture, &PcmCapture::stopped, this, &FfmpegLauncher::captureStopped);
+}
+
+CaptureBackend FfmpegLauncher::captureBackend() const
+{
+    return m_capture->backend();
+}
+
+/*!
+ * \brief Sets the backend used for capturing the sink continuously.
+ * \remarks Has no effect unless capturing continuously; per-track processes always capture the sink themselves.
+ */
+void FfmpegLauncher::setCaptureBackend(CaptureBackend backend)
+{
+    m_capture->setBackend(backend);
+}
+
+void FfmpegLauncher::setSampleRate(unsigned int sampleRate)
+{
+    m_capture->setSampleRate(sampleRate);
+}
+
+void FfmpegLauncher::setChannels(unsigned int channels)
+{
+    m_capture->setChannels(channels);
+}
+
+/*!
+ * \brief Sets the directory to store spool files in and creates it if it does not exist yet.
+ * \remarks Spooling is only done when capturing continuously. Setting an empty path disables spooling.
+ * \returns Returns whether the directory exists (or could be created); otherwise an error is logged.
+ */
+bool FfmpegLauncher::setSpoolDir(const QString &path)
+{
+    m_spoolDir = path;
+    if (!path.isEmpty() && !QDir().mkpath(path)) {
+        cerr << "Error: Can not create spool directory: " << path << endl;
+        return false;
+    }
+    return true;
+}
+
+int FfmpegLauncher::encoderJobs() const
+{
+    return m_encoderPool->maxJobs();
+}
+
+/*!
+ * \brief Sets the maximum number of spool files encoded in parallel (defaults to the number of cores).
+ */
+void FfmpegLauncher::setEncoderJobs(int jobs)
+{
+    m_encoderPool->setMaxJobs(jobs);
+}
+
+int FfmpegLauncher::encoderBacklog() const
+{
+    return m_encoderPool->maxBacklog();
+}
+
+/*!
+ * \brief Sets the maximum number of spool files waiting to be encoded.
+ * \remarks Spool files exceeding the backlog are kept and must be encoded manually.
+ */
+void FfmpegLauncher::setEncoderBacklog(int backlog)
+{
+    m_encoderPool->setMaxBacklog(backlog);
+}
+
+/*!
+ * \brief Sets the pool used to encode spool files.
+ * \remarks The launcher does not take ownership of the specified \a pool. This allows multiple launchers to share
+ *          one pool so the number of encoders running in parallel stays bounded. The pool must not be destroyed
+ *          before the launcher.
+ */
+void FfmpegLauncher::setEncoderPool(ProcessPool *pool)
+{
+    if (pool == m_encoderPool) {
+        return;
+    }
+    if (m_encoderPool->parent() == this) {
+        delete m_encoderPool;
+    }
+    m_encoderPool = pool;
+}
+
+/*!
+ * \brief Sets the path of the recording index to use. An empty \a path disables the index.
+ * \remarks The index is loaded when it is set. Launchers using the same path share the index.
+ */
+void FfmpegLauncher::setRecordingIndex(const QString &path)
+{
+    m_recordingIndex = path.isEmpty() ? nullptr : RecordingIndex::open(path);
+}
+
+/*!
+ * \brief Returns the path of the socket readers of the captured PCM stream attach to or an empty string if not
+ *        publishing the stream.
+ */
+QString FfmpegLauncher::pcmFanoutSocket() const
+{
+    return m_fanout ? m_fanout->socketPath() : QString();
+}
+
+/*!
+ * \brief Publishes the continuously captured PCM stream to local readers attaching via the socket at \a path.
+ * \remarks
+ * - An empty \a path stops publishing. See PcmFanout for details.
+ * - Must be set before capturing has been started.
+ * \returns Returns whether the socket could be created.
+ */
+bool FfmpegLauncher::setPcmFanoutSocket(const QString &path)
+{
+    m_capture->setFanout(nullptr);
+    delete m_fanout;
+    m_fanout = nullptr;
+    if (path.isEmpty()) {
+        return true;
+    }
+    m_fanout = new PcmFanout(this);
+    if (!m_fanout->listen(path)) {
+        delete m_fanout;
+        m_fanout = nullptr;
+        return false;
+    }
+    m_capture->setFanout(m_fanout);
+    return true;
+}
+
+/*!
+ * \brief Returns whether writing tags after a file has been finished is supported.
+ * \remarks This requires tagparser to be enabled at build time.
+ */
+bool FfmpegLauncher::isTaggingAfterwardsSupported()
+{
+#ifdef DBUS_SOUNDRECORDER_USE_TAGPARSER
+    return true;
+#else
+    return false;
+#endif
+}
+
+/*!
+ * \brief Sets whether tags are written after a file has been finished instead of passing them to ffmpeg.
+ *
+ * This way the final meta data is used, including corrections the player sends after the track started (see
+ * updateTags()). The tags are written in the background, patching only the tags (see TagWriter).
+ *
+ * \remarks Has no effect if not supported (see isTaggingAfterwardsSupported()).
+ */
+void FfmpegLauncher::setTaggingAfterwards(bool taggingAfterwards)
+{
+#ifdef DBUS_SOUNDRECORDER_USE_TAGPARSER
+    if (!taggingAfterwards) {
+        m_tagWriter.reset();
+    } else if (!m_tagWriter) {
+        m_tagWriter = make_shared<TagWriter>();
+    }
+#else
+    Q_UNUSED(taggingAfterwards)
+#endif
+}
+
+/*!
+ * \brief Returns whether neither capturing nor encoding is ongoing so the launcher can be destroyed without losing data.
+ * \remarks Jobs of a shared encoder pool (see setEncoderPool()) are not taken into account as they outlive the launcher.
+ */
+bool FfmpegLauncher::isIdle() const
+{
+    if (m_capture->isRunning() || !m_segments.isEmpty()) {
+        return false;
+    }
+    if (m_encoderPool->parent() == this && (m_encoderPool->runningJobs() || m_encoderPool->queuedJobs())) {
+        return false;
+    }
+    for (const auto *const recorder : m_recorders) {
+        if (recorder->state() != QProcess::NotRunning) {
+            return false;
+        }
+    }
+    return true;
+}
+
+unsigned int FfmpegLauncher::refineWindow() const
+{
+    return m_cutRefiner->window();
+}
+
+/*!
+ * \brief Sets the time in milliseconds cuts might be moved to the nearest silence when capturing continuously.
+ * \remarks Zero disables refining cuts. The window must not exceed the duration set via setPrerollBuffer(). Encoding
+ *          lags behind capturing by the window. See CutRefiner for details.
+ */
+void FfmpegLauncher::setRefineWindow(unsigned int milliseconds)
+{
+    m_cutRefiner->setWindow(milliseconds);
+}
+
+/*!
+ * \brief Sets the level in dBFS below which captured audio is considered silent when refining cuts.
+ */
+void FfmpegLauncher::setSilenceThreshold(double dbfs)
+{
+    m_cutRefiner->setSilenceThreshold(dbfs);
+}
+
+/*!
+ * \brief Sets the duration of captured audio which is kept for seeding new recordings when capturing continuously.
+ */
+void FfmpegLauncher::setPrerollBuffer(double seconds)
+{
+    m_capture->setBufferDuration(seconds);
+}
+
+/*!
+ * \brief Returns a recorder slot which is currently not in use.
+ * \remarks The pool usually consists of only two slots: one for the track which is currently being recorded
+ *          and one for the next track. Further slots are only added if a previous process has not been
+ *          reaped yet so starting the next recording never needs to wait for a previous process. A slot is
+ *          also considered in use as long as a segment or a pending recording refers to it.
+ */
+FfmpegProcess *FfmpegLauncher::idleRecorder()
+{
+    const auto isInUse = [this](FfmpegProcess *recorder) {
+        if (recorder == m_currentRecorder || recorder == m_previousRecorder || recorder->state() != QProcess::NotRunning
+            || m_recorderRecordings.contains(recorder)) {
+            return true;
+        }
+        return any_of(m_segments.cbegin(), m_segments.cend(), [recorder](const Segment &segment) { return segment.encoder == recorder; });
+    };
+    for (auto *const recorder : m_recorders) {
+        if (!isInUse(recorder)) {
+            return recorder;
+        }
+    }
+    auto *const recorder = new FfmpegProcess(this);
+    connect(recorder, &QProcess::started, this, &FfmpegLauncher::ffmpegStarted);
+    connect(recorder,
 #if QT_VERSION < QT_VERSION_CHECK(5, 6, 0) || (QT_DEPRECATED_SINCE(5, 6) && QT_VERSION < QT_VERSION_CHECK(6, 0, 0))
         static_cast<void (QProcess::*)(QProcess::ProcessError)>(
 #endif
@@ -62,45 +370,89 @@ FfmpegLauncher::FfmpegLauncher(PlayerWatcher &watcher, QObject *parent)
 #endif
             ,
         this, &FfmpegLauncher::ffmpegError);
-    connect(m_ffmpeg, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished), this, &FfmpegLauncher::ffmpegFinished);
-    m_ffmpeg->setProgram(QStringLiteral("ffmpeg"));
-    m_ffmpeg->setProcessChannelMode(QProcess::ForwardedChannels);
+    connect(recorder, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished), this, &FfmpegLauncher::ffmpegFinished);
+    recorder->setProcessChannelMode(QProcess::ForwardedChannels);
+    m_recorders << recorder;
+    return recorder;
 }
 
-void addMetaData(QStringList &args, const QString &field, const QString &value)
+FfmpegLauncher::~FfmpegLauncher()
 {
-    if (!value.isEmpty()) {
-        args << QStringLiteral("-metadata");
-        args << QStringLiteral("%1=%2").arg(field, value);
-    }
+}
+
+/*!
+ * \brief Loads the info.ini of the specified album in the background so it is ready when the next song starts.
+ */
+void FfmpegLauncher::warmUpAlbumInfo(const QString &artist, const QString &album)
+{
+    m_albumInfoCache->warmUp(QDir::cleanPath(m_targetDir.absoluteFilePath(albumDirPath(artist, album))));
 }
 
 void FfmpegLauncher::nextSong()
 {
     // skip ads
     if (m_watcher.isAd()) {
+        Metrics::instance().increment(Metrics::Counter::AdsSkipped);
+        if (m_fingerprinting && m_continuousCapture && m_recordingIndex) {
+            // capture the ad nevertheless to learn its fingerprint
+            Recording recording;
+            recording.songChangeTime = m_watcher.songChangeTime();
+            recording.length = m_watcher.length();
+            startSegment(recording, true);
+        } else {
+            endRecording();
+        }
+        return;
+    }
+    // skip tracks which have already been recorded completely
+    Recording recording;
+    recording.songChangeTime = m_watcher.songChangeTime();
+    recording.key = RecordingIndex::key(m_watcher.artist(), m_watcher.album(), m_watcher.title(), m_watcher.trackNumber());
+    if (m_skipRecorded && m_recordingIndex && m_recordingIndex->isRecorded(recording.key)) {
+        cerr << "Skipping \"" << m_watcher.title() << "\" which has already been recorded" << endl;
+        endRecording();
+        return;
+    }
+    if (!prepareRecording(recording)) {
+        endRecording();
         return;
     }
-    // pause player until ffmpeg has been started
-    m_watcher.setSilent(true);
-    if (m_watcher.isPlaying()) {
-        m_watcher.pause();
+    // log the recording before starting it so the file is known to be incomplete if the process dies
+    if (m_recordingJournal) {
+        recording.journalId = m_recordingJournal->addStart(
+            recording.writePath, recording.targetPath, static_cast<qint64>(recording.length.totalMilliseconds()), recording.key);
     }
-    // terminate/kill the current process
-    stopFfmpeg();
+    // measure the time until the process recording the previous track is reaped (if there is one)
+    const auto hasPreviousProcess = m_continuousCapture
+        ? any_of(m_segments.cbegin(), m_segments.cend(), [](const Segment &segment) { return segment.encoder != nullptr; })
+        : m_currentRecorder && m_currentRecorder->state() != QProcess::NotRunning;
+    if (hasPreviousProcess) {
+        m_pendingReapSongChangeTime = recording.songChangeTime;
+    }
+    if (m_continuousCapture) {
+        startSegment(recording);
+    } else {
+        startRecorder(recording);
+    }
+}
+
+/*!
+ * \brief Determines the target path, length and meta data for recording the current song.
+ * \remarks Creates the target directory if it does not exist yet and the staged file if a staging area is used.
+ */
+bool FfmpegLauncher::prepareRecording(Recording &recording)
+{
     // determine output file, create target directory
-    static const QString miscCategory(QStringLiteral("misc"));
     static const QString unknownTitle(QStringLiteral("unknown track"));
-    const auto targetDirPath = QStringLiteral("%1/%2").arg(m_watcher.artist().isEmpty() ? miscCategory : validFileName(m_watcher.artist()),
-        m_watcher.artist().isEmpty() ? miscCategory : validFileName(m_watcher.album()));
-    if (!m_targetDir.mkpath(targetDirPath)) {
+    const auto targetDirPath = albumDirPath(m_watcher.artist(), m_watcher.album());
+    if (!m_albumInfoCache->makeAlbumDir(QDir::cleanPath(m_targetDir.absoluteFilePath(targetDirPath)))) {
         cerr << "Error: Can not create target directory: " << targetDirPath << endl;
-        return;
+        return false;
     }
     QDir targetDir(m_targetDir);
     targetDir.cd(targetDirPath);
     // determine track number
-    QString number, length, year, genre, totalTracks, totalDisks;
+    QString number;
     if (m_watcher.trackNumber()) {
         if (m_watcher.diskNumber()) {
             number = QStringLiteral("%2-%1").arg(m_watcher.trackNumber(), 2, 10, QLatin1Char('0')).arg(m_watcher.diskNumber());
@@ -111,65 +463,324 @@ void FfmpegLauncher::nextSong()
     if (!number.isEmpty()) {
         number.append(QStringLiteral(" - "));
     }
-    // read additional meta info
-    //  - from an INI file called info.ini in the album directory (must be created before recording)
-    //  - track lengths might be specified for each track in the [length] section (useful to get rid of advertisements at the end)
-    //  - year, genre, total_tracks and total_disks might be specified in the [general] section
-    if (targetDir.exists(QStringLiteral("info.ini"))) {
-        fstream infoFile;
-        infoFile.exceptions(ios_base::badbit | ios_base::failbit);
-        try {
-            infoFile.open((targetDir.path() + QStringLiteral("/info.ini")).toLocal8Bit().data(), ios_base::in);
-            IniFile infoIni;
-            infoIni.parse(infoFile);
-            for (auto &scope : infoIni.data()) {
-                if (scope.first == "length") {
-                    if (m_watcher.trackNumber()) {
-                        // reading length scope is only possible if track number known because the track number is used for mapping
-                        for (const auto &entry : scope.second) {
-                            try {
-                                if (stringToNumber<unsigned int>(entry.first) == m_watcher.trackNumber()) {
-                                    // length entry for this track
-                                    length = QString::fromLocal8Bit(entry.second.data());
-                                    break;
-                                }
-                            } catch (const ConversionException &) {
-                                cerr << "Warning: Ignoring non-numeric key \"" << entry.first << "\" in [length] section of info.ini." << endl;
-                            }
-                        }
-                    }
-                } else if (scope.first == "general") {
-                    for (const auto &entry : scope.second) {
-                        if (entry.first == "year") {
-                            year = QString::fromLocal8Bit(entry.second.data());
-                        } else if (entry.first == "genre") {
-                            genre = QString::fromLocal8Bit(entry.second.data());
-                        } else if (entry.first == "total_tracks") {
-                            totalTracks = QString::fromLocal8Bit(entry.second.data());
-                        } else if (entry.first == "total_disks") {
-                            totalDisks = QString::fromLocal8Bit(entry.second.data());
-                        } else {
-                            cerr << "Warning: Ignoring unknown property \"" << entry.first << "\" in [general] section of info.ini." << endl;
-                        }
-                    }
-                } else {
-                    cerr << "Warning: Ignoring unknown section [" << scope.first << "] in info.ini." << endl;
-                }
+    // read additional meta info from info.ini in the album directory (cached, see AlbumInfoCache)
+    const auto albumInfo = m_albumInfoCache->info(QDir::cleanPath(targetDir.absolutePath()));
+    const auto length = m_watcher.trackNumber() ? albumInfo.lengths.value(m_watcher.trackNumber()) : QString();
+    // determine target name/path, start with the suffix following the last one used according to the index (if any)
+    const auto title = m_watcher.title().isEmpty() ? unknownTitle : validFileName(m_watcher.title());
+    const auto baseName = QStringLiteral("%3%1%2").arg(title, m_targetExtension, number);
+    const auto basePath = targetDir.absoluteFilePath(baseName);
+    const auto targetName = [&](unsigned int count) {
+        return count > 1 ? QStringLiteral("%3%1 (%4)%2").arg(title, m_targetExtension, number).arg(count) : baseName;
+    };
+    auto count = m_recordingIndex ? m_recordingIndex->lastSuffix(basePath) + 1 : 1u;
+    const auto isTaken = [&](unsigned int count) {
+        return targetDir.exists(targetName(count)) || (m_stagingArea && m_stagingArea->isReserved(targetDir.absoluteFilePath(targetName(count))));
+    };
+    while (isTaken(count)) {
+        ++count;
+    }
+    recording.targetPath = targetDir.absoluteFilePath(targetName(count));
+    if (m_recordingIndex) {
+        m_recordingIndex->addFile(basePath, count, recording.targetPath);
+    }
+    // reserve the target name when spooling because the file is only created after the track has been encoded
+    // note: staged files are reserved by the staging area instead
+    if (isSpooling() && !m_stagingArea) {
+        QFile placeholder(recording.targetPath);
+        if (!placeholder.open(QIODevice::WriteOnly)) {
+            cerr << "Error: Can not create target file: " << recording.targetPath << endl;
+            return false;
+        }
+    }
+    // use length if specified in info.ini
+    recording.length = length.isEmpty() ? m_watcher.length() : parseDuration(length);
+    determineTags(recording, albumInfo);
+    // write into the staging area if used, preallocating the file according to the length
+    recording.writePath = m_stagingArea ? m_stagingArea->stage(recording.targetPath, expectedFileSize(recording)) : recording.targetPath;
+    return !recording.writePath.isEmpty();
+}
+
+/*!
+ * \brief Determines the tags of \a recording from the meta data of the current song and the specified \a albumInfo.
+ * \remarks The fields are named like ffmpeg's meta data fields (see TagWriter::writeTags()). Empty fields are omitted.
+ */
+void FfmpegLauncher::determineTags(Recording &recording, const AlbumInfo &albumInfo) const
+{
+    const auto &year = albumInfo.year, &genre = albumInfo.genre, &totalTracks = albumInfo.totalTracks, &totalDisks = albumInfo.totalDisks;
+    auto &tags = recording.tags;
+    const auto addTag = [&tags](const QString &field, const QString &value) {
+        if (!value.isEmpty()) {
+            tags[field] = value;
+        }
+    };
+    tags.clear();
+    addTag(QStringLiteral("title"), m_watcher.title());
+    addTag(QStringLiteral("album"), m_watcher.album());
+    addTag(QStringLiteral("artist"), m_watcher.artist());
+    addTag(QStringLiteral("genre"), genre.isEmpty() ? m_watcher.genre() : genre);
+    addTag(QStringLiteral("year"), year.isEmpty() ? m_watcher.year() : year);
+    if (m_watcher.trackNumber()) {
+        addTag(QStringLiteral("track"),
+            totalTracks.isEmpty() ? QString::number(m_watcher.trackNumber()) : QString::number(m_watcher.trackNumber()) % QChar('/') % totalTracks);
+    }
+    if (m_watcher.diskNumber()) {
+        addTag(QStringLiteral("disk"),
+            totalDisks.isEmpty() ? QString::number(m_watcher.diskNumber()) : QString::number(m_watcher.diskNumber()) % QChar('/') % totalDisks);
+    }
+    // embed the cover art only when tagging afterwards; remote images are not downloaded
+    const QUrl artUrl(m_watcher.artUrl());
+    if (m_tagWriter && artUrl.isLocalFile()) {
+        addTag(QStringLiteral("cover"), artUrl.toLocalFile());
+    }
+}
+
+/*!
+ * \brief Returns the arguments to pass the tags of \a recording to ffmpeg.
+ * \remarks Returns no arguments if tags are written after the file has been finished (see setTaggingAfterwards()).
+ */
+QStringList FfmpegLauncher::metaDataArgs(const Recording &recording) const
+{
+    QStringList args;
+    if (m_tagWriter) {
+        return args;
+    }
+    for (auto i = recording.tags.cbegin(), end = recording.tags.cend(); i != end; ++i) {
+        args << QStringLiteral("-metadata");
+        args << QStringLiteral("%1=%2").arg(i.key(), i.value());
+    }
+    return args;
+}
+
+/*!
+ * \brief Returns the arguments to specify the output file of \a recording.
+ * \remarks A staged file has already been created and preallocated so ffmpeg must overwrite it without truncating it.
+ */
+QStringList FfmpegLauncher::outputArgs(const Recording &recording) const
+{
+    QStringList args;
+    if (recording.writePath != recording.targetPath) {
+        args << QStringLiteral("-y");
+        args << QStringLiteral("-truncate");
+        args << QStringLiteral("0");
+    }
+    args << recording.writePath;
+    return args;
+}
+
+/*!
+ * \brief Returns the expected size of the file of \a recording in bytes or zero if it can not be estimated.
+ * \remarks The estimation is based on the length of the track and the bitrate specified via the ffmpeg options
+ *          ("-b:a", "-ab" or "-b"), assuming 320 kbit/s if none is specified. Some space for the container and tags
+ *          is added.
+ */
+qint64 FfmpegLauncher::expectedFileSize(const Recording &recording) const
+{
+    if (recording.length.isNull()) {
+        return 0;
+    }
+    auto bitrate = 320000.0;
+    static const QRegularExpression bitrateOption(QStringLiteral("-(b(:a)?|ab)"));
+    const auto i = m_options.indexOf(bitrateOption);
+    if (i >= 0 && i + 1 < m_options.size()) {
+        auto value = m_options.at(i + 1).trimmed();
+        auto factor = 1.0;
+        if (value.endsWith(QChar('k'), Qt::CaseInsensitive)) {
+            factor = 1000.0;
+            value.chop(1);
+        } else if (value.endsWith(QChar('M'), Qt::CaseInsensitive)) {
+            factor = 1000000.0;
+            value.chop(1);
+        }
+        auto ok = false;
+        const auto number = value.toDouble(&ok);
+        if (ok && number > 0.0) {
+            bitrate = number * factor;
+        }
+    }
+    return static_cast<qint64>(recording.length.totalSeconds() * bitrate / 8.0 * 1.02) + 64 * 1024;
+}
+
+/*!
+ * \brief Removes the file written for \a recording (e.g. because recording it failed or it has been discarded).
+ */
+void FfmpegLauncher::removeRecordingFile(const Recording &recording)
+{
+    if (recording.writePath.isEmpty()) {
+        return;
+    }
+    if (recording.writePath != recording.targetPath) {
+        m_stagingArea->discard(recording.writePath);
+    } else {
+        QFile::remove(recording.writePath);
+    }
+}
+
+/*!
+ * \brief The PostProcessing struct holds everything needed to finish the file of a recording in the background.
+ * \remarks The tag writer, staging area, journal and verifier are shared so they are used even if the launcher is gone
+ *          when the file has been encoded.
+ */
+struct FfmpegLauncher::PostProcessing {
+    std::shared_ptr<TagWriter> tagWriter;
+    std::shared_ptr<StagingArea> stagingArea;
+    std::shared_ptr<RecordingJournal> journal;
+    std::shared_ptr<FileVerifier> verifier;
+    FileVerifier::ProblemHandler problemHandler;
+    QString writePath;
+    QString targetPath;
+    QMap<QString, QString> tags;
+    TimeSpan duration;
+    quint64 journalId = 0;
+};
+
+/*!
+ * \brief Writes the tags of the finished \a recording in the background if tagging afterwards, moves the file into the
+ *        target directory if staged and verifies it if a verifier has been set.
+ * \remarks Empty files are not post-processed; staged empty files are discarded.
+ */
+void FfmpegLauncher::postProcessRecording(const Recording &recording)
+{
+    if (recording.writePath.isEmpty()) {
+        completeRecording(recording);
+        return;
+    }
+    if (QFileInfo(recording.writePath).size() <= 0) {
+        if (recording.writePath != recording.targetPath) {
+            m_stagingArea->discard(recording.writePath);
+        }
+        completeRecording(recording);
+        return;
+    }
+    postProcessFile(postProcessing(recording));
+}
+
+/*!
+ * \brief Returns the post-processing for the file of \a recording.
+ * \remarks If the file fails verification, the recording is marked as incomplete in the recording index so the track is
+ *          recorded again next time.
+ */
+FfmpegLauncher::PostProcessing FfmpegLauncher::postProcessing(const Recording &recording) const
+{
+    PostProcessing postProcessing;
+    postProcessing.tagWriter = m_tagWriter;
+    postProcessing.stagingArea = m_stagingArea;
+    postProcessing.journal = m_recordingJournal;
+    postProcessing.verifier = m_fileVerifier;
+    if (m_recordingIndex) {
+        postProcessing.problemHandler
+            = [index = m_recordingIndex, key = recording.key, path = recording.targetPath](const QString &) { index->markIncomplete(key, path); };
+    }
+    postProcessing.writePath = recording.writePath;
+    postProcessing.targetPath = recording.targetPath;
+    postProcessing.tags = recording.tags;
+    postProcessing.duration = recording.duration;
+    postProcessing.journalId = recording.journalId;
+    return postProcessing;
+}
+
+/*!
+ * \brief Tags, commits and verifies a finished file as specified by \a postProcessing.
+ * \remarks
+ * - A staged file is tagged before it is moved so it shows up in the target directory only when it is final. Its
+ *   completion is logged only after it has been moved. The cover is copied into the target directory in any case.
+ * - The file is verified only after it has been tagged (and moved) because tagging might rewrite it.
+ */
+void FfmpegLauncher::postProcessFile(const PostProcessing &postProcessing)
+{
+    const auto staged = postProcessing.writePath != postProcessing.targetPath;
+    const auto complete = [postProcessing] {
+        if (postProcessing.journal && postProcessing.journalId) {
+            postProcessing.journal->addCompletion(postProcessing.journalId);
+        }
+    };
+    const auto verify = [postProcessing] {
+        if (postProcessing.verifier) {
+            postProcessing.verifier->verify(postProcessing.targetPath, postProcessing.duration, postProcessing.problemHandler);
+        }
+    };
+    if (!staged) {
+        complete();
+    }
+    const auto commit = [postProcessing, staged, complete, verify] {
+        if (!staged) {
+            verify();
+            return;
+        }
+        postProcessing.stagingArea->commit(postProcessing.writePath, [complete, verify](bool committed) {
+            if (committed) {
+                complete();
+                verify();
             }
-        } catch (const std::ios_base::failure &failure) {
-            cerr << "Warning: Can't parse info.ini because an IO error occurred: " << failure.what() << endl;
+        });
+    };
+#ifdef DBUS_SOUNDRECORDER_USE_TAGPARSER
+    if (postProcessing.tagWriter) {
+        postProcessing.tagWriter->enqueue(
+            postProcessing.writePath, postProcessing.tags, QFileInfo(postProcessing.targetPath).absolutePath(), commit);
+        return;
+    }
+#endif
+    commit();
+}
+
+/*!
+ * \brief Logs that the file of the specified \a recording is complete (or has been removed) if a journal is used.
+ */
+void FfmpegLauncher::completeRecording(const Recording &recording)
+{
+    if (m_recordingJournal && recording.journalId) {
+        m_recordingJournal->addCompletion(recording.journalId);
+    }
+}
+
+/*!
+ * \brief Takes over corrections of the current song's meta data the player sent after the recording has been started.
+ * \remarks The tags are only written with the corrected meta data when tagging afterwards (see setTaggingAfterwards()).
+ *          The key within the recording index and the length are updated in any case. A corrected length moves the end
+ *          of the current segment when capturing continuously (see updateSongEnd()); the length of a running process
+ *          can not be changed anymore.
+ */
+void FfmpegLauncher::updateTags()
+{
+    if (m_currentTargetPath.isEmpty() || m_watcher.isSongChangePending()) {
+        return;
+    }
+    Recording *recording = nullptr;
+    if (m_continuousCapture) {
+        if (!m_segments.isEmpty() && m_segments.last().recording.targetPath == m_currentTargetPath) {
+            recording = &m_segments.last().recording;
+        }
+    } else {
+        const auto i = m_recorderRecordings.find(m_currentRecorder);
+        if (i != m_recorderRecordings.end() && i->targetPath == m_currentTargetPath) {
+            recording = &*i;
         }
     }
-    // determine target name/path
-    QString targetName(
-        QStringLiteral("%3%1%2").arg(m_watcher.title().isEmpty() ? unknownTitle : validFileName(m_watcher.title()), m_targetExtension, number));
-    unsigned int count = 1;
-    while (targetDir.exists(targetName)) {
-        ++count;
-        targetName
-            = QStringLiteral("%3%1 (%4)%2").arg(m_watcher.title().isEmpty() ? unknownTitle : m_watcher.title(), m_targetExtension, number).arg(count);
+    if (!recording) {
+        return;
+    }
+    recording->key = RecordingIndex::key(m_watcher.artist(), m_watcher.album(), m_watcher.title(), m_watcher.trackNumber());
+    if (m_recordingJournal && recording->journalId) {
+        m_recordingJournal->addMetaData(recording->journalId, recording->key);
     }
-    auto targetPath = targetDir.absoluteFilePath(targetName);
+    const auto albumInfo = m_albumInfoCache->info(QDir::cleanPath(QFileInfo(recording->targetPath).absolutePath()));
+    // use length if specified in info.ini (like prepareRecording())
+    const auto length = m_watcher.trackNumber() ? albumInfo.lengths.value(m_watcher.trackNumber()) : QString();
+    const auto previousLength = recording->length;
+    recording->length = length.isEmpty() ? m_watcher.length() : parseDuration(length);
+    determineTags(*recording, albumInfo);
+    // note: the recording might be finished by moving its end so it must not be used afterwards
+    if (recording->length != previousLength) {
+        updateSongEnd(false);
+    }
+}
+
+/*!
+ * \brief Spawns a new ffmpeg process capturing the sink for the specified \a recording.
+ */
+void FfmpegLauncher::startRecorder(const Recording &recording)
+{
     // set input device
     QStringList args;
     args << QStringLiteral("-f");
@@ -177,69 +788,662 @@ void FfmpegLauncher::nextSong()
     args << m_inputOptions;
     args << QStringLiteral("-i");
     args << m_sink;
-    // set length if specified in info.ini
-    if (!length.isEmpty() || !m_watcher.length().isNull()) {
-        args << "-t";
-        args << (length.isEmpty() ? QString::number(m_watcher.length().totalSeconds()) : length);
+    // set length; the part of the song which has already been played when the process starts is not recorded
+    if (!recording.length.isNull()) {
+        const auto played = static_cast<double>(m_watcher.position()) / 1000000.0;
+        const auto remaining = (recording.length.totalSeconds() - played) / (m_watcher.rate() > 0.0 ? m_watcher.rate() : 1.0);
+        args << QStringLiteral("-t");
+        args << QString::number(remaining > 0.0 ? remaining : recording.length.totalSeconds());
     }
-    // set additional options
+    // set additional options and meta data
     args << m_options;
-    // set meta data
-    addMetaData(args, QStringLiteral("title"), m_watcher.title());
-    addMetaData(args, QStringLiteral("album"), m_watcher.album());
-    addMetaData(args, QStringLiteral("artist"), m_watcher.artist());
-    addMetaData(args, QStringLiteral("genre"), genre.isEmpty() ? m_watcher.genre() : genre);
-    addMetaData(args, QStringLiteral("year"), year.isEmpty() ? m_watcher.year() : year);
+    args << metaDataArgs(recording);
+    // set output file
+    args << outputArgs(recording);
+    // start the process for the next track while the previous one keeps recording; the previous process is
+    // only asked to finish a moment after the new one has been started (see ffmpegStarted()) so there is no gap
+    if (m_previousRecorder) {
+        // the process for the last track has not been started yet so it is superseded by this one
+        m_currentRecorder->stop();
+    } else {
+        m_previousRecorder = m_currentRecorder;
+    }
+    m_currentRecorder = idleRecorder();
+    m_recorderRecordings[m_currentRecorder] = recording;
+    m_currentTargetPath = recording.targetPath;
+    m_currentRecorder->setProgram(m_ffmpegBinary);
+    m_currentRecorder->setArguments(args);
+    m_currentRecorder->start();
+}
+
+/*!
+ * \brief Cuts the continuously captured stream for the specified \a recording.
+ *
+ * The cut is placed at the offset corresponding to the time the song started according to the playback position
+ * reported by the player (or the time the song change has been noticed if the player did not report it). Data captured
+ * before that offset still goes to the encoder of the previous track; everything from that offset on goes to a new
+ * encoder process reading PCM from stdin. So no audio is lost between tracks. Likewise, the segment ends at the offset
+ * corresponding to the time the song reaches its length (see updateSongEnd()).
+ *
+ * The new encoder is seeded with data from the capture's ring buffer starting at the pre-roll before the song change.
+ * So the beginning of the track is not lost even if the song change has been noticed only after the corresponding data
+ * has already been passed to the previous encoder.
+ *
+ * When spooling, the data is written losslessly into a spool file instead and encoded in the background after the
+ * segment has ended (see encodeSpoolFile()).
+ *
+ * When \a learningAd is set, the data is neither encoded nor spooled; it is only fingerprinted (see learnAd()).
+ */
+void FfmpegLauncher::startSegment(const Recording &recording, bool learningAd)
+{
+    // start capturing if not done yet
+    if (!m_capture->isRunning()) {
+        if (m_captureLost) {
+            Metrics::instance().increment(Metrics::Counter::CaptureRestarts);
+            m_captureLost = false;
+        }
+        m_capture->setFFmpegBinary(m_ffmpegBinary);
+        m_capture->setInputOptions(m_inputOptions);
+        m_capture->setSink(m_sink);
+        m_capture->start();
+    }
+    // end the previous segment, data which has already been passed to the previous encoder can not be taken back
+    const auto passedOffset = this->passedOffset();
+    const auto songStartOffset
+        = m_cutRefiner->refine(*m_capture, m_capture->offsetAt(m_watcher.timeAtPosition(0)), passedOffset, m_capture->bytesCaptured());
+    endSegments(max(songStartOffset, passedOffset), passedOffset);
+    publishMarker(songStartOffset);
+    // determine the start of the new segment, taking data from the ring buffer if possible
+    const auto frameSize = m_capture->frameSize();
+    auto startOffset = songStartOffset - static_cast<qint64>(m_preroll) * m_capture->byteRate() / 1000;
+    // keep a margin to the oldest buffered data because the producer overwrites it next
+    const auto &buffer = m_capture->buffer();
+    const auto overwrittenOffset = static_cast<qint64>(buffer.written()) - static_cast<qint64>(buffer.capacity());
+    startOffset = max({ startOffset, overwrittenOffset + overwriteMargin * m_capture->byteRate() / 1000, static_cast<qint64>(0) });
+    startOffset -= startOffset % frameSize;
+    // the length is applied by ending the segment at the corresponding offset
+    auto endOffset = qint64(-1);
+    if (!recording.length.isNull()) {
+        endOffset = max(songEndOffset(recording), startOffset);
+    }
+    Segment segment{ nullptr, nullptr, startOffset, endOffset, recording };
+    segment.learningAd = learningAd;
+    if (m_fingerprinting && m_recordingIndex) {
+        segment.fingerprinter = make_shared<Fingerprinter>(m_capture->sampleRate(), m_capture->channels(), fingerprintLength);
+    }
+    if (learningAd) {
+        m_segments << segment;
+        m_currentTargetPath.clear();
+        if (startOffset < passedOffset) {
+            passPcm(m_segments.last(), startOffset, endOffset < 0 ? passedOffset : min(endOffset, passedOffset));
+        }
+        return;
+    }
+    if (m_analyzingLoudness) {
+        segment.loudnessMeter = make_shared<LoudnessMeter>(m_capture->sampleRate(), m_capture->channels());
+    }
+    if (isSpooling()) {
+        // create spool file for the new segment
+        segment.spool = make_shared<SpoolFile>();
+        // the counter is shared by all launchers so they can use the same spool directory
+        static quint64 spoolCounter = 0;
+        const auto spoolPath = QStringLiteral("%1/%2-%3.wav").arg(m_spoolDir).arg(QCoreApplication::applicationPid()).arg(++spoolCounter);
+        if (!segment.spool->open(spoolPath, m_capture->sampleRate(), m_capture->channels())) {
+            cerr << "Error: Can not create spool file: " << spoolPath << endl;
+            removeRecordingFile(recording);
+            completeRecording(recording);
+            return;
+        }
+        Metrics::instance().observe(Metrics::Phase::Spawned, recording.songChangeTime);
+    } else {
+        // start encoder for the new segment
+        QStringList args;
+        args << m_capture->formatArgs();
+        args << QStringLiteral("-i");
+        args << QStringLiteral("-");
+        args << m_options;
+        args << metaDataArgs(recording);
+        args << outputArgs(recording);
+        segment.encoder = idleRecorder();
+        segment.encoder->setProgram(m_ffmpegBinary);
+        segment.encoder->setArguments(args);
+        segment.encoder->start();
+    }
+    m_segments << segment;
+    m_currentTargetPath = recording.targetPath;
+    emit recordingStarted(recording.targetPath);
+    // seed the encoder with data which has already been captured (and passed to the other encoders)
+    if (startOffset < passedOffset) {
+        passPcm(m_segments.last(), startOffset, endOffset < 0 ? passedOffset : min(endOffset, passedOffset));
+        if (m_segments.last().discarded) {
+            discardSegment(m_segments.last());
+            m_segments.removeLast();
+        }
+    }
+}
+
+/*!
+ * \brief Returns the offset up to which captured data has been passed to the encoders.
+ * \remarks When refining cuts, the encoders lag behind the capture by the refinement window so a cut can still be moved
+ *          by that amount in either direction after the song change has been noticed.
+ */
+qint64 FfmpegLauncher::passedOffset() const
+{
+    return max(m_capture->bytesCaptured() - m_cutRefiner->windowSize(*m_capture), static_cast<qint64>(0));
+}
+
+/*!
+ * \brief Returns the offset within the captured stream at which the current song reaches the length of \a recording.
+ */
+qint64 FfmpegLauncher::songEndOffset(const Recording &recording) const
+{
+    return m_capture->offsetAt(m_watcher.timeAtPosition(static_cast<qlonglong>(recording.length.totalTicks() / TimeSpan::ticksPerMicrosecond)));
+}
+
+/*!
+ * \brief Moves the end of the current recording after the playback position has been reported or changed by seeking.
+ * \remarks When capturing continuously, the current segment is ended at the offset the song reaches its length now.
+ *          Otherwise the length of the running process can not be changed anymore. A recording during which the player
+ *          has seeked does not match the song anymore so it is never considered complete.
+ */
+void FfmpegLauncher::updateSongEnd(bool seeked)
+{
+    // the position belongs to the next song if its meta data is still settling
+    if (m_watcher.isSongChangePending()) {
+        return;
+    }
+    if (!m_continuousCapture) {
+        const auto recording = m_recorderRecordings.find(m_currentRecorder);
+        if (seeked && recording != m_recorderRecordings.end()) {
+            recording->seeked = true;
+        }
+        return;
+    }
+    if (m_segments.isEmpty() || !m_capture->isRunning()) {
+        return;
+    }
+    auto &segment = m_segments.last();
+    if (segment.recording.key != RecordingIndex::key(m_watcher.artist(), m_watcher.album(), m_watcher.title(), m_watcher.trackNumber())) {
+        return;
+    }
+    segment.recording.seeked = segment.recording.seeked || seeked;
+    if (segment.recording.length.isNull()) {
+        return;
+    }
+    // data which has already been passed to the encoder can not be taken back
+    const auto passedOffset = this->passedOffset();
+    segment.endOffset = max({ songEndOffset(segment.recording), segment.startOffset, passedOffset });
+    segment.endRefined = false;
+    if (segment.endOffset <= passedOffset) {
+        finishSegment(segment);
+        m_segments.removeLast();
+    }
+}
+
+/*!
+ * \brief Ends the current recording without starting a new one.
+ * \remarks When capturing continuously, the capture keeps running so the next track can be cut without delay.
+ */
+void FfmpegLauncher::endRecording()
+{
+    m_currentTargetPath.clear();
+    if (m_continuousCapture && m_capture->isRunning()) {
+        const auto passedOffset = this->passedOffset();
+        const auto songStartOffset
+            = m_cutRefiner->refine(*m_capture, m_capture->offsetAt(m_watcher.timeAtPosition(0)), passedOffset, m_capture->bytesCaptured());
+        endSegments(max(songStartOffset, passedOffset), passedOffset);
+        publishMarker(songStartOffset);
+    } else {
+        stopFfmpeg();
+    }
+}
+
+/*!
+ * \brief Announces the current song (starting at the specified \a offset) to the readers of the PCM stream (if any).
+ * \remarks Markers are published for all songs, including ads and songs which are not recorded.
+ */
+void FfmpegLauncher::publishMarker(qint64 offset)
+{
+    if (!m_fanout) {
+        return;
+    }
+    PcmFanout::Fields fields;
+    fields[QStringLiteral("title")] = m_watcher.title();
+    fields[QStringLiteral("album")] = m_watcher.album();
+    fields[QStringLiteral("artist")] = m_watcher.artist();
     if (m_watcher.trackNumber()) {
-        addMetaData(args, QStringLiteral("track"),
-            totalTracks.isEmpty() ? QString::number(m_watcher.trackNumber()) : QString::number(m_watcher.trackNumber()) % QChar('/') % totalTracks);
+        fields[QStringLiteral("track")] = QString::number(m_watcher.trackNumber());
     }
     if (m_watcher.diskNumber()) {
-        addMetaData(args, QStringLiteral("disk"),
-            totalDisks.isEmpty() ? QString::number(m_watcher.diskNumber()) : QString::number(m_watcher.diskNumber()) % QChar('/') % totalDisks);
+        fields[QStringLiteral("disk")] = QString::number(m_watcher.diskNumber());
     }
-    // set output file
-    args << targetPath;
-    m_ffmpeg->setArguments(args);
-    // start process
-    m_ffmpeg->start();
-    // resume player
-    m_watcher.play();
-    m_watcher.setSilent(false);
+    if (!m_watcher.length().isNull()) {
+        fields[QStringLiteral("length")] = QString::number(m_watcher.length().totalSeconds(), 'f', 3);
+    }
+    auto flags = std::uint32_t();
+    if (m_watcher.isAd()) {
+        flags |= PcmFanoutMarker::Ad;
+    }
+    if (!m_watcher.isPlaying()) {
+        flags |= PcmFanoutMarker::NotPlaying;
+    }
+    m_fanout->addMarker(static_cast<std::uint64_t>(max<qint64>(offset, 0)), fields, flags);
 }
 
-void FfmpegLauncher::stopFfmpeg()
+/*!
+ * \brief Ends all open segments at the specified \a offset.
+ * \remarks The stdin of an encoder is closed as soon as all data up to \a offset has been passed to it. All data up to
+ *          \a passedOffset must have been passed already.
+ */
+void FfmpegLauncher::endSegments(qint64 offset, qint64 passedOffset)
 {
-    if (m_ffmpeg->state() != QProcess::NotRunning) {
-        m_ffmpeg->terminate();
-        m_ffmpeg->waitForFinished(10000);
-        if (m_ffmpeg->state() != QProcess::NotRunning) {
-            m_ffmpeg->kill();
-            m_ffmpeg->waitForFinished(5000);
-            if (m_ffmpeg->state() != QProcess::NotRunning) {
-                throw runtime_error("Unable to terminate/kill ffmpeg process.");
-            }
+    for (auto i = m_segments.begin(); i != m_segments.end();) {
+        auto &segment = *i;
+        if (segment.endOffset < 0 || segment.endOffset > offset) {
+            segment.endOffset = max(offset, segment.startOffset);
+            segment.endRefined = true;
+        }
+        if (segment.endOffset <= passedOffset) {
+            finishSegment(segment);
+            i = m_segments.erase(i);
+        } else {
+            ++i;
         }
     }
 }
 
+/*!
+ * \brief Passes the captured PCM data within the specified range from the ring buffer to the encoder of \a segment.
+ */
+void FfmpegLauncher::passPcm(Segment &segment, qint64 from, qint64 to)
+{
+    // copy the data before passing it because the producer might overwrite it meanwhile
+    const auto size = static_cast<std::size_t>(to - from);
+    if (m_pcmScratch.size() < size) {
+        m_pcmScratch.resize(size);
+    }
+    if (!m_capture->buffer().read(static_cast<std::uint64_t>(from), m_pcmScratch.data(), size)) {
+        cerr << "Warning: Captured data has been overwritten before it could be passed to the encoder." << endl;
+        return;
+    }
+    const auto *const data = m_pcmScratch.data();
+    if (segment.encoder) {
+        segment.encoder->write(data, static_cast<qint64>(size));
+    } else if (segment.spool) {
+        segment.spool->write(data, static_cast<qint64>(size));
+    }
+    if (segment.loudnessMeter) {
+        segment.loudnessMeter->add(data, size);
+    }
+    auto *const fingerprinter = segment.fingerprinter.get();
+    if (fingerprinter) {
+        fingerprinter->add(data, size);
+    }
+    // match the beginning of the track against the known fingerprints as early as possible
+    if (fingerprinter && !segment.learningAd && !segment.fingerprintChecked && fingerprinter->duration() >= fingerprintMatchTime) {
+        segment.fingerprintChecked = true;
+        segment.discarded = isUnwanted(segment);
+    }
+    auto &metrics = Metrics::instance();
+    metrics.increment(Metrics::Counter::BytesWritten, static_cast<std::uint64_t>(to - from));
+    if (!segment.dataPassed) {
+        segment.dataPassed = true;
+        metrics.observe(Metrics::Phase::FirstBytes, segment.recording.songChangeTime);
+    }
+}
+
+/*!
+ * \brief Finishes the specified \a segment after all of its data has been passed.
+ * \remarks Closes the encoder's stdin so it finishes after encoding the remaining data or enqueues the spool file for
+ *          encoding.
+ */
+void FfmpegLauncher::finishSegment(Segment &segment)
+{
+    if (segment.learningAd) {
+        learnAd(segment);
+        return;
+    }
+    const auto duration = TimeSpan::fromSeconds(static_cast<double>(segment.endOffset - segment.startOffset) / m_capture->byteRate());
+    if (segment.loudnessMeter) {
+        addLoudnessTags(segment.recording, *segment.loudnessMeter);
+    }
+    segment.recording.duration = duration;
+    if (segment.fingerprinter && segment.fingerprinter->duration() >= fingerprintMatchTime) {
+        segment.recording.fingerprint = FingerprintIndex::encode(segment.fingerprinter->subFingerprints());
+    }
+    if (segment.encoder) {
+        segment.encoder->finishInput();
+        // index, tag, move and verify the file and log its completion once the encoder has finished (see ffmpegFinished())
+        m_recorderRecordings[segment.encoder] = segment.recording;
+    } else if (segment.spool) {
+        if (segment.spool->finish()) {
+            encodeSpoolFile(segment.spool->path(), segment.recording);
+        } else {
+            cerr << "Error: Unable to write spool file: " << segment.spool->path() << endl;
+            removeRecordingFile(segment.recording);
+            completeRecording(segment.recording);
+        }
+    }
+    emit recordingFinished(segment.recording.targetPath);
+}
+
+/*!
+ * \brief Returns whether \a segment sounds like a known ad or (if skipping recorded tracks) like a recorded track.
+ */
+bool FfmpegLauncher::isUnwanted(const Segment &segment) const
+{
+    const auto *const track = m_recordingIndex->fingerprints().match(segment.fingerprinter->subFingerprints());
+    if (!track) {
+        return false;
+    }
+    if (track->ad) {
+        cerr << "Discarding " << segment.recording.targetPath << " which sounds like a known ad" << endl;
+        Metrics::instance().increment(Metrics::Counter::AdsSkipped);
+        return true;
+    }
+    const auto *const entry = m_recordingIndex->find(track->key);
+    if (m_skipRecorded && entry && entry->complete) {
+        cerr << "Discarding " << segment.recording.targetPath << " which sounds like the already recorded " << entry->path << endl;
+        Metrics::instance().increment(Metrics::Counter::DuplicatesDiscarded);
+        return true;
+    }
+    return false;
+}
+
+/*!
+ * \brief Stops recording the specified \a segment and removes everything which has been written for it so far.
+ * \remarks The segment must be removed from the list of segments afterwards.
+ */
+void FfmpegLauncher::discardSegment(Segment &segment)
+{
+    if (segment.encoder) {
+        segment.encoder->stop();
+    } else if (segment.spool) {
+        segment.spool->discard();
+    }
+    removeRecordingFile(segment.recording);
+    completeRecording(segment.recording);
+    if (m_currentTargetPath == segment.recording.targetPath) {
+        m_currentTargetPath.clear();
+    }
+}
+
+/*!
+ * \brief Adds the fingerprint of the ad captured by \a segment to the recording index unless the ad is known already.
+ * \remarks Ads shorter than the time needed for matching are ignored.
+ */
+void FfmpegLauncher::learnAd(const Segment &segment)
+{
+    const auto &subFingerprints = segment.fingerprinter->subFingerprints();
+    if (segment.fingerprinter->duration() < fingerprintMatchTime) {
+        return;
+    }
+    const auto *const track = m_recordingIndex->fingerprints().match(subFingerprints);
+    if (track && track->ad) {
+        return;
+    }
+    m_recordingIndex->addAd(FingerprintIndex::encode(subFingerprints));
+    cerr << "Learned fingerprint of ad (" << m_recordingIndex->fingerprints().size() << " fingerprints known)" << endl;
+}
+
+/*!
+ * \brief Adds the ReplayGain tags for the loudness measured by \a meter to the tags of \a recording.
+ * \remarks The track gain refers to -18 LUFS as specified by ReplayGain 2.0; the R128 gain (as used by Opus) refers to
+ *          -23 LUFS in Q7.8 format. The loudness range is only logged as there is no common tag for it.
+ */
+void FfmpegLauncher::addLoudnessTags(Recording &recording, const LoudnessMeter &meter) const
+{
+    const auto integratedLoudness = meter.integratedLoudness();
+    if (!meter.hasResult() || !isfinite(integratedLoudness)) {
+        return;
+    }
+    const auto truePeak = meter.truePeak();
+    cerr << "Loudness of " << recording.targetPath << ": " << integratedLoudness << " LUFS, range " << meter.loudnessRange() << " LU, true peak "
+         << 20.0 * log10(max(truePeak, 1e-9)) << " dBTP" << endl;
+    auto &tags = recording.tags;
+    tags[QStringLiteral("replaygain_track_gain")] = QString::number(-18.0 - integratedLoudness, 'f', 2) + QStringLiteral(" dB");
+    tags[QStringLiteral("replaygain_track_peak")] = QString::number(truePeak, 'f', 6);
+    tags[QStringLiteral("r128_track_gain")] = QString::number(lround((-23.0 - integratedLoudness) * 256.0));
+}
+
+/*!
+ * \brief Adds the specified \a recording to the recording \a index (if any).
+ * \remarks The recording is considered complete if its duration is not (significantly) shorter than the length of the
+ *          track. Recordings of tracks with unknown length are never considered complete.
+ */
+void FfmpegLauncher::indexRecording(RecordingIndex *index, const Recording &recording)
+{
+    if (!index) {
+        return;
+    }
+    RecordingIndex::Entry entry;
+    entry.path = recording.targetPath;
+    entry.duration = recording.duration;
+    entry.complete = !recording.seeked && !recording.length.isNull() && recording.duration >= recording.length - TimeSpan::fromSeconds(1.0);
+    entry.fingerprint = recording.fingerprint;
+    index->addRecording(recording.key, entry);
+}
+
+/*!
+ * \brief Encodes the spool file at \a spoolPath for the specified \a recording in the background.
+ * \remarks The encoding job runs at a lower priority. The spool file is removed and the recording is added to the
+ *          recording index only after it has been encoded successfully.
+ */
+void FfmpegLauncher::encodeSpoolFile(const QString &spoolPath, const Recording &recording)
+{
+    QStringList args;
+    args << QStringLiteral("-nostdin");
+    args << QStringLiteral("-y");
+    args << QStringLiteral("-i");
+    args << spoolPath;
+    args << m_options;
+    args << metaDataArgs(recording);
+    args << outputArgs(recording);
+    const auto postProcessing = this->postProcessing(recording);
+    const auto handleResult = [spoolPath, recording, postProcessing, index = m_recordingIndex](int exitCode, QProcess::ExitStatus exitStatus) {
+        if (exitStatus == QProcess::NormalExit && !exitCode) {
+            cerr << "Encoded " << recording.targetPath << endl;
+            QFile::remove(spoolPath);
+            indexRecording(index.get(), recording);
+            postProcessFile(postProcessing);
+        } else {
+            cerr << "Error: Unable to encode " << recording.targetPath << ", keeping spool file " << spoolPath << endl;
+        }
+    };
+    const auto enqueued = m_encoderPool->enqueue(m_ffmpegBinary, args, handleResult);
+    if (!enqueued) {
+        cerr << "Warning: Encoder backlog is full, keeping spool file " << spoolPath << " for " << recording.targetPath << endl;
+        removeRecordingFile(recording);
+        completeRecording(recording);
+    }
+}
+
+/*!
+ * \brief Passes the newly captured PCM data at the specified \a offset to the encoders of the segments it belongs to.
+ * \remarks When refining cuts, the data is held back for the refinement window (see passedOffset()).
+ */
+void FfmpegLauncher::dispatchPcm(qint64 offset, qint64 size)
+{
+    const auto lookahead = m_cutRefiner->windowSize(*m_capture);
+    passCapturedPcm(max(offset - lookahead, static_cast<qint64>(0)), max(offset + size - lookahead, static_cast<qint64>(0)));
+}
+
+/*!
+ * \brief Passes the captured PCM data within the specified range to the encoders of the segments it belongs to.
+ * \remarks Refines the end of a segment before passing the data it ends at. The captured data following the end of the
+ *          segment is available at this point because the data is passed with a lag of the refinement window.
+ */
+void FfmpegLauncher::passCapturedPcm(qint64 offset, qint64 end)
+{
+    if (offset >= end) {
+        return;
+    }
+    for (auto i = m_segments.begin(); i != m_segments.end();) {
+        auto &segment = *i;
+        if (!segment.endRefined && segment.endOffset >= 0 && segment.endOffset <= end) {
+            segment.endOffset = max(m_cutRefiner->refine(*m_capture, segment.endOffset, max(offset, segment.startOffset), m_capture->bytesCaptured()),
+                segment.startOffset);
+            segment.endRefined = true;
+        }
+        const auto from = max(offset, segment.startOffset);
+        const auto to = segment.endOffset < 0 ? end : min(end, segment.endOffset);
+        if (from < to) {
+            passPcm(segment, from, to);
+        }
+        if (segment.discarded) {
+            discardSegment(segment);
+            i = m_segments.erase(i);
+        } else if (segment.endOffset >= 0 && segment.endOffset <= end) {
+            finishSegment(segment);
+            i = m_segments.erase(i);
+        } else {
+            ++i;
+        }
+    }
+}
+
+/*!
+ * \brief Asks all ffmpeg processes to finish.
+ * \remarks Returns immediately; the processes are reaped in the background.
+ */
+void FfmpegLauncher::stopFfmpeg()
+{
+    flushPcm();
+    endSegments(m_capture->bytesCaptured(), m_capture->bytesCaptured());
+    m_capture->stop();
+    for (auto *const recorder : m_recorders) {
+        recorder->stop();
+    }
+    m_currentRecorder = m_previousRecorder = nullptr;
+    m_currentTargetPath.clear();
+}
+
+/*!
+ * \brief Ends all segments when the capture stopped (e.g. because the capturing process crashed).
+ */
+void FfmpegLauncher::captureStopped()
+{
+    m_captureLost = true;
+    flushPcm();
+    endSegments(m_capture->bytesCaptured(), m_capture->bytesCaptured());
+}
+
+/*!
+ * \brief Passes the data which has been held back for refining cuts to the encoders.
+ */
+void FfmpegLauncher::flushPcm()
+{
+    passCapturedPcm(passedOffset(), m_capture->bytesCaptured());
+}
+
 void FfmpegLauncher::ffmpegStarted()
 {
+    auto *const recorder = static_cast<FfmpegProcess *>(sender());
     cerr << "Started ffmpeg: ";
-    cerr << m_ffmpeg->program();
-    for (const auto &arg : m_ffmpeg->arguments()) {
+    cerr << recorder->program();
+    for (const auto &arg : recorder->arguments()) {
         cerr << ' ' << arg;
     }
     cerr << endl;
+    auto &metrics = Metrics::instance();
+    metrics.increment(Metrics::Counter::FfmpegStarts);
+    // note: encoders of segments are only added after the segment has been finished (which might happen before they started)
+    const auto pendingRecording = m_recorderRecordings.find(recorder);
+    if (!m_continuousCapture && pendingRecording != m_recorderRecordings.end()) {
+        pendingRecording->startTime = chrono::steady_clock::now();
+        metrics.observe(Metrics::Phase::Spawned, pendingRecording->songChangeTime);
+        emit recordingStarted(pendingRecording->targetPath);
+    }
+    for (const auto &segment : m_segments) {
+        if (segment.encoder == recorder) {
+            metrics.observe(Metrics::Phase::Spawned, segment.recording.songChangeTime);
+        }
+    }
+    // hand over: the new process is about to record so the previous one can finish after it had time to open the
+    // source and to initialize the encoder
+    // note: the previous process might have finished and been reused by then so it is only stopped if it is the same
+    if (recorder == m_currentRecorder && m_previousRecorder) {
+        auto *const previousRecorder = m_previousRecorder;
+        QTimer::singleShot(handoverOverlap, previousRecorder, [previousRecorder, processId = previousRecorder->processId()] {
+            if (previousRecorder->processId() == processId) {
+                previousRecorder->stop();
+            }
+        });
+        m_previousRecorder = nullptr;
+    }
 }
 
 void FfmpegLauncher::ffmpegError()
 {
-    cerr << "Failed to start ffmpeg: " << m_ffmpeg->errorString() << '\n';
+    auto *const recorder = static_cast<FfmpegProcess *>(sender());
+    cerr << "Failed to start ffmpeg: " << recorder->errorString() << '\n';
+    Metrics::instance().increment(Metrics::Counter::FfmpegFailures);
+    // don't pass captured data to an encoder which is not running; whatever it has written is finished like a file of a
+    // finished encoder
+    for (auto i = m_segments.begin(); i != m_segments.end();) {
+        if (i->encoder == recorder && recorder->state() == QProcess::NotRunning) {
+            postProcessRecording(i->recording);
+            i = m_segments.erase(i);
+        } else {
+            ++i;
+        }
+    }
+    // a process which failed to start does not finish so its recording is finished here (an empty staged file is discarded)
+    if (recorder->error() == QProcess::FailedToStart) {
+        postProcessRecording(m_recorderRecordings.take(recorder));
+    }
+    // don't let the previous process record the next track as well
+    if (recorder == m_currentRecorder && m_previousRecorder && recorder->state() == QProcess::NotRunning) {
+        m_previousRecorder->stop();
+        m_previousRecorder = nullptr;
+    }
 }
 
 void FfmpegLauncher::ffmpegFinished(int exitCode)
 {
     cerr << "FFmpeg finished with exit code " << exitCode << '\n';
+    // the first process finishing after a song change is the one of the previous track
+    if (m_pendingReapSongChangeTime != chrono::steady_clock::time_point()) {
+        Metrics::instance().observe(Metrics::Phase::Reaped, m_pendingReapSongChangeTime);
+        m_pendingReapSongChangeTime = chrono::steady_clock::time_point();
+    }
+    auto *const recorder = static_cast<FfmpegProcess *>(sender());
+    // an encoder which finished before the end of its segment failed (e.g. due to invalid options or a full disk) so
+    // don't pass captured data to it anymore; its file is only finished if it exited successfully anyway
+    for (auto i = m_segments.begin(); i != m_segments.end();) {
+        if (i->encoder != recorder) {
+            ++i;
+            continue;
+        }
+        if (recorder->exitStatus() == QProcess::NormalExit && !exitCode) {
+            postProcessRecording(i->recording);
+        } else {
+            cerr << "Error: Encoder of " << i->recording.targetPath << " failed before the end of the track" << endl;
+            discardSegment(*i);
+        }
+        i = m_segments.erase(i);
+    }
+    // index the recording only if the process succeeded
+    // note: encoders of segments are only added after the segment has been finished so their start time is not set
+    auto recording = m_recorderRecordings.take(recorder);
+    const auto succeeded = recorder->exitStatus() == QProcess::NormalExit && !exitCode;
+    if (recording.startTime != chrono::steady_clock::time_point()) {
+        // the duration of a per-track process is the time it has been running
+        const auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - recording.startTime);
+        recording.duration = TimeSpan::fromMilliseconds(static_cast<double>(elapsed.count()));
+        if (!recording.length.isNull() && recording.duration > recording.length) {
+            recording.duration = recording.length;
+        }
+        // note: the process is stopped via SIGTERM when the next track starts before the length has been reached
+        if (succeeded || (recorder->exitStatus() == QProcess::NormalExit && recorder->hasBeenStopped())) {
+            indexRecording(m_recordingIndex.get(), recording);
+        }
+        emit recordingFinished(recording.targetPath);
+    } else if (!recording.targetPath.isEmpty() && succeeded) {
+        // the duration of a segment's encoder is the duration of the segment
+        indexRecording(m_recordingIndex.get(), recording);
+    }
+    // the file is complete now so its tags can be written, it can be moved into the target directory and verified
+    postProcessRecording(recording);
 }
 } // namespace DBusSoundRecorder
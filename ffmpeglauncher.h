@@ -1,41 +1,202 @@
 #ifndef FFMPEGLAUNCHER_H
 #define FFMPEGLAUNCHER_H
 
+#include <c++utilities/chrono/timespan.h>
+
 #include <QDir>
+#include <QHash>
+#include <QList>
+#include <QMap>
 #include <QObject>
-#include <QProcess>
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
 
 namespace DBusSoundRecorder {
 
+struct AlbumInfo;
+class AlbumInfoCache;
+enum class CaptureBackend;
+class CutRefiner;
+class FfmpegProcess;
+class FileVerifier;
+class Fingerprinter;
+class LoudnessMeter;
+class PcmCapture;
+class PcmFanout;
 class PlayerWatcher;
+class ProcessPool;
+class RecordingIndex;
+class RecordingJournal;
+class SpoolFile;
+class StagingArea;
+class TagWriter;
 
 class FfmpegLauncher : public QObject {
     Q_OBJECT
 public:
     explicit FfmpegLauncher(PlayerWatcher &watcher, QObject *parent = nullptr);
+    ~FfmpegLauncher() override;
 
     void setSink(const QString &sinkName);
     void setFFmpegInputOptions(const QString &options);
+    const QString &ffmpegBinary() const;
     void setFFmpegBinary(const QString &path);
     void setFFmpegOptions(const QString &options);
     void setTargetDir(const QString &path);
     void setTargetExtension(const QString &extension);
+    bool isContinuousCapture() const;
+    void setContinuousCapture(bool continuousCapture);
+    CaptureBackend captureBackend() const;
+    void setCaptureBackend(CaptureBackend backend);
+    void setSampleRate(unsigned int sampleRate);
+    void setChannels(unsigned int channels);
+    void setPrerollBuffer(double seconds);
+    unsigned int preroll() const;
+    void setPreroll(unsigned int milliseconds);
+    unsigned int refineWindow() const;
+    void setRefineWindow(unsigned int milliseconds);
+    void setSilenceThreshold(double dbfs);
+    bool isAnalyzingLoudness() const;
+    void setAnalyzingLoudness(bool analyzingLoudness);
+    bool isSpooling() const;
+    const QString &spoolDir() const;
+    bool setSpoolDir(const QString &path);
+    const std::shared_ptr<StagingArea> &stagingArea() const;
+    void setStagingArea(const std::shared_ptr<StagingArea> &area);
+    int encoderJobs() const;
+    void setEncoderJobs(int jobs);
+    int encoderBacklog() const;
+    void setEncoderBacklog(int backlog);
+    ProcessPool *encoderPool() const;
+    void setEncoderPool(ProcessPool *pool);
+    void setAlbumInfoCache(const std::shared_ptr<AlbumInfoCache> &cache);
+    bool isIdle() const;
+    const std::shared_ptr<RecordingIndex> &recordingIndex() const;
+    void setRecordingIndex(const QString &path);
+    const std::shared_ptr<RecordingJournal> &recordingJournal() const;
+    void setRecordingJournal(const std::shared_ptr<RecordingJournal> &journal);
+    bool isSkippingRecorded() const;
+    void setSkipRecorded(bool skipRecorded);
+    bool isFingerprinting() const;
+    void setFingerprinting(bool fingerprinting);
+    bool isTaggingAfterwards() const;
+    void setTaggingAfterwards(bool taggingAfterwards);
+    static bool isTaggingAfterwardsSupported();
+    const std::shared_ptr<FileVerifier> &fileVerifier() const;
+    void setFileVerifier(const std::shared_ptr<FileVerifier> &verifier);
+    QString pcmFanoutSocket() const;
+    bool setPcmFanoutSocket(const QString &path);
+
+Q_SIGNALS:
+    void recordingStarted(const QString &targetPath);
+    void recordingFinished(const QString &targetPath);
 
 private Q_SLOTS:
+    void warmUpAlbumInfo(const QString &artist, const QString &album);
     void nextSong();
+    void updateSongEnd(bool seeked);
+    void updateTags();
     void stopFfmpeg();
+    void dispatchPcm(qint64 offset, qint64 size);
+    void captureStopped();
     void ffmpegStarted();
     void ffmpegError();
     void ffmpegFinished(int exitCode);
 
 private:
+    struct Recording {
+        QString key;
+        QString targetPath;
+        QString writePath;
+        CppUtilities::TimeSpan length;
+        CppUtilities::TimeSpan duration;
+        QMap<QString, QString> tags;
+        QByteArray fingerprint;
+        std::chrono::steady_clock::time_point startTime;
+        std::chrono::steady_clock::time_point songChangeTime;
+        quint64 journalId = 0;
+        bool seeked = false;
+    };
+    struct Segment {
+        FfmpegProcess *encoder;
+        std::shared_ptr<SpoolFile> spool;
+        qint64 startOffset;
+        qint64 endOffset;
+        Recording recording;
+        bool dataPassed = false;
+        bool endRefined = false;
+        std::shared_ptr<LoudnessMeter> loudnessMeter;
+        std::shared_ptr<Fingerprinter> fingerprinter;
+        bool fingerprintChecked = false;
+        bool discarded = false;
+        bool learningAd = false;
+    };
+    struct PostProcessing;
+
+    bool prepareRecording(Recording &recording);
+    void determineTags(Recording &recording, const AlbumInfo &albumInfo) const;
+    QStringList metaDataArgs(const Recording &recording) const;
+    QStringList outputArgs(const Recording &recording) const;
+    qint64 expectedFileSize(const Recording &recording) const;
+    void removeRecordingFile(const Recording &recording);
+    void postProcessRecording(const Recording &recording);
+    PostProcessing postProcessing(const Recording &recording) const;
+    static void postProcessFile(const PostProcessing &postProcessing);
+    void completeRecording(const Recording &recording);
+    void addLoudnessTags(Recording &recording, const LoudnessMeter &meter) const;
+    void startRecorder(const Recording &recording);
+    void startSegment(const Recording &recording, bool learningAd = false);
+    void publishMarker(qint64 offset);
+    void endRecording();
+    void endSegments(qint64 offset, qint64 passedOffset);
+    qint64 passedOffset() const;
+    void passCapturedPcm(qint64 offset, qint64 end);
+    void flushPcm();
+    qint64 songEndOffset(const Recording &recording) const;
+    void passPcm(Segment &segment, qint64 from, qint64 to);
+    void finishSegment(Segment &segment);
+    bool isUnwanted(const Segment &segment) const;
+    void discardSegment(Segment &segment);
+    void learnAd(const Segment &segment);
+    void encodeSpoolFile(const QString &spoolPath, const Recording &recording);
+    static void indexRecording(RecordingIndex *index, const Recording &recording);
+    FfmpegProcess *idleRecorder();
+
     PlayerWatcher &m_watcher;
     QString m_sink;
     QStringList m_inputOptions;
     QStringList m_options;
     QDir m_targetDir;
     QString m_targetExtension;
-    QProcess *m_ffmpeg;
+    QString m_ffmpegBinary;
+    QList<FfmpegProcess *> m_recorders;
+    FfmpegProcess *m_currentRecorder;
+    FfmpegProcess *m_previousRecorder;
+    PcmCapture *m_capture;
+    PcmFanout *m_fanout;
+    std::unique_ptr<CutRefiner> m_cutRefiner;
+    QList<Segment> m_segments;
+    std::vector<char> m_pcmScratch;
+    bool m_continuousCapture;
+    unsigned int m_preroll;
+    bool m_analyzingLoudness;
+    QString m_spoolDir;
+    std::shared_ptr<StagingArea> m_stagingArea;
+    ProcessPool *m_encoderPool;
+    std::shared_ptr<AlbumInfoCache> m_albumInfoCache;
+    std::shared_ptr<RecordingIndex> m_recordingIndex;
+    std::shared_ptr<RecordingJournal> m_recordingJournal;
+    bool m_skipRecorded;
+    bool m_fingerprinting;
+    std::shared_ptr<TagWriter> m_tagWriter;
+    std::shared_ptr<FileVerifier> m_fileVerifier;
+    QString m_currentTargetPath;
+    QHash<FfmpegProcess *, Recording> m_recorderRecordings;
+    std::chrono::steady_clock::time_point m_pendingReapSongChangeTime;
+    bool m_captureLost;
 };
 
 inline void FfmpegLauncher::setSink(const QString &sinkName)
@@ -48,9 +209,14 @@ inline void FfmpegLauncher::setFFmpegInputOptions(const QString &options)
     m_inputOptions = options.split(QChar(' '), Qt::SkipEmptyParts);
 }
 
+inline const QString &FfmpegLauncher::ffmpegBinary() const
+{
+    return m_ffmpegBinary;
+}
+
 inline void FfmpegLauncher::setFFmpegBinary(const QString &path)
 {
-    m_ffmpeg->setProgram(path);
+    m_ffmpegBinary = path;
 }
 
 inline void FfmpegLauncher::setFFmpegOptions(const QString &options)
@@ -63,6 +229,170 @@ inline void FfmpegLauncher::setTargetDir(const QString &path)
     m_targetDir = QDir(path);
 }
 
+inline bool FfmpegLauncher::isContinuousCapture() const
+{
+    return m_continuousCapture;
+}
+
+/*!
+ * \brief Sets whether the sink is captured by a single long-lived ffmpeg process which is cut into per-track files.
+ *
+ * Otherwise a new ffmpeg process capturing the sink is spawned for every track.
+ */
+inline void FfmpegLauncher::setContinuousCapture(bool continuousCapture)
+{
+    m_continuousCapture = continuousCapture;
+}
+
+inline unsigned int FfmpegLauncher::preroll() const
+{
+    return m_preroll;
+}
+
+/*!
+ * \brief Sets the time in milliseconds before the song change the recording of a new track should start.
+ * \remarks Only applies when capturing continuously. The audio is taken from the ring buffer so it must not exceed the
+ *          duration set via setPrerollBuffer().
+ */
+inline void FfmpegLauncher::setPreroll(unsigned int milliseconds)
+{
+    m_preroll = milliseconds;
+}
+
+inline bool FfmpegLauncher::isAnalyzingLoudness() const
+{
+    return m_analyzingLoudness;
+}
+
+/*!
+ * \brief Sets whether the loudness of each track is measured while capturing (see LoudnessMeter).
+ * \remarks Only applies when capturing continuously. The results are written as ReplayGain tags when spooling or
+ *          tagging afterwards (see setTaggingAfterwards()); otherwise they are only logged because the tags have been
+ *          passed to the encoder already.
+ */
+inline void FfmpegLauncher::setAnalyzingLoudness(bool analyzingLoudness)
+{
+    m_analyzingLoudness = analyzingLoudness;
+}
+
+/*!
+ * \brief Returns whether captured data is written losslessly into spool files which are encoded in the background.
+ */
+inline bool FfmpegLauncher::isSpooling() const
+{
+    return m_continuousCapture && !m_spoolDir.isEmpty();
+}
+
+inline const QString &FfmpegLauncher::spoolDir() const
+{
+    return m_spoolDir;
+}
+
+inline const std::shared_ptr<StagingArea> &FfmpegLauncher::stagingArea() const
+{
+    return m_stagingArea;
+}
+
+/*!
+ * \brief Sets the staging area files are written into before they are moved into the target directory.
+ * \remarks A nullptr disables staging so files are written into the target directory directly. Files are moved after
+ *          they have been tagged (if tagging afterwards) and before they are verified.
+ */
+inline void FfmpegLauncher::setStagingArea(const std::shared_ptr<StagingArea> &area)
+{
+    m_stagingArea = area;
+}
+
+inline ProcessPool *FfmpegLauncher::encoderPool() const
+{
+    return m_encoderPool;
+}
+
+/*!
+ * \brief Sets the cache used to look up the info.ini files of album directories.
+ * \remarks Launchers writing to the same target directory might share a cache.
+ */
+inline void FfmpegLauncher::setAlbumInfoCache(const std::shared_ptr<AlbumInfoCache> &cache)
+{
+    m_albumInfoCache = cache;
+}
+
+inline const std::shared_ptr<RecordingIndex> &FfmpegLauncher::recordingIndex() const
+{
+    return m_recordingIndex;
+}
+
+inline const std::shared_ptr<RecordingJournal> &FfmpegLauncher::recordingJournal() const
+{
+    return m_recordingJournal;
+}
+
+/*!
+ * \brief Sets the journal to log the start and completion of recordings in. A nullptr disables the journal.
+ * \remarks Launchers might share a journal (see RecordingJournal::open()).
+ */
+inline void FfmpegLauncher::setRecordingJournal(const std::shared_ptr<RecordingJournal> &journal)
+{
+    m_recordingJournal = journal;
+}
+
+inline bool FfmpegLauncher::isSkippingRecorded() const
+{
+    return m_skipRecorded;
+}
+
+/*!
+ * \brief Sets whether tracks which are already recorded completely according to the recording index are skipped.
+ * \remarks Has no effect if no recording index has been set.
+ */
+inline void FfmpegLauncher::setSkipRecorded(bool skipRecorded)
+{
+    m_skipRecorded = skipRecorded;
+}
+
+inline bool FfmpegLauncher::isFingerprinting() const
+{
+    return m_fingerprinting;
+}
+
+/*!
+ * \brief Sets whether tracks are recognized by their acoustic fingerprint (see Fingerprinter).
+ *
+ * The first seconds of each track are matched against the fingerprints of the recording index. Recordings of known ads
+ * are discarded; recordings of tracks which have already been recorded completely are discarded as well if skipping
+ * recorded tracks is enabled (see setSkipRecorded()). Ads flagged by the player are captured (but not encoded) to learn
+ * their fingerprint so they are recognized when played by another player as well.
+ *
+ * \remarks Only applies when capturing continuously and has no effect if no recording index has been set.
+ */
+inline void FfmpegLauncher::setFingerprinting(bool fingerprinting)
+{
+    m_fingerprinting = fingerprinting;
+}
+
+/*!
+ * \brief Returns whether tags are written after a file has been finished instead of passing them to ffmpeg.
+ */
+inline bool FfmpegLauncher::isTaggingAfterwards() const
+{
+    return m_tagWriter != nullptr;
+}
+
+inline const std::shared_ptr<FileVerifier> &FfmpegLauncher::fileVerifier() const
+{
+    return m_fileVerifier;
+}
+
+/*!
+ * \brief Sets the verifier to check finished files with. A nullptr disables verification.
+ * \remarks Files are verified after they have been tagged (if tagging afterwards). A file which fails verification is
+ *          not considered complete anymore by the recording index.
+ */
+inline void FfmpegLauncher::setFileVerifier(const std::shared_ptr<FileVerifier> &verifier)
+{
+    m_fileVerifier = verifier;
+}
+
 inline void FfmpegLauncher::setTargetExtension(const QString &extension)
 {
     m_targetExtension = extension.startsWith(QChar('.')) ? extension : QStringLiteral(".") + extension;
@@ -0,0 +1,116 @@
+#include "ffmpegprocess.h"
+#include "metrics.h"
+
+#include <QTimer>
+
+#include <iostream>
+
+#include <sys/resource.h>
+
+using namespace std;
+
+namespace DBusSoundRecorder {
+
+/// \brief The time ffmpeg has to finish after its stdin has been closed before it gets terminated.
+constexpr int inputGracePeriod = 30000;
+/// \brief The time ffmpeg has to finish after SIGTERM has been sent before it gets killed.
+constexpr int terminationGracePeriod = 10000;
+/// \brief The time to wait for the process to finish after SIGKILL has been sent.
+constexpr int killGracePeriod = 5000;
+
+FfmpegProcess::FfmpegProcess(QObject *parent)
+    : QProcess(parent)
+    , m_shutdownTimer(new QTimer(this))
+    , m_shutdown(Shutdown::None)
+    , m_finishedShutdown(Shutdown::None)
+    , m_niceness(0)
+{
+    m_shutdownTimer->setSingleShot(true);
+    connect(m_shutdownTimer, &QTimer::timeout, this, &FfmpegProcess::escalate);
+    connect(this, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished), this, &FfmpegProcess::reap);
+}
+
+/*!
+ * \brief Sets the niceness applied to the process when it is started.
+ * \remarks Used to run background work (like encoding spooled recordings) at a lower priority than capturing.
+ */
+void FfmpegProcess::setNiceness(int niceness)
+{
+    m_niceness = niceness;
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+    setChildProcessModifier([niceness] {
+        if (niceness) {
+            setpriority(PRIO_PROCESS, 0, niceness);
+        }
+    });
+#endif
+}
+
+#if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
+void FfmpegProcess::setupChildProcess()
+{
+    if (m_niceness) {
+        setpriority(PRIO_PROCESS, 0, m_niceness);
+    }
+}
+#endif
+
+/*!
+ * \brief Closes stdin so ffmpeg finishes after encoding the remaining input; terminates the process if it takes too long.
+ */
+void FfmpegProcess::finishInput()
+{
+    closeWriteChannel();
+    if (state() == QProcess::NotRunning || m_shutdown != Shutdown::None) {
+        return;
+    }
+    m_shutdown = Shutdown::ClosingInput;
+    m_shutdownTimer->start(inputGracePeriod);
+}
+
+/*!
+ * \brief Sends SIGTERM to the process; escalates to SIGKILL if it does not finish in time.
+ */
+void FfmpegProcess::stop()
+{
+    if (state() == QProcess::NotRunning || m_shutdown == Shutdown::Terminating || m_shutdown == Shutdown::Killing) {
+        return;
+    }
+    m_shutdown = Shutdown::Terminating;
+    terminate();
+    m_shutdownTimer->start(terminationGracePeriod);
+}
+
+void FfmpegProcess::escalate()
+{
+    if (state() == QProcess::NotRunning) {
+        return;
+    }
+    switch (m_shutdown) {
+    case Shutdown::None:
+        break;
+    case Shutdown::ClosingInput:
+        cerr << "FFmpeg did not finish after closing its input, terminating it" << endl;
+        m_shutdown = Shutdown::None;
+        stop();
+        break;
+    case Shutdown::Terminating:
+        cerr << "FFmpeg did not finish after SIGTERM, killing it" << endl;
+        m_shutdown = Shutdown::Killing;
+        Metrics::instance().increment(Metrics::Counter::Kills);
+        kill();
+        m_shutdownTimer->start(killGracePeriod);
+        break;
+    case Shutdown::Killing:
+        cerr << "Error: Unable to kill ffmpeg process " << processId() << '.' << endl;
+        break;
+    }
+}
+
+void FfmpegProcess::reap()
+{
+    m_shutdownTimer->stop();
+    m_finishedShutdown = m_shutdown;
+    m_shutdown = Shutdown::None;
+}
+} // namespace DBusSoundRecorder
@@ -0,0 +1,76 @@
+#ifndef FFMPEGPROCESS_H
+#define FFMPEGPROCESS_H
+
+#include <QProcess>
+
+QT_FORWARD_DECLARE_CLASS(QTimer)
+
+namespace DBusSoundRecorder {
+
+/*!
+ * \brief The FfmpegProcess class wraps an ffmpeg process which can be shut down without blocking the event loop.
+ *
+ * Shutting down is implemented as a state machine driven by a timer and the finished() signal: the process is asked
+ * to finish (by closing its stdin or sending SIGTERM) and only killed if it does not finish in time. The process is
+ * reaped in the background; stop() and finishInput() return immediately.
+ */
+class FfmpegProcess : public QProcess {
+    Q_OBJECT
+public:
+    explicit FfmpegProcess(QObject *parent = nullptr);
+
+    bool isStopping() const;
+    bool hasBeenStopped() const;
+    int niceness() const;
+    void setNiceness(int niceness);
+
+public Q_SLOTS:
+    void finishInput();
+    void stop();
+
+#if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
+protected:
+    void setupChildProcess() override;
+#endif
+
+private Q_SLOTS:
+    void escalate();
+    void reap();
+
+private:
+    enum class Shutdown {
+        None,
+        ClosingInput,
+        Terminating,
+        Killing,
+    };
+
+    QTimer *m_shutdownTimer;
+    Shutdown m_shutdown;
+    Shutdown m_finishedShutdown;
+    int m_niceness;
+};
+
+/*!
+ * \brief Returns whether the process has been asked to finish but is still running.
+ */
+inline bool FfmpegProcess::isStopping() const
+{
+    return m_shutdown != Shutdown::None;
+}
+/*!
+ * \brief Returns whether the process finished after it has been asked to via stop() (and has not been killed).
+ * \remarks ffmpeg finishes the output gracefully on SIGTERM but exits with a non-zero code then.
+ */
+inline bool FfmpegProcess::hasBeenStopped() const
+{
+    return m_finishedShutdown == Shutdown::Terminating;
+}
+
+inline int FfmpegProcess::niceness() const
+{
+    return m_niceness;
+}
+} // namespace DBusSoundRecorder
+
+#endif // FFMPEGPROCESS_H
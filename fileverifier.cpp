@@ -0,0 +1,148 @@
+#include "fileverifier.h"
+#include "metrics.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QRegularExpression>
+
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+using namespace CppUtilities;
+
+namespace DBusSoundRecorder {
+
+inline ostream &operator<<(ostream &stream, const QString &str)
+{
+    return stream << str.toLocal8Bit().data();
+}
+
+/// \brief The maximum volume in dBFS up to which a file is considered silent.
+constexpr double silenceThreshold = -60.0;
+/// \brief The minimum time in seconds the decoded duration might fall short of the expected duration.
+constexpr double minDurationTolerance = 1.0;
+/// \brief The fraction of the expected duration the decoded duration might fall short of it.
+constexpr double relativeDurationTolerance = 0.01;
+
+FileVerifier::FileVerifier()
+    : m_ffmpegBinary(QStringLiteral("ffmpeg"))
+{
+    m_pool.setMaxJobs(1);
+    m_pool.setNiceness(19);
+}
+
+/*!
+ * \brief Verifies the file at the specified \a path in the background.
+ * \remarks
+ * - The \a expectedDuration is the duration of the audio which has been written into the file. A null duration skips
+ *   checking the duration.
+ * - The \a handler is invoked (after the problem has been reported) if the file has a problem.
+ */
+void FileVerifier::verify(const QString &path, TimeSpan expectedDuration, const ProblemHandler &handler)
+{
+    // decode the first audio stream, stopping at the first error; mix down so the number of samples equals the frames
+    const QStringList args{ QStringLiteral("-nostdin"), QStringLiteral("-hide_banner"), QStringLiteral("-nostats"), QStringLiteral("-xerror"),
+        QStringLiteral("-threads"), QStringLiteral("1"), QStringLiteral("-i"), path, QStringLiteral("-map"), QStringLiteral("0:a:0"),
+        QStringLiteral("-af"), QStringLiteral("aformat=channel_layouts=mono,volumedetect"), QStringLiteral("-f"), QStringLiteral("null"),
+        QStringLiteral("-") };
+    const auto handleResult = [this, path, expectedDuration, handler](int exitCode, QProcess::ExitStatus exitStatus, const QByteArray &output) {
+        const auto problem = exitStatus == QProcess::NormalExit && !exitCode
+            ? check(output, expectedDuration)
+            : QStringLiteral("unreadable or damaged (ffmpeg exited with %1)").arg(exitCode);
+        if (problem.isEmpty()) {
+            return;
+        }
+        report(path, problem);
+        if (handler) {
+            handler(problem);
+        }
+        if (!m_quarantineDir.isEmpty()) {
+            quarantine(path);
+        }
+    };
+    if (!m_pool.enqueueCapturingOutput(m_ffmpegBinary, args, handleResult)) {
+        cerr << "Warning: Verification backlog is full, not verifying " << path << endl;
+    }
+}
+
+/*!
+ * \brief Returns the problem of a file according to the \a output of ffmpeg or an empty string if there is none.
+ */
+QString FileVerifier::check(const QByteArray &output, TimeSpan expectedDuration)
+{
+    static const QRegularExpression sampleRateExpr(QStringLiteral("Audio: [^\\n]*?(\\d+) Hz"));
+    static const QRegularExpression samplesExpr(QStringLiteral("n_samples: (\\d+)"));
+    static const QRegularExpression maxVolumeExpr(QStringLiteral("max_volume: (\\S+) dB"));
+    const auto text = QString::fromLocal8Bit(output);
+    const auto sampleRate = sampleRateExpr.match(text).captured(1).toULongLong();
+    const auto samples = samplesExpr.match(text).captured(1).toULongLong();
+    if (!sampleRate || !samples) {
+        return QStringLiteral("contains no audio");
+    }
+    const auto duration = static_cast<double>(samples) / static_cast<double>(sampleRate);
+    if (!expectedDuration.isNull()) {
+        const auto expectedSeconds = expectedDuration.totalSeconds();
+        if (duration < expectedSeconds - max(minDurationTolerance, expectedSeconds * relativeDurationTolerance)) {
+            return QStringLiteral("truncated (%1 s of %2 s)").arg(duration, 0, 'f', 1).arg(expectedSeconds, 0, 'f', 1);
+        }
+    }
+    const auto maxVolume = maxVolumeExpr.match(text).captured(1);
+    if (maxVolume.isEmpty() || maxVolume == QLatin1String("-inf") || maxVolume.toDouble() <= silenceThreshold) {
+        return QStringLiteral("silent (maximum volume %1 dB)").arg(maxVolume.isEmpty() ? QStringLiteral("-inf") : maxVolume);
+    }
+    return QString();
+}
+
+/*!
+ * \brief Logs the \a problem of the file at \a path and appends it to the report file (if any).
+ */
+void FileVerifier::report(const QString &path, const QString &problem)
+{
+    cerr << "Warning: Verification of " << path << " failed: " << problem << endl;
+    Metrics::instance().increment(Metrics::Counter::FilesFlagged);
+    if (m_reportPath.isEmpty()) {
+        return;
+    }
+    QFile reportFile(m_reportPath);
+    const auto line = QStringList({ QDateTime::currentDateTime().toString(Qt::ISODate), path, problem }).join(QChar('\t')).toUtf8() + '\n';
+    if (!reportFile.open(QIODevice::WriteOnly | QIODevice::Append) || reportFile.write(line) != line.size()) {
+        cerr << "Error: Unable to write verification report " << m_reportPath << ": " << reportFile.errorString() << endl;
+    }
+}
+
+/*!
+ * \brief Moves the file at the specified \a path into the quarantine directory.
+ */
+void FileVerifier::quarantine(const QString &path)
+{
+    if (quarantineFile(path, m_quarantineDir).isEmpty()) {
+        cerr << "Error: Unable to quarantine " << path << endl;
+    }
+}
+
+/*!
+ * \brief Moves the file at the specified \a path into the directory at \a dirPath, creating the directory if needed.
+ * \remarks The name is prefixed with a number if a file with the same name has already been quarantined.
+ * \returns Returns the new path of the file or an empty string if it could not be moved.
+ */
+QString quarantineFile(const QString &path, const QString &dirPath)
+{
+    QDir dir(dirPath);
+    if (!dir.mkpath(QStringLiteral("."))) {
+        return QString();
+    }
+    const auto fileName = QFileInfo(path).fileName();
+    auto targetPath = dir.absoluteFilePath(fileName);
+    for (auto count = 2; QFileInfo::exists(targetPath); ++count) {
+        targetPath = dir.absoluteFilePath(QStringLiteral("%1 - %2").arg(count).arg(fileName));
+    }
+    if (!QFile::rename(path, targetPath)) {
+        return QString();
+    }
+    cerr << "Quarantined " << path << " as " << targetPath << endl;
+    return targetPath;
+}
+} // namespace DBusSoundRecorder
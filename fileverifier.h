@@ -0,0 +1,101 @@
+#ifndef FILEVERIFIER_H
+#define FILEVERIFIER_H
+
+#include "processpool.h"
+
+#include <c++utilities/chrono/timespan.h>
+
+#include <QString>
+
+#include <functional>
+
+namespace DBusSoundRecorder {
+
+/*!
+ * \brief The FileVerifier class checks finished recordings in the background.
+ *
+ * Each file is decoded completely by ffmpeg which checks the container and the audio data. The decoded duration is
+ * compared to the duration which has been captured and the maximum volume is determined to find files containing only
+ * silence. Problems are logged, appended to the report file and the files are moved into the quarantine directory
+ * (if these have been set).
+ *
+ * The verifications have their own ProcessPool which runs only one job at a time using a single thread at the lowest
+ * priority, so verifying does not compete with capturing or encoding. The backlog is bounded; files are not verified
+ * when it is full.
+ */
+class FileVerifier {
+public:
+    using ProblemHandler = std::function<void(const QString &problem)>;
+
+    FileVerifier();
+
+    const QString &ffmpegBinary() const;
+    void setFFmpegBinary(const QString &path);
+    const QString &reportPath() const;
+    void setReportPath(const QString &path);
+    const QString &quarantineDir() const;
+    void setQuarantineDir(const QString &path);
+    ProcessPool &pool();
+
+    void verify(const QString &path, CppUtilities::TimeSpan expectedDuration, const ProblemHandler &handler = ProblemHandler());
+
+private:
+    static QString check(const QByteArray &output, CppUtilities::TimeSpan expectedDuration);
+    void report(const QString &path, const QString &problem);
+    void quarantine(const QString &path);
+
+    QString m_ffmpegBinary;
+    QString m_reportPath;
+    QString m_quarantineDir;
+    ProcessPool m_pool;
+};
+
+inline const QString &FileVerifier::ffmpegBinary() const
+{
+    return m_ffmpegBinary;
+}
+
+inline void FileVerifier::setFFmpegBinary(const QString &path)
+{
+    m_ffmpegBinary = path;
+}
+
+inline const QString &FileVerifier::reportPath() const
+{
+    return m_reportPath;
+}
+
+/*!
+ * \brief Sets the file problems are appended to (one line per file with time, path and problem separated by tabs).
+ * \remarks An empty path disables the report; problems are logged in any case.
+ */
+inline void FileVerifier::setReportPath(const QString &path)
+{
+    m_reportPath = path;
+}
+
+inline const QString &FileVerifier::quarantineDir() const
+{
+    return m_quarantineDir;
+}
+
+/*!
+ * \brief Sets the directory files with problems are moved into. An empty path disables moving the files.
+ */
+inline void FileVerifier::setQuarantineDir(const QString &path)
+{
+    m_quarantineDir = path;
+}
+
+/*!
+ * \brief Returns the pool running the verifications, e.g. to configure the number of parallel jobs.
+ */
+inline ProcessPool &FileVerifier::pool()
+{
+    return m_pool;
+}
+
+QString quarantineFile(const QString &path, const QString &dirPath);
+} // namespace DBusSoundRecorder
+
+#endif // FILEVERIFIER_H
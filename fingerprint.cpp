@@ -0,0 +1,299 @@
+#include "fingerprint.h"
+
+#include <QHash>
+#include <QtAlgorithms>
+#include <QtEndian>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+
+namespace DBusSoundRecorder {
+
+/// \brief The sample rate the signal is decimated to (roughly) before filtering.
+constexpr unsigned int analysisRate = 5512;
+/// \brief The duration of a frame in seconds.
+constexpr double frameDuration = 0.0464;
+/// \brief The lower and upper bound of the analyzed frequency range in Hz.
+constexpr double minFrequency = 300.0, maxFrequency = 2000.0;
+/// \brief The mean energy per band and sample below which a frame is considered silent (about -80 dBFS).
+constexpr float silenceEnergy = 1e-8f;
+
+/// \brief The number of postings collected before they are merged into the big array.
+constexpr std::size_t mergeThreshold = 16 * 1024;
+/// \brief The number of postings above which a sub-fingerprint is considered too common to be meaningful.
+constexpr std::ptrdiff_t maxPostings = 1024;
+/// \brief The number of votes an alignment needs to be verified.
+constexpr unsigned int minVotes = 2;
+/// \brief The number of alignments with the most votes which are verified.
+constexpr std::size_t maxCandidates = 8;
+/// \brief The number of non-silent frames which must overlap when verifying an alignment.
+constexpr std::size_t minComparedFrames = 32;
+/// \brief The bit error rate below which fingerprints are considered to match.
+constexpr double maxBitErrorRate = 0.35;
+
+/*!
+ * \brief Constructs a fingerprinter for a stream of signed 16-bit little-endian samples with the specified format.
+ * \remarks At most \a maxLength sub-fingerprints are computed.
+ */
+Fingerprinter::Fingerprinter(unsigned int sampleRate, unsigned int channels, std::size_t maxLength)
+    : m_channels(channels)
+    , m_decimation(max(sampleRate / analysisRate, 1u))
+    , m_frameSamples(max(static_cast<std::uint32_t>(lround(static_cast<double>(sampleRate) / m_decimation * frameDuration)), 1u))
+    , m_maxLength(maxLength)
+    , m_frameDuration(static_cast<double>(m_frameSamples) * m_decimation / max(sampleRate, 1u))
+    , m_x1()
+    , m_x2()
+    , m_y1()
+    , m_y2()
+    , m_energies()
+    , m_previousEnergies()
+    , m_hasPreviousFrame(false)
+    , m_decimationSum(0.0f)
+    , m_decimationCount(0)
+    , m_frameCount(0)
+    , m_pending()
+    , m_pendingSize(0)
+{
+    // band-pass filters with constant peak gain (RBJ cookbook), bands are spaced logarithmically
+    const auto rate = static_cast<double>(max(sampleRate, 1u)) / m_decimation;
+    const auto ratio = pow(maxFrequency / minFrequency, 1.0 / bands);
+    for (std::size_t band = 0; band != bands; ++band) {
+        const auto lower = minFrequency * pow(ratio, static_cast<double>(band));
+        const auto upper = lower * ratio;
+        const auto center = sqrt(lower * upper);
+        const auto w0 = 2.0 * M_PI * min(center, rate * 0.45) / rate;
+        const auto alpha = sin(w0) * (upper - lower) / (2.0 * center);
+        const auto a0 = 1.0 + alpha;
+        m_b0[band] = static_cast<float>(alpha / a0);
+        m_a1[band] = static_cast<float>(-2.0 * cos(w0) / a0);
+        m_a2[band] = static_cast<float>((1.0 - alpha) / a0);
+    }
+    m_subFingerprints.reserve(maxLength);
+}
+
+/*!
+ * \brief Analyzes the specified PCM data.
+ * \remarks The data does not need to be aligned to frames. Does nothing if the fingerprint is complete.
+ */
+void Fingerprinter::add(const char *data, std::size_t size)
+{
+    const auto frameSize = static_cast<std::size_t>(m_channels) * 2;
+    if (!frameSize || frameSize > m_pending.size() || isComplete()) {
+        return;
+    }
+    const auto processFrames = [this, frameSize](const char *frames, std::size_t frameCount) {
+        const auto scale = 1.0f / (32768.0f * static_cast<float>(m_channels));
+        for (const auto *const end = frames + frameCount * frameSize; frames != end;) {
+            auto sum = 0;
+            for (auto channel = 0u; channel != m_channels; ++channel, frames += 2) {
+                sum += qFromLittleEndian<qint16>(frames);
+            }
+            m_decimationSum += static_cast<float>(sum) * scale;
+            if (++m_decimationCount == m_decimation) {
+                processSample(m_decimationSum / static_cast<float>(m_decimation));
+                m_decimationSum = 0.0f;
+                m_decimationCount = 0;
+            }
+        }
+    };
+    if (m_pendingSize) {
+        const auto missing = min(frameSize - m_pendingSize, size);
+        memcpy(m_pending.data() + m_pendingSize, data, missing);
+        m_pendingSize += missing;
+        data += missing;
+        size -= missing;
+        if (m_pendingSize < frameSize) {
+            return;
+        }
+        processFrames(m_pending.data(), 1);
+        m_pendingSize = 0;
+    }
+    const auto frameCount = size / frameSize;
+    processFrames(data, frameCount);
+    m_pendingSize = size - frameCount * frameSize;
+    memcpy(m_pending.data(), data + frameCount * frameSize, m_pendingSize);
+}
+
+/*!
+ * \brief Passes the specified (decimated) \a sample through the filter bank.
+ * \remarks The bands are independent of each other so the loop is vectorized by the compiler.
+ */
+void Fingerprinter::processSample(float sample)
+{
+    for (std::size_t band = 0; band != bands; ++band) {
+        const auto y = m_b0[band] * (sample - m_x2[band]) - m_a1[band] * m_y1[band] - m_a2[band] * m_y2[band];
+        m_x2[band] = m_x1[band];
+        m_x1[band] = sample;
+        m_y2[band] = m_y1[band];
+        m_y1[band] = y;
+        m_energies[band] += y * y;
+    }
+    if (++m_frameCount == m_frameSamples) {
+        finishFrame();
+    }
+}
+
+/*!
+ * \brief Computes the sub-fingerprint of the current frame from the band energies of the current and previous frame.
+ */
+void Fingerprinter::finishFrame()
+{
+    auto totalEnergy = 0.0f;
+    for (const auto energy : m_energies) {
+        totalEnergy += energy;
+    }
+    if (m_hasPreviousFrame && !isComplete()) {
+        auto subFingerprint = std::uint32_t(0);
+        if (totalEnergy >= silenceEnergy * static_cast<float>(bands * m_frameSamples)) {
+            for (std::size_t band = 0; band + 1 != bands; ++band) {
+                const auto difference
+                    = (m_energies[band] - m_energies[band + 1]) - (m_previousEnergies[band] - m_previousEnergies[band + 1]);
+                if (difference > 0.0f) {
+                    subFingerprint |= std::uint32_t(1) << band;
+                }
+            }
+        }
+        m_subFingerprints.push_back(subFingerprint);
+    }
+    copy(begin(m_energies), end(m_energies), m_previousEnergies.begin());
+    fill(begin(m_energies), end(m_energies), 0.0f);
+    m_hasPreviousFrame = true;
+    m_frameCount = 0;
+}
+
+/*!
+ * \brief Adds the track with the specified \a key and \a subFingerprints to the index.
+ * \remarks Tracks are not de-duplicated; adding a track again only makes it more likely to be found.
+ */
+void FingerprintIndex::add(const QString &key, bool ad, const std::vector<std::uint32_t> &subFingerprints)
+{
+    const auto track = static_cast<std::uint32_t>(m_tracks.size());
+    m_tracks.emplace_back(Track{ key, ad, subFingerprints });
+    const auto previousSize = m_recentPostings.size();
+    for (std::size_t position = 0; position != subFingerprints.size(); ++position) {
+        if (subFingerprints[position]) {
+            m_recentPostings.emplace_back(Posting{ subFingerprints[position], track, static_cast<std::uint32_t>(position) });
+        }
+    }
+    sort(m_recentPostings.begin() + static_cast<std::ptrdiff_t>(previousSize), m_recentPostings.end());
+    inplace_merge(m_recentPostings.begin(), m_recentPostings.begin() + static_cast<std::ptrdiff_t>(previousSize), m_recentPostings.end());
+    if (m_recentPostings.size() < mergeThreshold) {
+        return;
+    }
+    const auto size = m_postings.size();
+    m_postings.insert(m_postings.end(), m_recentPostings.cbegin(), m_recentPostings.cend());
+    inplace_merge(m_postings.begin(), m_postings.begin() + static_cast<std::ptrdiff_t>(size), m_postings.end());
+    m_recentPostings.clear();
+}
+
+/*!
+ * \brief Returns the track which matches the specified \a subFingerprints best or nullptr if none matches.
+ * \remarks The query is usually the beginning of a track. It might be located anywhere within the indexed part of a
+ *          track but must overlap it by at least half of its (non-silent) length.
+ */
+const FingerprintIndex::Track *FingerprintIndex::match(const std::vector<std::uint32_t> &subFingerprints) const
+{
+    // let each hit vote for the alignment of the query within the track it belongs to
+    QHash<quint64, unsigned int> votes;
+    const auto vote = [this, &votes](std::uint32_t subFingerprint, std::size_t position) {
+        for (const auto *const postings : { &m_postings, &m_recentPostings }) {
+            const auto range = equal_range(postings->cbegin(), postings->cend(), Posting{ subFingerprint, 0, 0 });
+            if (range.second - range.first > maxPostings) {
+                continue;
+            }
+            for (auto i = range.first; i != range.second; ++i) {
+                const auto alignment = static_cast<std::int64_t>(i->position) - static_cast<std::int64_t>(position);
+                ++votes[(static_cast<quint64>(i->track) << 32) | static_cast<std::uint32_t>(alignment)];
+            }
+        }
+    };
+    for (std::size_t position = 0; position != subFingerprints.size(); ++position) {
+        const auto subFingerprint = subFingerprints[position];
+        if (!subFingerprint) {
+            continue;
+        }
+        vote(subFingerprint, position);
+        for (auto bit = 0u; bit != 32; ++bit) {
+            vote(subFingerprint ^ (std::uint32_t(1) << bit), position);
+        }
+    }
+    // verify the alignments with the most votes
+    std::vector<std::pair<unsigned int, quint64>> candidates;
+    for (auto i = votes.cbegin(), end = votes.cend(); i != end; ++i) {
+        if (i.value() >= minVotes) {
+            candidates.emplace_back(i.value(), i.key());
+        }
+    }
+    const auto candidateCount = min(candidates.size(), maxCandidates);
+    partial_sort(candidates.begin(), candidates.begin() + static_cast<std::ptrdiff_t>(candidateCount), candidates.end(),
+        [](const auto &lhs, const auto &rhs) { return lhs.first > rhs.first; });
+    const Track *bestTrack = nullptr;
+    auto bestBitErrorRate = maxBitErrorRate;
+    for (std::size_t i = 0; i != candidateCount; ++i) {
+        const auto &track = m_tracks[static_cast<std::size_t>(candidates[i].second >> 32)];
+        const auto alignment = static_cast<std::int32_t>(static_cast<std::uint32_t>(candidates[i].second));
+        const auto rate = bitErrorRate(subFingerprints, track, alignment);
+        if (rate < bestBitErrorRate) {
+            bestTrack = &track;
+            bestBitErrorRate = rate;
+        }
+    }
+    return bestTrack;
+}
+
+/*!
+ * \brief Returns the fraction of bits differing between the \a query and \a track when aligned as specified.
+ * \remarks Silent frames are not compared. Returns 1.0 if too few frames overlap.
+ */
+double FingerprintIndex::bitErrorRate(const std::vector<std::uint32_t> &query, const Track &track, std::int64_t alignment) const
+{
+    auto relevantFrames = std::size_t(0), comparedFrames = std::size_t(0), errors = std::size_t(0);
+    for (std::size_t position = 0; position != query.size(); ++position) {
+        if (!query[position]) {
+            continue;
+        }
+        ++relevantFrames;
+        const auto trackPosition = static_cast<std::int64_t>(position) + alignment;
+        if (trackPosition < 0 || trackPosition >= static_cast<std::int64_t>(track.subFingerprints.size())) {
+            continue;
+        }
+        const auto subFingerprint = track.subFingerprints[static_cast<std::size_t>(trackPosition)];
+        if (subFingerprint) {
+            ++comparedFrames;
+            errors += qPopulationCount(query[position] ^ subFingerprint);
+        }
+    }
+    if (comparedFrames < minComparedFrames || comparedFrames * 2 < relevantFrames) {
+        return 1.0;
+    }
+    return static_cast<double>(errors) / static_cast<double>(comparedFrames * 32);
+}
+
+/*!
+ * \brief Returns the specified \a subFingerprints in the format stored in the recording index (little-endian).
+ */
+QByteArray FingerprintIndex::encode(const std::vector<std::uint32_t> &subFingerprints)
+{
+    QByteArray data(static_cast<int>(subFingerprints.size() * 4), Qt::Uninitialized);
+    auto *const out = data.data();
+    for (std::size_t i = 0; i != subFingerprints.size(); ++i) {
+        qToLittleEndian(subFingerprints[i], out + i * 4);
+    }
+    return data;
+}
+
+/*!
+ * \brief Returns the sub-fingerprints from \a data as returned by encode().
+ */
+std::vector<std::uint32_t> FingerprintIndex::decode(const QByteArray &data)
+{
+    std::vector<std::uint32_t> subFingerprints(static_cast<std::size_t>(data.size()) / 4);
+    for (std::size_t i = 0; i != subFingerprints.size(); ++i) {
+        subFingerprints[i] = qFromLittleEndian<std::uint32_t>(data.constData() + i * 4);
+    }
+    return subFingerprints;
+}
+} // namespace DBusSoundRecorder
@@ -0,0 +1,146 @@
+#ifndef FINGERPRINT_H
+#define FINGERPRINT_H
+
+#include <QByteArray>
+#include <QString>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace DBusSoundRecorder {
+
+/*!
+ * \brief The Fingerprinter class computes an acoustic fingerprint of a PCM stream while it is passed.
+ *
+ * The fingerprint is a sequence of 32-bit sub-fingerprints similar to the one described by Haitsma and Kalker:
+ * - The channels are mixed down to mono and decimated to roughly 5.5 kHz by averaging.
+ * - A bank of 33 band-pass filters with logarithmically spaced bands between 300 Hz and 2 kHz splits the signal.
+ * - The energy of each band is summed up in frames of about 46 ms. Each bit of a sub-fingerprint is the sign of the
+ *   difference between adjacent bands compared to the previous frame. So the fingerprint does not depend on the volume.
+ * - Silent frames yield the sub-fingerprint zero which is ignored when matching.
+ *
+ * Only the sub-fingerprints of the beginning of the stream are computed (see maxLength) so the fingerprint is compact
+ * and analyzing stops after that.
+ */
+class Fingerprinter {
+public:
+    static constexpr std::size_t bands = 33;
+
+    Fingerprinter(unsigned int sampleRate, unsigned int channels, std::size_t maxLength);
+
+    void add(const char *data, std::size_t size);
+    const std::vector<std::uint32_t> &subFingerprints() const;
+    bool isComplete() const;
+    double duration() const;
+
+private:
+    void processSample(float sample);
+    void finishFrame();
+
+    const unsigned int m_channels;
+    const unsigned int m_decimation;
+    const std::uint32_t m_frameSamples;
+    const std::size_t m_maxLength;
+    const double m_frameDuration;
+    // band-pass filters: coefficients b0 (b1 is zero, b2 is -b0), a1 and a2 and their state
+    alignas(16) float m_b0[bands];
+    alignas(16) float m_a1[bands];
+    alignas(16) float m_a2[bands];
+    alignas(16) float m_x1[bands];
+    alignas(16) float m_x2[bands];
+    alignas(16) float m_y1[bands];
+    alignas(16) float m_y2[bands];
+    alignas(16) float m_energies[bands];
+    std::array<float, bands> m_previousEnergies;
+    bool m_hasPreviousFrame;
+    float m_decimationSum;
+    unsigned int m_decimationCount;
+    std::uint32_t m_frameCount;
+    std::vector<std::uint32_t> m_subFingerprints;
+    // bytes of an incomplete frame which have been passed so far (streams with more than 128 channels are not analyzed)
+    std::array<char, 256> m_pending;
+    std::size_t m_pendingSize;
+};
+
+/*!
+ * \brief Returns the sub-fingerprints computed so far.
+ */
+inline const std::vector<std::uint32_t> &Fingerprinter::subFingerprints() const
+{
+    return m_subFingerprints;
+}
+
+/*!
+ * \brief Returns whether the maximum number of sub-fingerprints has been computed so further data is ignored.
+ */
+inline bool Fingerprinter::isComplete() const
+{
+    return m_subFingerprints.size() >= m_maxLength;
+}
+
+/*!
+ * \brief Returns the duration in seconds covered by the sub-fingerprints computed so far.
+ */
+inline double Fingerprinter::duration() const
+{
+    return static_cast<double>(m_subFingerprints.size()) * m_frameDuration;
+}
+
+/*!
+ * \brief The FingerprintIndex class finds tracks by the fingerprints computed via Fingerprinter.
+ *
+ * The index is inverted: it maps each sub-fingerprint to the tracks and positions it occurs at. The postings are kept
+ * in a sorted array (12 bytes per sub-fingerprint) so the index stays compact even for many tracks; new postings are
+ * collected in a small sorted array which is merged into the big one from time to time.
+ *
+ * A query looks up its sub-fingerprints and all variants with a single flipped bit (as bits of bands with similar
+ * energies are unreliable). Each hit votes for an alignment of the query within a track. The alignments with the most
+ * votes are verified by comparing the whole overlapping parts of the fingerprints.
+ */
+class FingerprintIndex {
+public:
+    struct Track {
+        QString key;
+        bool ad = false;
+        std::vector<std::uint32_t> subFingerprints;
+    };
+
+    void add(const QString &key, bool ad, const std::vector<std::uint32_t> &subFingerprints);
+    const Track *match(const std::vector<std::uint32_t> &subFingerprints) const;
+    std::size_t size() const;
+
+    static QByteArray encode(const std::vector<std::uint32_t> &subFingerprints);
+    static std::vector<std::uint32_t> decode(const QByteArray &data);
+
+private:
+    struct Posting {
+        std::uint32_t subFingerprint;
+        std::uint32_t track;
+        std::uint32_t position;
+        bool operator<(const Posting &other) const;
+    };
+
+    double bitErrorRate(const std::vector<std::uint32_t> &query, const Track &track, std::int64_t alignment) const;
+
+    std::vector<Track> m_tracks;
+    std::vector<Posting> m_postings;
+    std::vector<Posting> m_recentPostings;
+};
+
+/*!
+ * \brief Returns the number of tracks in the index.
+ */
+inline std::size_t FingerprintIndex::size() const
+{
+    return m_tracks.size();
+}
+
+inline bool FingerprintIndex::Posting::operator<(const Posting &other) const
+{
+    return subFingerprint < other.subFingerprint;
+}
+} // namespace DBusSoundRecorder
+
+#endif // FINGERPRINT_H
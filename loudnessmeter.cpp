@@ -0,0 +1,326 @@
+#include "loudnessmeter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace DBusSoundRecorder {
+
+/// \brief The lower bound of the histograms in LUFS; this is the absolute gate as well.
+constexpr double histogramMin = -70.0;
+/// \brief The width of the histogram bins in LU.
+constexpr double histogramBinWidth = 0.1;
+
+/*!
+ * \brief Returns the loudness in LUFS corresponding to the specified (weighted) mean square.
+ */
+inline double loudness(double meanSquare)
+{
+    return -0.691 + 10.0 * log10(meanSquare);
+}
+
+/*!
+ * \brief Returns the loudness in LUFS corresponding to the center of the specified \a bin.
+ */
+inline double binLoudness(std::size_t bin)
+{
+    return histogramMin + (static_cast<double>(bin) + 0.5) * histogramBinWidth;
+}
+
+/*!
+ * \brief Returns the mean square corresponding to the center of each histogram bin.
+ */
+const std::array<double, LoudnessMeter::histogramSize> &LoudnessMeter::binEnergies()
+{
+    static const auto energies = [] {
+        std::array<double, histogramSize> energies;
+        for (auto bin = std::size_t(0); bin != histogramSize; ++bin) {
+            energies[bin] = pow(10.0, (binLoudness(bin) + 0.691) / 10.0);
+        }
+        return energies;
+    }();
+    return energies;
+}
+
+/*!
+ * \brief Constructs a new meter for a stream of signed 16-bit PCM with the specified \a sampleRate and \a channels.
+ */
+LoudnessMeter::LoudnessMeter(unsigned int sampleRate, unsigned int channels)
+    : m_channels(channels)
+    , m_analyzedChannels(min(channels, maxChannels))
+    , m_subBlockFrames(max<std::uint32_t>(sampleRate / 10, 1))
+    , m_state()
+    , m_sums()
+    , m_frames(0)
+    , m_subBlocks()
+    , m_subBlockCount(0)
+    , m_blockHistogram()
+    , m_shortTermHistogram()
+    , m_history()
+    , m_historyPos(0)
+    , m_truePeak(0.0f)
+    , m_pending()
+    , m_pendingSize(0)
+{
+    // pre-filter (high shelf) and RLB filter (high-pass) as specified by ITU-R BS.1770, adapted to the sample rate
+    const auto rate = static_cast<double>(max(sampleRate, 1u));
+    auto f0 = 1681.974450955533, gain = 3.999843853973347, q = 0.7071752369554196;
+    auto k = tan(M_PI * f0 / rate);
+    const auto vh = pow(10.0, gain / 20.0), vb = pow(vh, 0.4996667741545416);
+    auto a0 = 1.0 + k / q + k * k;
+    m_shelf = { (vh + vb * k / q + k * k) / a0, 2.0 * (k * k - vh) / a0, (vh - vb * k / q + k * k) / a0, 2.0 * (k * k - 1.0) / a0,
+        (1.0 - k / q + k * k) / a0 };
+    f0 = 38.13547087602444, q = 0.5003270373238773;
+    k = tan(M_PI * f0 / rate);
+    a0 = 1.0 + k / q + k * k;
+    m_highPass = { 1.0, -2.0, 1.0, 2.0 * (k * k - 1.0) / a0, (1.0 - k / q + k * k) / a0 };
+    // weight the surround channels of 5.1 streams higher and ignore the LFE channel
+    m_weights.fill(1.0);
+    if (channels == 6) {
+        m_weights[3] = 0.0;
+        m_weights[4] = m_weights[5] = 1.41;
+    }
+    // windowed sinc interpolating at four phases between the input samples, each phase normalized to unity gain
+    constexpr auto length = 4 * interpolationTaps;
+    for (auto phase = std::size_t(0); phase != 4; ++phase) {
+        auto sum = 0.0f;
+        for (auto tap = std::size_t(0); tap != interpolationTaps; ++tap) {
+            // the newest sample is the last within the history so the taps are reversed
+            const auto n = phase + 4 * (interpolationTaps - 1 - tap);
+            const auto x = (static_cast<double>(n) - (length - 1) / 2.0) / 4.0;
+            const auto sinc = x == 0.0 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+            const auto window = 0.5 - 0.5 * cos(2.0 * M_PI * (static_cast<double>(n) + 0.5) / length);
+            sum += m_phases[phase][tap] = static_cast<float>(sinc * window);
+        }
+        for (auto &coefficient : m_phases[phase]) {
+            coefficient /= sum;
+        }
+    }
+}
+
+/*!
+ * \brief Analyzes the specified \a data.
+ * \remarks The data might be split at any byte; an incomplete frame is kept until the rest of it is passed.
+ */
+void LoudnessMeter::add(const char *data, std::size_t size)
+{
+    const auto frameSize = static_cast<std::size_t>(m_channels) * 2;
+    if (!frameSize || frameSize > m_pending.size()) {
+        return;
+    }
+    if (m_pendingSize) {
+        const auto missing = min(frameSize - m_pendingSize, size);
+        memcpy(m_pending.data() + m_pendingSize, data, missing);
+        m_pendingSize += missing;
+        data += missing;
+        size -= missing;
+        if (m_pendingSize < frameSize) {
+            return;
+        }
+        processFrames(m_pending.data(), 1);
+        m_pendingSize = 0;
+    }
+    const auto frameCount = size / frameSize;
+    processFrames(data, frameCount);
+    m_pendingSize = size - frameCount * frameSize;
+    memcpy(m_pending.data(), data + frameCount * frameSize, m_pendingSize);
+}
+
+/*!
+ * \brief Analyzes the specified number of interleaved frames.
+ */
+void LoudnessMeter::processFrames(const char *data, std::size_t frameCount)
+{
+    constexpr auto scale = 1.0 / 32768.0;
+    const auto frameSize = static_cast<std::size_t>(m_channels) * 2;
+    alignas(16) double samples[maxChannels] = {};
+    for (; frameCount; --frameCount, data += frameSize) {
+        for (auto channel = 0u; channel != m_analyzedChannels; ++channel) {
+            std::int16_t sample;
+            memcpy(&sample, data + channel * 2, 2);
+            samples[channel] = sample * scale;
+        }
+        processTruePeak(samples);
+        // apply K-weighting using transposed direct form II, two channels at a time if possible
+        auto channel = 0u;
+#ifdef __SSE2__
+        const auto shelfB0 = _mm_set1_pd(m_shelf[0]), shelfB1 = _mm_set1_pd(m_shelf[1]), shelfB2 = _mm_set1_pd(m_shelf[2]);
+        const auto shelfA1 = _mm_set1_pd(m_shelf[3]), shelfA2 = _mm_set1_pd(m_shelf[4]);
+        const auto highPassA1 = _mm_set1_pd(m_highPass[3]), highPassA2 = _mm_set1_pd(m_highPass[4]);
+        const auto two = _mm_set1_pd(2.0);
+        for (; channel + 2 <= m_analyzedChannels; channel += 2) {
+            const auto x = _mm_load_pd(samples + channel);
+            auto z1 = _mm_load_pd(m_state[0] + channel), z2 = _mm_load_pd(m_state[1] + channel);
+            const auto y = _mm_add_pd(_mm_mul_pd(shelfB0, x), z1);
+            z1 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(shelfB1, x), _mm_mul_pd(shelfA1, y)), z2);
+            z2 = _mm_sub_pd(_mm_mul_pd(shelfB2, x), _mm_mul_pd(shelfA2, y));
+            _mm_store_pd(m_state[0] + channel, z1);
+            _mm_store_pd(m_state[1] + channel, z2);
+            // the high-pass has the numerator 1, -2, 1
+            auto z3 = _mm_load_pd(m_state[2] + channel), z4 = _mm_load_pd(m_state[3] + channel);
+            const auto filtered = _mm_add_pd(y, z3);
+            z3 = _mm_add_pd(_mm_sub_pd(_mm_sub_pd(_mm_setzero_pd(), _mm_mul_pd(two, y)), _mm_mul_pd(highPassA1, filtered)), z4);
+            z4 = _mm_sub_pd(y, _mm_mul_pd(highPassA2, filtered));
+            _mm_store_pd(m_state[2] + channel, z3);
+            _mm_store_pd(m_state[3] + channel, z4);
+            _mm_store_pd(m_sums + channel, _mm_add_pd(_mm_load_pd(m_sums + channel), _mm_mul_pd(filtered, filtered)));
+        }
+#endif
+        for (; channel != m_analyzedChannels; ++channel) {
+            const auto x = samples[channel];
+            const auto y = m_shelf[0] * x + m_state[0][channel];
+            m_state[0][channel] = m_shelf[1] * x - m_shelf[3] * y + m_state[1][channel];
+            m_state[1][channel] = m_shelf[2] * x - m_shelf[4] * y;
+            const auto filtered = y + m_state[2][channel];
+            m_state[2][channel] = -2.0 * y - m_highPass[3] * filtered + m_state[3][channel];
+            m_state[3][channel] = y - m_highPass[4] * filtered;
+            m_sums[channel] += filtered * filtered;
+        }
+        if (++m_frames == m_subBlockFrames) {
+            finishSubBlock();
+        }
+    }
+}
+
+/*!
+ * \brief Updates the true peak with the specified (normalized) \a samples of one frame.
+ */
+void LoudnessMeter::processTruePeak(const double *samples)
+{
+    auto peak = m_truePeak;
+    for (auto channel = 0u; channel != m_analyzedChannels; ++channel) {
+        auto *const history = m_history[channel];
+        const auto sample = static_cast<float>(samples[channel]);
+        history[m_historyPos] = history[m_historyPos + interpolationTaps] = sample;
+        const auto *const window = history + m_historyPos + 1;
+        for (const auto &coefficients : m_phases) {
+#ifdef __SSE2__
+            auto sums = _mm_mul_ps(_mm_loadu_ps(window), _mm_load_ps(coefficients));
+            sums = _mm_add_ps(sums, _mm_mul_ps(_mm_loadu_ps(window + 4), _mm_load_ps(coefficients + 4)));
+            sums = _mm_add_ps(sums, _mm_mul_ps(_mm_loadu_ps(window + 8), _mm_load_ps(coefficients + 8)));
+            alignas(16) float lanes[4];
+            _mm_store_ps(lanes, sums);
+            const auto value = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#else
+            auto value = 0.0f;
+            for (auto tap = std::size_t(0); tap != interpolationTaps; ++tap) {
+                value += window[tap] * coefficients[tap];
+            }
+#endif
+            peak = max(peak, fabs(value));
+        }
+        peak = max(peak, fabs(sample));
+    }
+    m_truePeak = peak;
+    m_historyPos = (m_historyPos + 1) % interpolationTaps;
+}
+
+/*!
+ * \brief Adds the block of 400 ms and the block of 3 s ending with the current sub-block to the histograms.
+ */
+void LoudnessMeter::finishSubBlock()
+{
+    auto meanSquare = 0.0;
+    for (auto channel = 0u; channel != m_analyzedChannels; ++channel) {
+        meanSquare += m_weights[channel] * m_sums[channel];
+        m_sums[channel] = 0.0;
+    }
+    m_subBlocks[m_subBlockCount++ % shortTermSubBlocks] = meanSquare / m_frames;
+    m_frames = 0;
+    const auto sumOfLast = [this](std::size_t count) {
+        auto sum = 0.0;
+        for (auto i = std::size_t(1); i <= count; ++i) {
+            sum += m_subBlocks[(m_subBlockCount - i) % shortTermSubBlocks];
+        }
+        return sum / static_cast<double>(count);
+    };
+    if (m_subBlockCount >= 4) {
+        addToHistogram(m_blockHistogram, sumOfLast(4));
+    }
+    if (m_subBlockCount >= shortTermSubBlocks) {
+        addToHistogram(m_shortTermHistogram, sumOfLast(shortTermSubBlocks));
+    }
+}
+
+/*!
+ * \brief Adds a block with the specified \a meanSquare to \a histogram unless it is below the absolute gate.
+ */
+void LoudnessMeter::addToHistogram(Histogram &histogram, double meanSquare)
+{
+    if (meanSquare <= 0.0) {
+        return;
+    }
+    const auto bin = (loudness(meanSquare) - histogramMin) / histogramBinWidth;
+    if (bin >= 0.0) {
+        ++histogram[min(static_cast<std::size_t>(bin), histogramSize - 1)];
+    }
+}
+
+/*!
+ * \brief Returns the first bin of \a histogram which is not below the relative gate.
+ * \remarks The relative gate is \a relativeGate LU below the loudness of all blocks. Returns histogramSize if the
+ *          histogram is empty.
+ */
+std::size_t LoudnessMeter::gatedBin(const Histogram &histogram, double relativeGate)
+{
+    const auto &energies = binEnergies();
+    auto sum = 0.0;
+    auto count = std::uint64_t(0);
+    for (auto bin = std::size_t(0); bin != histogramSize; ++bin) {
+        sum += histogram[bin] * energies[bin];
+        count += histogram[bin];
+    }
+    if (!count) {
+        return histogramSize;
+    }
+    const auto gate = loudness(sum / static_cast<double>(count)) + relativeGate;
+    return static_cast<std::size_t>(max(ceil((gate - histogramMin) / histogramBinWidth - 0.5), 0.0));
+}
+
+/*!
+ * \brief Returns the integrated loudness in LUFS or -infinity if the stream has been silent (or too short).
+ */
+double LoudnessMeter::integratedLoudness() const
+{
+    const auto &energies = binEnergies();
+    auto sum = 0.0;
+    auto count = std::uint64_t(0);
+    for (auto bin = gatedBin(m_blockHistogram, -10.0); bin < histogramSize; ++bin) {
+        sum += m_blockHistogram[bin] * energies[bin];
+        count += m_blockHistogram[bin];
+    }
+    return count ? loudness(sum / static_cast<double>(count)) : -HUGE_VAL;
+}
+
+/*!
+ * \brief Returns the loudness range in LU (the spread between the 10th and 95th percentile of the short-term loudness).
+ */
+double LoudnessMeter::loudnessRange() const
+{
+    const auto firstBin = gatedBin(m_shortTermHistogram, -20.0);
+    auto count = std::uint64_t(0);
+    for (auto bin = firstBin; bin < histogramSize; ++bin) {
+        count += m_shortTermHistogram[bin];
+    }
+    if (!count) {
+        return 0.0;
+    }
+    const auto percentile = [&, this](double fraction) {
+        const auto threshold = static_cast<std::uint64_t>(ceil(fraction * static_cast<double>(count)));
+        auto cumulativeCount = std::uint64_t(0);
+        for (auto bin = firstBin; bin < histogramSize; ++bin) {
+            if ((cumulativeCount += m_shortTermHistogram[bin]) >= max<std::uint64_t>(threshold, 1)) {
+                return binLoudness(bin);
+            }
+        }
+        return binLoudness(histogramSize - 1);
+    };
+    return percentile(0.95) - percentile(0.10);
+}
+} // namespace DBusSoundRecorder
@@ -0,0 +1,91 @@
+#ifndef LOUDNESSMETER_H
+#define LOUDNESSMETER_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace DBusSoundRecorder {
+
+/*!
+ * \brief The LoudnessMeter class measures the loudness of a PCM stream according to EBU R128 (ITU-R BS.1770-4).
+ *
+ * The stream is analyzed while it is passed so no second pass over the encoded file is needed:
+ * - The K-weighting filter (two cascaded biquads) processes two channels at a time using SSE2 if available.
+ * - The mean squares of the filtered samples are summed up in sub-blocks of 100 ms. The gating blocks (400 ms with
+ *   75 % overlap for the integrated loudness and 3 s for the loudness range) are formed from the last sub-blocks.
+ * - The loudness of the gating blocks is collected in histograms with bins of 0.1 LU so gating does not need to keep
+ *   the blocks.
+ * - The true peak is determined by oversampling four times via a polyphase FIR filter.
+ *
+ * All state has a fixed size so no memory is allocated while analyzing. At most maxChannels channels are supported;
+ * further channels are ignored.
+ */
+class LoudnessMeter {
+public:
+    static constexpr unsigned int maxChannels = 8;
+
+    LoudnessMeter(unsigned int sampleRate, unsigned int channels);
+
+    void add(const char *data, std::size_t size);
+    bool hasResult() const;
+    double integratedLoudness() const;
+    double loudnessRange() const;
+    double truePeak() const;
+
+private:
+    static constexpr std::size_t histogramSize = 750;
+    static constexpr std::size_t shortTermSubBlocks = 30;
+    static constexpr std::size_t interpolationTaps = 12;
+    using Histogram = std::array<std::uint32_t, histogramSize>;
+
+    void processFrames(const char *data, std::size_t frameCount);
+    void processTruePeak(const double *samples);
+    void finishSubBlock();
+    static void addToHistogram(Histogram &histogram, double meanSquare);
+    static std::size_t gatedBin(const Histogram &histogram, double relativeGate);
+    static const std::array<double, histogramSize> &binEnergies();
+
+    const unsigned int m_channels;
+    const unsigned int m_analyzedChannels;
+    const std::uint32_t m_subBlockFrames;
+    // K-weighting filter: coefficients b0, b1, b2, a1, a2 of both stages and their state per channel
+    std::array<double, 5> m_shelf;
+    std::array<double, 5> m_highPass;
+    alignas(16) double m_state[4][maxChannels];
+    alignas(16) double m_sums[maxChannels];
+    std::array<double, maxChannels> m_weights;
+    std::uint32_t m_frames;
+    // mean squares of the last sub-blocks (ring)
+    std::array<double, shortTermSubBlocks> m_subBlocks;
+    std::uint64_t m_subBlockCount;
+    Histogram m_blockHistogram;
+    Histogram m_shortTermHistogram;
+    // true peak: polyphase coefficients and the last samples of each channel (stored twice to avoid wrapping)
+    alignas(16) float m_phases[4][interpolationTaps];
+    alignas(16) float m_history[maxChannels][2 * interpolationTaps];
+    std::size_t m_historyPos;
+    float m_truePeak;
+    // bytes of an incomplete frame which have been passed so far (streams with more than 128 channels are not analyzed)
+    std::array<char, 256> m_pending;
+    std::size_t m_pendingSize;
+};
+
+/*!
+ * \brief Returns whether enough data has been analyzed to determine the integrated loudness.
+ */
+inline bool LoudnessMeter::hasResult() const
+{
+    return m_subBlockCount >= 4;
+}
+
+/*!
+ * \brief Returns the true peak as linear value (1.0 is full scale).
+ */
+inline double LoudnessMeter::truePeak() const
+{
+    return static_cast<double>(m_truePeak);
+}
+} // namespace DBusSoundRecorder
+
+#endif // LOUDNESSMETER_H
@@ -1,13 +1,23 @@
-#include "ffmpeglauncher.h"
-#include "playerwatcher.h"
+#include "albuminfocache.h"
+#include "fakeplayer.h"
+#include "metrics.h"
+#include "playerdiscovery.h"
+#include "processpool.h"
+#include "recorder.h"
 
 #include "resources/config.h"
 
 #include <c++utilities/application/argumentparser.h>
+#include <c++utilities/conversion/stringconversion.h>
 
 #include <QCoreApplication>
+#include <QDBusConnection>
+#include <QProcess>
+#include <QTimer>
 
 #include <iostream>
+#include <memory>
+#include <vector>
 
 using namespace std;
 using namespace CppUtilities;
@@ -21,7 +31,8 @@ int main(int argc, char *argv[])
     HelpArgument helpArg(parser);
     Argument recordArg("record", 'r', "starts recording");
     recordArg.setDenotesOperation(true);
-    Argument applicationArg("application", 'a', "specifies the application providing meta information via D-Bus interface");
+    Argument applicationArg(
+        "application", 'a', "specifies the application providing meta information via D-Bus interface (might be a wildcard pattern like \"vlc*\")");
     applicationArg.setRequired(true);
     applicationArg.setValueNames({ "name" });
     applicationArg.setRequiredValueCount(1);
@@ -50,38 +61,283 @@ int main(int argc, char *argv[])
     ffmpegOptions.setValueNames({ "options" });
     ffmpegOptions.setRequiredValueCount(1);
     ffmpegOptions.setCombinable(true);
-    recordArg.setSubArguments(
-        { &applicationArg, &sinkArg, &ffmpegInputOptions, &targetDirArg, &targetExtArg, &ignorePlaybackStatusArg, &ffmpegBinArg, &ffmpegOptions });
-    parser.setMainArguments({ &helpArg, &recordArg });
+    Argument continuousArg("continuous", 'c', "captures the sink continuously with a single ffmpeg process and cuts it into tracks");
+    continuousArg.setCombinable(true);
+    Argument captureBackendArg("capture-backend", '\0', "specifies how the sink is captured continuously (ffmpeg or pulse, default is ffmpeg)");
+    captureBackendArg.setValueNames({ "backend" });
+    captureBackendArg.setPreDefinedCompletionValues("ffmpeg pulse");
+    captureBackendArg.setRequiredValueCount(1);
+    captureBackendArg.setCombinable(true);
+    Argument sampleRateArg("sample-rate", '\0', "specifies the sample rate used for capturing continuously (default is 44100)");
+    sampleRateArg.setValueNames({ "rate" });
+    sampleRateArg.setRequiredValueCount(1);
+    sampleRateArg.setCombinable(true);
+    Argument channelsArg("channels", '\0', "specifies the number of channels used for capturing continuously (default is 2)");
+    channelsArg.setValueNames({ "count" });
+    channelsArg.setRequiredValueCount(1);
+    channelsArg.setCombinable(true);
+    Argument settleTimeArg("settle-time", '\0', "specifies the time meta data must not change before a new track is started (default is 100 ms)");
+    settleTimeArg.setValueNames({ "milliseconds" });
+    settleTimeArg.setRequiredValueCount(1);
+    settleTimeArg.setCombinable(true);
+    Argument prerollArg("preroll", '\0', "specifies the time before the track change a new track should start when capturing continuously");
+    prerollArg.setValueNames({ "milliseconds" });
+    prerollArg.setRequiredValueCount(1);
+    prerollArg.setCombinable(true);
+    Argument prerollBufferArg("preroll-buffer", '\0', "specifies the duration of captured audio kept for the pre-roll (default is 5 seconds)");
+    prerollBufferArg.setValueNames({ "seconds" });
+    prerollBufferArg.setRequiredValueCount(1);
+    prerollBufferArg.setCombinable(true);
+    Argument refineCutsArg("refine-cuts", '\0', "moves cuts to the nearest silence within the specified window when capturing continuously");
+    refineCutsArg.setValueNames({ "milliseconds" });
+    refineCutsArg.setRequiredValueCount(1);
+    refineCutsArg.setCombinable(true);
+    Argument silenceThresholdArg("silence-threshold", '\0', "specifies the level below which audio is considered silent when refining cuts (default is -50 dBFS)");
+    silenceThresholdArg.setValueNames({ "dBFS" });
+    silenceThresholdArg.setRequiredValueCount(1);
+    silenceThresholdArg.setCombinable(true);
+    Argument analyzeLoudnessArg("analyze-loudness", '\0', "measures the loudness (EBU R128) while capturing continuously and writes ReplayGain tags");
+    analyzeLoudnessArg.setCombinable(true);
+    Argument pcmFanoutArg("pcm-fanout", '\0', "publishes the captured stream via shared memory to local readers attaching to the specified socket");
+    pcmFanoutArg.setValueNames({ "path" });
+    pcmFanoutArg.setRequiredValueCount(1);
+    pcmFanoutArg.setCombinable(true);
+    Argument spoolDirArg("spool-dir", '\0', "captures continuously into lossless spool files which are encoded in the background");
+    spoolDirArg.setValueNames({ "path" });
+    spoolDirArg.setRequiredValueCount(1);
+    spoolDirArg.setCombinable(true);
+    Argument stagingDirArg("staging-dir", '\0', "writes files into the specified directory and moves them into the target directory once finished");
+    stagingDirArg.setValueNames({ "path" });
+    stagingDirArg.setRequiredValueCount(1);
+    stagingDirArg.setCombinable(true);
+    Argument encoderJobsArg("encoder-jobs", '\0', "specifies the number of spool files encoded in parallel (default is the number of cores)");
+    encoderJobsArg.setValueNames({ "count" });
+    encoderJobsArg.setRequiredValueCount(1);
+    encoderJobsArg.setCombinable(true);
+    Argument encoderBacklogArg("encoder-backlog", '\0', "specifies the number of spool files which might wait for encoding (default is 64)");
+    encoderBacklogArg.setValueNames({ "count" });
+    encoderBacklogArg.setRequiredValueCount(1);
+    encoderBacklogArg.setCombinable(true);
+    Argument indexArg("index", '\0', "specifies a file to keep track of recorded tracks (speeds up choosing file names)");
+    indexArg.setValueNames({ "path" });
+    indexArg.setRequiredValueCount(1);
+    indexArg.setCombinable(true);
+    Argument journalArg("journal", '\0', "specifies a file to log recordings in so files left incomplete (e.g. on a crash) are recovered on startup");
+    journalArg.setValueNames({ "path" });
+    journalArg.setRequiredValueCount(1);
+    journalArg.setCombinable(true);
+    Argument journalRecoveryArg("journal-recovery", '\0', "specifies how incomplete files are recovered (repair, quarantine or delete, default is quarantine)");
+    journalRecoveryArg.setValueNames({ "strategy" });
+    journalRecoveryArg.setRequiredValueCount(1);
+    journalRecoveryArg.setPreDefinedCompletionValues("repair quarantine delete");
+    journalRecoveryArg.setCombinable(true);
+    Argument skipRecordedArg("skip-recorded", '\0', "skips tracks which have already been recorded completely according to the index");
+    skipRecordedArg.setCombinable(true);
+    Argument fingerprintArg("fingerprint", '\0', "recognizes ads and recorded tracks by their sound when capturing continuously (requires --index)");
+    fingerprintArg.setCombinable(true);
+    Argument verifyArg("verify", '\0', "verifies finished files in the background (container, duration and silence)");
+    verifyArg.setCombinable(true);
+    Argument verifyReportArg("verify-report", '\0', "appends files which failed verification to the specified report file (implies --verify)");
+    verifyReportArg.setValueNames({ "path" });
+    verifyReportArg.setRequiredValueCount(1);
+    verifyReportArg.setCombinable(true);
+    Argument verifyQuarantineArg("verify-quarantine", '\0', "moves files which failed verification into the specified directory (implies --verify)");
+    verifyQuarantineArg.setValueNames({ "path" });
+    verifyQuarantineArg.setRequiredValueCount(1);
+    verifyQuarantineArg.setCombinable(true);
+    Argument tagAfterwardsArg("tag-afterwards", '\0', "writes tags after a file has been finished using the final meta data (requires tagparser)");
+    tagAfterwardsArg.setCombinable(true);
+    Argument traceArg("trace", '\0', "records the D-Bus events received from the player into the specified trace file");
+    traceArg.setValueNames({ "path" });
+    traceArg.setRequiredValueCount(1);
+    traceArg.setCombinable(true);
+    Argument metricsFileArg("metrics-file", '\0', "periodically writes timings of track switches and counters into the specified file (Prometheus text format)");
+    metricsFileArg.setValueNames({ "path" });
+    metricsFileArg.setRequiredValueCount(1);
+    metricsFileArg.setCombinable(true);
+    const ArgumentInitializerList recordArgs = { &applicationArg, &sinkArg, &ffmpegInputOptions, &targetDirArg, &targetExtArg,
+        &ignorePlaybackStatusArg, &ffmpegBinArg, &ffmpegOptions, &continuousArg, &captureBackendArg, &sampleRateArg, &channelsArg, &settleTimeArg, &prerollArg,
+        &prerollBufferArg, &refineCutsArg, &silenceThresholdArg, &analyzeLoudnessArg, &pcmFanoutArg, &spoolDirArg, &stagingDirArg, &encoderJobsArg,
+        &encoderBacklogArg, &indexArg, &journalArg, &journalRecoveryArg, &skipRecordedArg, &fingerprintArg, &tagAfterwardsArg, &verifyArg,
+        &verifyReportArg, &verifyQuarantineArg, &traceArg, &metricsFileArg };
+    recordArg.setSubArguments(recordArgs);
+    Argument replayArg("replay", '\0', "replays a trace file via a fake player on a private D-Bus daemon and records it (for testing/benchmarking)");
+    replayArg.setDenotesOperation(true);
+    Argument inputArg("input", '\0', "specifies the trace file to replay");
+    inputArg.setRequired(true);
+    inputArg.setValueNames({ "path" });
+    inputArg.setRequiredValueCount(1);
+    inputArg.setCombinable(true);
+    Argument speedArg("speed", '\0', "specifies the factor to speed up the replay by (default is 1)");
+    speedArg.setValueNames({ "factor" });
+    speedArg.setRequiredValueCount(1);
+    speedArg.setCombinable(true);
+    replayArg.setSubArguments(recordArgs);
+    replayArg.addSubArgument(&inputArg);
+    replayArg.addSubArgument(&speedArg);
+    Argument daemonArg("daemon", 'd', "starts recording multiple players as specified in a config file");
+    daemonArg.setDenotesOperation(true);
+    Argument configArg("config", '\0', "specifies the config file (see README.md for its format)");
+    configArg.setRequired(true);
+    configArg.setValueNames({ "path" });
+    configArg.setRequiredValueCount(1);
+    daemonArg.setSubArguments({ &configArg, &encoderJobsArg, &encoderBacklogArg, &metricsFileArg });
+    parser.setMainArguments({ &helpArg, &recordArg, &daemonArg, &replayArg });
     // parse command line arguments
     parser.parseArgs(argc, argv);
+    const auto metricsFilePath = metricsFileArg.isPresent() ? QString::fromLocal8Bit(metricsFileArg.values().front()) : QString();
     try {
-        if (recordArg.isPresent()) {
-            // start watching/recording
-            cerr << "Watching MPRIS service of the specified application \"" << applicationArg.values().front() << "\" ..." << endl;
-            // create app loop, player watcher and ffmpeg launcher
-            QCoreApplication app(argc, argv);
-            PlayerWatcher watcher(QString::fromLocal8Bit(applicationArg.values().front()), ignorePlaybackStatusArg.isPresent());
-            FfmpegLauncher ffmpeg(watcher);
-            // pass specified args to ffmpeg launcher
+        if (recordArg.isPresent() || replayArg.isPresent()) {
+            // read config from args
+            RecorderConfig config;
+            config.application = QString::fromLocal8Bit(applicationArg.values().front());
+            config.ignorePlaybackStatus = ignorePlaybackStatusArg.isPresent();
+            if (settleTimeArg.isPresent()) {
+                config.settleTime = stringToNumber<int>(settleTimeArg.values().front());
+            }
             if (sinkArg.isPresent()) {
-                ffmpeg.setSink(QString::fromLocal8Bit(sinkArg.values().front()));
+                config.sink = QString::fromLocal8Bit(sinkArg.values().front());
             }
             if (ffmpegInputOptions.isPresent()) {
-                ffmpeg.setFFmpegInputOptions(QString::fromLocal8Bit(ffmpegInputOptions.values().front()));
+                config.inputOptions = QString::fromLocal8Bit(ffmpegInputOptions.values().front());
             }
             if (ffmpegBinArg.isPresent()) {
-                ffmpeg.setFFmpegBinary(QString::fromLocal8Bit(ffmpegBinArg.values().front()));
+                config.ffmpegBinary = QString::fromLocal8Bit(ffmpegBinArg.values().front());
             }
             if (ffmpegOptions.isPresent()) {
-                ffmpeg.setFFmpegOptions(QString::fromLocal8Bit(ffmpegOptions.values().front()));
+                config.options = QString::fromLocal8Bit(ffmpegOptions.values().front());
             }
             if (targetDirArg.isPresent()) {
-                ffmpeg.setTargetDir(QString::fromLocal8Bit(targetDirArg.values().front()));
+                config.targetDir = QString::fromLocal8Bit(targetDirArg.values().front());
             }
             if (targetExtArg.isPresent()) {
-                ffmpeg.setTargetExtension(QString::fromLocal8Bit(targetExtArg.values().front()));
+                config.targetExtension = QString::fromLocal8Bit(targetExtArg.values().front());
+            }
+            config.continuous = continuousArg.isPresent();
+            if (captureBackendArg.isPresent()) {
+                config.setValue("capture-backend", captureBackendArg.values().front());
+            }
+            if (sampleRateArg.isPresent()) {
+                config.sampleRate = stringToNumber<unsigned int>(sampleRateArg.values().front());
+            }
+            if (channelsArg.isPresent()) {
+                config.channels = stringToNumber<unsigned int>(channelsArg.values().front());
+            }
+            if (prerollArg.isPresent()) {
+                config.preroll = stringToNumber<unsigned int>(prerollArg.values().front());
+            }
+            if (prerollBufferArg.isPresent()) {
+                config.prerollBuffer = stringToNumber<double>(prerollBufferArg.values().front());
+            }
+            if (refineCutsArg.isPresent()) {
+                config.refineWindow = stringToNumber<unsigned int>(refineCutsArg.values().front());
+            }
+            if (silenceThresholdArg.isPresent()) {
+                config.silenceThreshold = stringToNumber<double>(silenceThresholdArg.values().front());
+            }
+            config.analyzeLoudness = analyzeLoudnessArg.isPresent();
+            if (pcmFanoutArg.isPresent()) {
+                config.pcmFanout = QString::fromLocal8Bit(pcmFanoutArg.values().front());
+            }
+            if (spoolDirArg.isPresent()) {
+                config.spoolDir = QString::fromLocal8Bit(spoolDirArg.values().front());
+            }
+            if (stagingDirArg.isPresent()) {
+                config.stagingDir = QString::fromLocal8Bit(stagingDirArg.values().front());
+            }
+            if (indexArg.isPresent()) {
+                config.index = QString::fromLocal8Bit(indexArg.values().front());
+            }
+            if (journalArg.isPresent()) {
+                config.journal = QString::fromLocal8Bit(journalArg.values().front());
+            }
+            if (journalRecoveryArg.isPresent()) {
+                config.setValue("journal-recovery", journalRecoveryArg.values().front());
+            }
+            config.skipRecorded = skipRecordedArg.isPresent();
+            config.fingerprint = fingerprintArg.isPresent();
+            if (tagAfterwardsArg.isPresent()) {
+                config.setValue("tag-afterwards", "yes");
+            }
+            config.verify = verifyArg.isPresent();
+            if (verifyReportArg.isPresent()) {
+                config.verifyReport = QString::fromLocal8Bit(verifyReportArg.values().front());
+            }
+            if (verifyQuarantineArg.isPresent()) {
+                config.verifyQuarantine = QString::fromLocal8Bit(verifyQuarantineArg.values().front());
+            }
+            if (traceArg.isPresent()) {
+                config.trace = QString::fromLocal8Bit(traceArg.values().front());
+            }
+            if (encoderJobsArg.isPresent()) {
+                config.encoderJobs = stringToNumber<int>(encoderJobsArg.values().front());
+            }
+            if (encoderBacklogArg.isPresent()) {
+                config.encoderBacklog = stringToNumber<int>(encoderBacklogArg.values().front());
+            }
+            // create app loop and recorder (player watcher and ffmpeg launcher)
+            QCoreApplication app(argc, argv);
+            unique_ptr<MetricsFile> metricsFile;
+            if (!metricsFilePath.isEmpty()) {
+                metricsFile = make_unique<MetricsFile>(metricsFilePath);
+            }
+            if (replayArg.isPresent()) {
+                // serve the trace from a fake player on a private bus so real players do not interfere
+                const auto events = readTrace(QString::fromLocal8Bit(inputArg.values().front()));
+                QProcess busDaemon;
+                const auto busAddress = startPrivateBus(busDaemon);
+                qputenv("DBUS_SESSION_BUS_ADDRESS", busAddress.toLocal8Bit());
+                FakePlayer player(QDBusConnection::connectToBus(busAddress, QStringLiteral("fake-player")), config.application);
+                if (!player.registerService()) {
+                    return 4;
+                }
+                Recorder recorder(config);
+                player.measureSwitchLatency(recorder.watcher());
+                // give the recorder a moment to finish the last track before exiting
+                QObject::connect(&player, &FakePlayer::finished, &app, [&app] { QTimer::singleShot(1000, &app, &QCoreApplication::quit); });
+                player.replay(events, speedArg.isPresent() ? stringToNumber<double>(speedArg.values().front()) : 1.0);
+                const auto exitCode = app.exec();
+                player.printStatistics();
+                return exitCode;
+            }
+            if (PlayerDiscovery::isPattern(config.application)) {
+                // attach a recorder to each matching player
+                PlayerDiscovery discovery;
+                discovery.addRule(config);
+                discovery.start();
+                return app.exec();
+            }
+            Recorder recorder(config);
+            // enter app loop
+            return app.exec();
+        } else if (daemonArg.isPresent()) {
+            // read configs of all recorders before doing anything
+            const auto configs = readRecorderConfigs(QString::fromLocal8Bit(configArg.values().front()));
+            // create app loop and a recorder for each config; all recorders share the D-Bus connection, the encoder
+            // pool and the album info cache
+            QCoreApplication app(argc, argv);
+            unique_ptr<MetricsFile> metricsFile;
+            if (!metricsFilePath.isEmpty()) {
+                metricsFile = make_unique<MetricsFile>(metricsFilePath);
+            }
+            ProcessPool encoderPool;
+            if (encoderJobsArg.isPresent()) {
+                encoderPool.setMaxJobs(stringToNumber<int>(encoderJobsArg.values().front()));
+            }
+            if (encoderBacklogArg.isPresent()) {
+                encoderPool.setMaxBacklog(stringToNumber<int>(encoderBacklogArg.values().front()));
+            }
+            const auto albumInfoCache = make_shared<AlbumInfoCache>();
+            PlayerDiscovery discovery(&encoderPool, albumInfoCache);
+            vector<unique_ptr<Recorder>> recorders;
+            for (const auto &config : configs) {
+                if (PlayerDiscovery::isPattern(config.application)) {
+                    discovery.addRule(config);
+                } else {
+                    recorders.emplace_back(make_unique<Recorder>(config, &encoderPool, albumInfoCache));
+                }
             }
+            discovery.start();
             // enter app loop
             return app.exec();
         } else if (!helpArg.isPresent()) {
@@ -0,0 +1,152 @@
+#include "metrics.h"
+
+#include <QSaveFile>
+#include <QTimer>
+
+#include <iostream>
+
+using namespace std;
+
+namespace DBusSoundRecorder {
+
+inline ostream &operator<<(ostream &stream, const QString &str)
+{
+    return stream << str.toLocal8Bit().data();
+}
+
+/*!
+ * \brief Returns the name and help text of the histogram for the specified \a phase.
+ */
+inline pair<const char *, const char *> phaseInfo(Metrics::Phase phase)
+{
+    switch (phase) {
+    case Metrics::Phase::Resolved:
+        return { "dbus_soundrecorder_switch_resolved_seconds", "Time from the first song change signal until the meta data has settled" };
+    case Metrics::Phase::Spawned:
+        return { "dbus_soundrecorder_switch_spawned_seconds", "Time from the first song change signal until ffmpeg has been started" };
+    case Metrics::Phase::FirstBytes:
+        return { "dbus_soundrecorder_switch_first_bytes_seconds",
+            "Time from the first song change signal until the first data has been passed to the encoder" };
+    default:
+        return { "dbus_soundrecorder_switch_reaped_seconds", "Time from the first song change signal until the previous ffmpeg has been reaped" };
+    }
+}
+
+/*!
+ * \brief Returns the name and help text of the specified \a counter.
+ */
+inline pair<const char *, const char *> counterInfo(Metrics::Counter counter)
+{
+    switch (counter) {
+    case Metrics::Counter::FfmpegStarts:
+        return { "dbus_soundrecorder_ffmpeg_starts_total", "Number of ffmpeg processes started for recording tracks" };
+    case Metrics::Counter::FfmpegFailures:
+        return { "dbus_soundrecorder_ffmpeg_failures_total", "Number of ffmpeg processes which failed to start or stopped unexpectedly" };
+    case Metrics::Counter::CaptureRestarts:
+        return { "dbus_soundrecorder_capture_restarts_total", "Number of restarts of the continuous capture" };
+    case Metrics::Counter::Kills:
+        return { "dbus_soundrecorder_ffmpeg_kills_total", "Number of ffmpeg processes killed after not finishing on SIGTERM" };
+    case Metrics::Counter::AdsSkipped:
+        return { "dbus_soundrecorder_ads_skipped_total", "Number of ads which have not been recorded" };
+    case Metrics::Counter::DuplicatesDiscarded:
+        return { "dbus_soundrecorder_duplicates_discarded_total", "Number of recordings discarded as duplicates of recorded tracks" };
+    case Metrics::Counter::FilesFlagged:
+        return { "dbus_soundrecorder_files_flagged_total", "Number of finished files which failed verification" };
+    case Metrics::Counter::BytesCaptured:
+        return { "dbus_soundrecorder_captured_bytes_total", "Number of bytes read from the continuous capture" };
+    default:
+        return { "dbus_soundrecorder_written_bytes_total", "Number of bytes passed to encoders or written to spool files" };
+    }
+}
+
+/*!
+ * \brief Returns the metrics of the process.
+ * \remarks Must only be used from the main thread.
+ */
+Metrics &Metrics::instance()
+{
+    static Metrics metrics;
+    return metrics;
+}
+
+/*!
+ * \brief Records that the specified \a phase of the track switch announced at \a songChangeTime has been completed now.
+ * \remarks Does nothing if \a songChangeTime is not set (e.g. the recording has not been started by a song change).
+ */
+void Metrics::observe(Phase phase, Clock::time_point songChangeTime)
+{
+    if (songChangeTime == Clock::time_point()) {
+        return;
+    }
+    const auto seconds = chrono::duration<double>(Clock::now() - songChangeTime).count();
+    auto &histogram = m_histograms[static_cast<size_t>(phase)];
+    auto bucket = size_t(0);
+    while (bucket < bucketBounds.size() && seconds > bucketBounds[bucket]) {
+        ++bucket;
+    }
+    ++histogram.buckets[bucket];
+    ++histogram.count;
+    histogram.sum += seconds;
+}
+
+/*!
+ * \brief Returns the metrics in the Prometheus text format.
+ */
+QByteArray Metrics::toPrometheusText() const
+{
+    QByteArray text;
+    for (auto phase = size_t(0); phase != m_histograms.size(); ++phase) {
+        const auto info = phaseInfo(static_cast<Phase>(phase));
+        const auto &histogram = m_histograms[phase];
+        text += QByteArray("# HELP ") + info.first + ' ' + info.second + "\n# TYPE " + info.first + " histogram\n";
+        auto cumulativeCount = std::uint64_t(0);
+        for (auto bucket = size_t(0); bucket != histogram.buckets.size(); ++bucket) {
+            cumulativeCount += histogram.buckets[bucket];
+            text += QByteArray(info.first) + "_bucket{le=\""
+                + (bucket < bucketBounds.size() ? QByteArray::number(bucketBounds[bucket], 'g', 6) : QByteArray("+Inf")) + "\"} "
+                + QByteArray::number(static_cast<qulonglong>(cumulativeCount)) + '\n';
+        }
+        text += QByteArray(info.first) + "_sum " + QByteArray::number(histogram.sum, 'g', 9) + '\n';
+        text += QByteArray(info.first) + "_count " + QByteArray::number(static_cast<qulonglong>(histogram.count)) + '\n';
+    }
+    for (auto counter = size_t(0); counter != m_counters.size(); ++counter) {
+        const auto info = counterInfo(static_cast<Counter>(counter));
+        text += QByteArray("# HELP ") + info.first + ' ' + info.second + "\n# TYPE " + info.first + " counter\n";
+        text += QByteArray(info.first) + ' ' + QByteArray::number(static_cast<qulonglong>(m_counters[counter])) + '\n';
+    }
+    return text;
+}
+
+/*!
+ * \brief Constructs a new instance writing the metrics to the specified \a path every \a interval milliseconds.
+ * \remarks The file is written once more when the instance is destroyed so the final values are not lost.
+ */
+MetricsFile::MetricsFile(const QString &path, int interval, QObject *parent)
+    : QObject(parent)
+    , m_path(path)
+    , m_timer(new QTimer(this))
+{
+    connect(m_timer, &QTimer::timeout, this, &MetricsFile::write);
+    m_timer->start(interval);
+    write();
+}
+
+MetricsFile::~MetricsFile()
+{
+    write();
+}
+
+/*!
+ * \brief Writes the metrics into the file.
+ * \returns Returns whether the file could be written.
+ */
+bool MetricsFile::write()
+{
+    QSaveFile file(m_path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(Metrics::instance().toPrometheusText()) < 0 || !file.commit()) {
+        cerr << "Warning: Unable to write metrics file " << m_path << ": " << file.errorString() << endl;
+        return false;
+    }
+    return true;
+}
+} // namespace DBusSoundRecorder
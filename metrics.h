@@ -0,0 +1,96 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QObject>
+#include <QString>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+QT_FORWARD_DECLARE_CLASS(QTimer)
+
+namespace DBusSoundRecorder {
+
+/*!
+ * \brief The Metrics class collects timings of track switches and counters of the whole process.
+ *
+ * The phases of a track switch are measured from the time the first D-Bus signal announcing the new song has been
+ * received (see PlayerWatcher::songChangeTime()) using the monotonic clock. Recording a value only increments a few
+ * integers so it can be done on the hot path. The metrics are exported via MetricsFile.
+ */
+class Metrics {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class Phase {
+        Resolved, /**< the meta data of the new song has settled */
+        Spawned, /**< the ffmpeg process for the new song has been started (or the spool file has been created) */
+        FirstBytes, /**< the first captured data has been passed to the encoder of the new song (continuous capture only) */
+        Reaped, /**< the ffmpeg process of the previous song has been reaped */
+        Count,
+    };
+    enum class Counter {
+        FfmpegStarts, /**< ffmpeg processes started for recording tracks */
+        FfmpegFailures, /**< ffmpeg processes (including the capture) which could not be started or stopped unexpectedly */
+        CaptureRestarts, /**< restarts of the continuous capture after it stopped unexpectedly */
+        Kills, /**< ffmpeg processes which had to be killed because they did not finish after SIGTERM */
+        AdsSkipped, /**< ads which have not been recorded */
+        DuplicatesDiscarded, /**< recordings discarded because they sound like a track which has been recorded before */
+        FilesFlagged, /**< finished files which failed verification */
+        BytesCaptured, /**< bytes read from the continuous capture */
+        BytesWritten, /**< bytes passed to encoders or written to spool files */
+        Count,
+    };
+
+    static Metrics &instance();
+
+    void observe(Phase phase, Clock::time_point songChangeTime);
+    void increment(Counter counter, std::uint64_t value = 1);
+    QByteArray toPrometheusText() const;
+
+private:
+    /// \brief The upper bounds of the histogram buckets in seconds (the last bucket is +Inf).
+    static constexpr std::array<double, 12> bucketBounds = { 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0 };
+
+    struct Histogram {
+        std::array<std::uint64_t, bucketBounds.size() + 1> buckets = {};
+        std::uint64_t count = 0;
+        double sum = 0.0;
+    };
+
+    Metrics() = default;
+
+    std::array<Histogram, static_cast<std::size_t>(Phase::Count)> m_histograms;
+    std::array<std::uint64_t, static_cast<std::size_t>(Counter::Count)> m_counters = {};
+};
+
+/*!
+ * \brief Increments the specified \a counter by \a value.
+ */
+inline void Metrics::increment(Counter counter, std::uint64_t value)
+{
+    m_counters[static_cast<std::size_t>(counter)] += value;
+}
+
+/*!
+ * \brief The MetricsFile class periodically writes the metrics into a file using the Prometheus text format.
+ *
+ * The file is replaced atomically so it can be picked up by the textfile collector of the node exporter at any time.
+ */
+class MetricsFile : public QObject {
+    Q_OBJECT
+public:
+    explicit MetricsFile(const QString &path, int interval = 10000, QObject *parent = nullptr);
+    ~MetricsFile() override;
+
+public Q_SLOTS:
+    bool write();
+
+private:
+    QString m_path;
+    QTimer *m_timer;
+};
+} // namespace DBusSoundRecorder
+
+#endif // METRICS_H
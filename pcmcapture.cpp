@@ -0,0 +1,262 @@
+#include "pcmcapture.h"
+#include "ffmpegprocess.h"
+#include "metrics.h"
+#include "pcmfanout.h"
+#ifdef DBUS_SOUNDRECORDER_USE_LIBPULSE
+#include "pulsereader.h"
+#endif
+
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+namespace DBusSoundRecorder {
+
+inline ostream &operator<<(ostream &stream, const QString &str)
+{
+    return stream << str.toLocal8Bit().data();
+}
+
+PcmCapture::PcmCapture(QObject *parent)
+    : QObject(parent)
+    , m_backend(CaptureBackend::FFmpeg)
+    , m_process(nullptr)
+    , m_reader(nullptr)
+    , m_ffmpegBinary(QStringLiteral("ffmpeg"))
+    , m_sink(QStringLiteral("default"))
+    , m_sampleRate(44100)
+    , m_channels(2)
+    , m_bufferDuration(5.0)
+    , m_fanout(nullptr)
+    , m_bytesCaptured(0)
+{
+}
+
+PcmCapture::~PcmCapture()
+{
+    // the reader thread must not outlive the ring buffer
+    stopPulseReader();
+}
+
+/*!
+ * \brief Returns whether the specified \a backend has been enabled at build time.
+ */
+bool PcmCapture::isBackendAvailable(CaptureBackend backend)
+{
+    switch (backend) {
+    case CaptureBackend::PulseAudio:
+#ifdef DBUS_SOUNDRECORDER_USE_LIBPULSE
+        return true;
+#else
+        return false;
+#endif
+    default:
+        return true;
+    }
+}
+
+/*!
+ * \brief Returns the arguments to pass to ffmpeg for reading the captured PCM data from stdin.
+ */
+QStringList PcmCapture::formatArgs() const
+{
+    return QStringList({ QStringLiteral("-f"), QStringLiteral("s16le"), QStringLiteral("-ar"), QString::number(m_sampleRate), QStringLiteral("-ac"),
+        QString::number(m_channels) });
+}
+
+/*!
+ * \brief Returns whether the sink is currently being captured.
+ * \remarks Returns false if a capturing process has been stopped but not reaped yet.
+ */
+bool PcmCapture::isRunning() const
+{
+    return m_process || m_reader;
+}
+
+/*!
+ * \brief Returns the (frame-aligned) offset within the captured stream which corresponds to the specified \a time.
+ * \remarks The mapping is relative to the most recently read data (which is assumed to be captured at the time it has
+ *          been read) so it stays accurate even if the sink's clock drifts against the system clock over a long session.
+ */
+qint64 PcmCapture::offsetAt(Clock::time_point time) const
+{
+    const auto delta = chrono::duration_cast<chrono::microseconds>(time - m_lastReadTime).count();
+    auto offset = bytesCaptured() + delta * byteRate() / 1000000;
+    offset -= offset % frameSize();
+    return max<qint64>(offset, 0);
+}
+
+void PcmCapture::start()
+{
+    if (isRunning()) {
+        return;
+    }
+    // allocate the ring buffer upfront so reading captured data never allocates; keep at least one second
+    // note: when fanning out, the ring buffer is placed in shared memory so readers access the captured data directly
+    const auto bufferSize = static_cast<std::size_t>(static_cast<qint64>(max(m_bufferDuration, 1.0) * m_sampleRate) * frameSize());
+    m_buffer.reset(bufferSize, m_fanout ? m_fanout->ringStorage(bufferSize, m_sampleRate, m_channels) : nullptr);
+    if (m_fanout) {
+        m_fanout->restart();
+    }
+    m_bytesCaptured = 0;
+    m_lastReadTime = Clock::now();
+    if (m_backend == CaptureBackend::PulseAudio) {
+        startPulseReader();
+        return;
+    }
+    QStringList args;
+    args << QStringLiteral("-nostdin");
+    args << QStringLiteral("-f");
+    args << QStringLiteral("pulse");
+    args << m_inputOptions;
+    args << QStringLiteral("-i");
+    args << m_sink;
+    args << formatArgs();
+    args << QStringLiteral("-");
+    m_process = new FfmpegProcess(this);
+    connect(m_process, &QProcess::readyReadStandardOutput, this, &PcmCapture::readPcm);
+    connect(m_process,
+#if QT_VERSION < QT_VERSION_CHECK(5, 6, 0) || (QT_DEPRECATED_SINCE(5, 6) && QT_VERSION < QT_VERSION_CHECK(6, 0, 0))
+        static_cast<void (QProcess::*)(QProcess::ProcessError)>(
+#endif
+            &QProcess::error
+#if QT_VERSION < QT_VERSION_CHECK(5, 6, 0) || (QT_DEPRECATED_SINCE(5, 6) && QT_VERSION < QT_VERSION_CHECK(6, 0, 0))
+            )
+#endif
+            ,
+        this, &PcmCapture::processError);
+    connect(m_process, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished), this, &PcmCapture::processFinished);
+    m_process->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    m_process->setProgram(m_ffmpegBinary);
+    m_process->setArguments(args);
+    m_process->start();
+    cerr << "Started capturing sink \"" << m_sink << "\" continuously" << endl;
+}
+
+/*!
+ * \brief Stops capturing.
+ * \remarks Returns immediately; the capturing process is detached and reaped in the background so capturing can be
+ *          started again right away.
+ */
+void PcmCapture::stop()
+{
+    stopPulseReader();
+    if (!m_process) {
+        return;
+    }
+    m_process->disconnect(this);
+    connect(m_process, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished), m_process, &QObject::deleteLater);
+    if (m_process->state() == QProcess::NotRunning) {
+        m_process->deleteLater();
+    } else {
+        m_process->stop();
+    }
+    m_process = nullptr;
+}
+
+void PcmCapture::readPcm()
+{
+    if (!m_process) {
+        return;
+    }
+    // read directly into the ring buffer and announce each chunk right away so consumers see it before it is overwritten
+    for (qint64 available; (available = m_process->bytesAvailable()) > 0;) {
+        const auto region = m_buffer.writeRegion(static_cast<std::size_t>(available));
+        const auto size = m_process->read(region.data, static_cast<qint64>(region.size));
+        if (size <= 0) {
+            m_buffer.commit(0);
+            break;
+        }
+        const auto offset = bytesCaptured();
+        m_buffer.commit(static_cast<std::size_t>(size));
+        announce(offset, size, Clock::now());
+    }
+}
+
+/*!
+ * \brief Announces that the specified range has been captured at \a readTime.
+ */
+void PcmCapture::announce(qint64 offset, qint64 size, Clock::time_point readTime)
+{
+    m_bytesCaptured = offset + size;
+    m_lastReadTime = readTime;
+    Metrics::instance().increment(Metrics::Counter::BytesCaptured, static_cast<std::uint64_t>(size));
+    if (m_fanout) {
+        m_fanout->notify();
+    }
+    emit pcmAvailable(offset, size);
+}
+
+/*!
+ * \brief Starts reading the sink via libpulse on a dedicated thread.
+ */
+void PcmCapture::startPulseReader()
+{
+#ifdef DBUS_SOUNDRECORDER_USE_LIBPULSE
+    m_reader = new PulseReader(m_buffer, m_sink, m_sampleRate, m_channels, this);
+    connect(m_reader, &PulseReader::pcmRead, this, &PcmCapture::pulseRead);
+    connect(m_reader, &PulseReader::failed, this, &PcmCapture::pulseFailed);
+    m_reader->start(QThread::HighestPriority);
+    cerr << "Started capturing sink \"" << m_sink << "\" continuously via libpulse" << endl;
+#else
+    cerr << "Error: Unable to capture sink \"" << m_sink << "\" via libpulse: not built with libpulse" << endl;
+#endif
+}
+
+/*!
+ * \brief Stops the reader thread (if any).
+ * \remarks The reader finishes after the chunk which is currently read so waiting for it does not block for long.
+ */
+void PcmCapture::stopPulseReader()
+{
+#ifdef DBUS_SOUNDRECORDER_USE_LIBPULSE
+    if (!m_reader) {
+        return;
+    }
+    m_reader->requestStop();
+    m_reader->wait();
+    delete m_reader;
+    m_reader = nullptr;
+#endif
+}
+
+void PcmCapture::pulseRead(qint64 offset, qint64 size, qint64 readTime)
+{
+    // ignore chunks which have been read before the reader has been stopped
+    if (!m_reader || sender() != m_reader) {
+        return;
+    }
+    announce(offset, size, Clock::time_point(Clock::duration(readTime)));
+}
+
+void PcmCapture::pulseFailed(const QString &message)
+{
+    cerr << "Failed to capture sink \"" << m_sink << "\" via libpulse: " << message << endl;
+    Metrics::instance().increment(Metrics::Counter::FfmpegFailures);
+    stop();
+    emit stopped();
+}
+
+void PcmCapture::processError()
+{
+    cerr << "Failed to capture sink \"" << m_sink << "\": " << m_process->errorString() << endl;
+    if (m_process->state() == QProcess::NotRunning) {
+        Metrics::instance().increment(Metrics::Counter::FfmpegFailures);
+        m_process->deleteLater();
+        m_process = nullptr;
+        emit stopped();
+    }
+}
+
+void PcmCapture::processFinished(int exitCode)
+{
+    // pass remaining data
+    readPcm();
+    cerr << "Capturing finished unexpectedly with exit code " << exitCode << endl;
+    Metrics::instance().increment(Metrics::Counter::FfmpegFailures);
+    m_process->deleteLater();
+    m_process = nullptr;
+    emit stopped();
+}
+} // namespace DBusSoundRecorder
@@ -0,0 +1,201 @@
+#ifndef PCMCAPTURE_H
+#define PCMCAPTURE_H
+
+#include "pcmringbuffer.h"
+
+#include <QObject>
+#include <QStringList>
+
+#include <chrono>
+
+namespace DBusSoundRecorder {
+
+class FfmpegProcess;
+class PcmFanout;
+class PulseReader;
+
+/*!
+ * \brief The CaptureBackend enum specifies how the sink is captured continuously.
+ */
+enum class CaptureBackend {
+    FFmpeg, /**< an ffmpeg process is spawned */
+    PulseAudio, /**< the source is read via libpulse within the process (see PulseReader) */
+};
+
+/*!
+ * \brief The PcmCapture class captures a Pulse Audio sink continuously as raw PCM (signed 16-bit little endian, interleaved).
+ *
+ * A single long-lived ffmpeg process (or a PulseReader thread) is used for the whole session. The captured data is read directly into a fixed-size
+ * ring buffer which keeps the last few seconds of audio. The pcmAvailable() signal announces new data by its offset within
+ * the stream so consumers can cut the stream into segments at arbitrary positions, even slightly in the past.
+ */
+class PcmCapture : public QObject {
+    Q_OBJECT
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit PcmCapture(QObject *parent = nullptr);
+    ~PcmCapture() override;
+
+    static bool isBackendAvailable(CaptureBackend backend);
+    CaptureBackend backend() const;
+    void setBackend(CaptureBackend backend);
+
+    void setFFmpegBinary(const QString &path);
+    void setInputOptions(const QStringList &options);
+    void setSink(const QString &sinkName);
+    unsigned int sampleRate() const;
+    void setSampleRate(unsigned int sampleRate);
+    unsigned int channels() const;
+    void setChannels(unsigned int channels);
+    qint64 frameSize() const;
+    qint64 byteRate() const;
+    QStringList formatArgs() const;
+    double bufferDuration() const;
+    void setBufferDuration(double seconds);
+    const PcmRingBuffer &buffer() const;
+    PcmFanout *fanout() const;
+    void setFanout(PcmFanout *fanout);
+
+    bool isRunning() const;
+    qint64 bytesCaptured() const;
+    qint64 offsetAt(Clock::time_point time) const;
+
+public Q_SLOTS:
+    void start();
+    void stop();
+
+Q_SIGNALS:
+    void pcmAvailable(qint64 offset, qint64 size);
+    void stopped();
+
+private Q_SLOTS:
+    void readPcm();
+    void processError();
+    void processFinished(int exitCode);
+    void pulseRead(qint64 offset, qint64 size, qint64 readTime);
+    void pulseFailed(const QString &message);
+
+private:
+    void startPulseReader();
+    void stopPulseReader();
+    void announce(qint64 offset, qint64 size, Clock::time_point readTime);
+
+    CaptureBackend m_backend;
+    FfmpegProcess *m_process;
+    PulseReader *m_reader;
+    QString m_ffmpegBinary;
+    QStringList m_inputOptions;
+    QString m_sink;
+    unsigned int m_sampleRate;
+    unsigned int m_channels;
+    double m_bufferDuration;
+    PcmRingBuffer m_buffer;
+    PcmFanout *m_fanout;
+    qint64 m_bytesCaptured;
+    Clock::time_point m_lastReadTime;
+};
+
+inline CaptureBackend PcmCapture::backend() const
+{
+    return m_backend;
+}
+
+/*!
+ * \brief Sets the backend used for capturing.
+ * \remarks Takes effect when capturing is started the next time. The backend must be available (see isBackendAvailable()).
+ */
+inline void PcmCapture::setBackend(CaptureBackend backend)
+{
+    m_backend = backend;
+}
+
+inline void PcmCapture::setFFmpegBinary(const QString &path)
+{
+    m_ffmpegBinary = path;
+}
+
+inline void PcmCapture::setInputOptions(const QStringList &options)
+{
+    m_inputOptions = options;
+}
+
+inline void PcmCapture::setSink(const QString &sinkName)
+{
+    m_sink = sinkName;
+}
+
+inline unsigned int PcmCapture::sampleRate() const
+{
+    return m_sampleRate;
+}
+
+inline void PcmCapture::setSampleRate(unsigned int sampleRate)
+{
+    m_sampleRate = sampleRate;
+}
+
+inline unsigned int PcmCapture::channels() const
+{
+    return m_channels;
+}
+
+inline void PcmCapture::setChannels(unsigned int channels)
+{
+    m_channels = channels;
+}
+
+inline qint64 PcmCapture::frameSize() const
+{
+    return static_cast<qint64>(m_channels) * 2;
+}
+
+inline qint64 PcmCapture::byteRate() const
+{
+    return frameSize() * m_sampleRate;
+}
+
+inline double PcmCapture::bufferDuration() const
+{
+    return m_bufferDuration;
+}
+
+/*!
+ * \brief Sets the duration of audio kept in the ring buffer.
+ * \remarks Takes effect when capturing is started the next time.
+ */
+inline void PcmCapture::setBufferDuration(double seconds)
+{
+    m_bufferDuration = seconds;
+}
+
+inline const PcmRingBuffer &PcmCapture::buffer() const
+{
+    return m_buffer;
+}
+
+inline PcmFanout *PcmCapture::fanout() const
+{
+    return m_fanout;
+}
+
+/*!
+ * \brief Sets the \a fanout the ring buffer is shared with so local readers can access the captured data directly.
+ * \remarks Takes effect when capturing is started the next time. The fanout must outlive capturing; it is not owned.
+ */
+inline void PcmCapture::setFanout(PcmFanout *fanout)
+{
+    m_fanout = fanout;
+}
+
+/*!
+ * \brief Returns the number of bytes announced via pcmAvailable() so far.
+ * \remarks The ring buffer might already contain more data if it is written by a PulseReader on another thread.
+ */
+inline qint64 PcmCapture::bytesCaptured() const
+{
+    return m_bytesCaptured;
+}
+} // namespace DBusSoundRecorder
+
+#endif // PCMCAPTURE_H
@@ -0,0 +1,310 @@
+#include "pcmfanout.h"
+
+#include <QEvent>
+#include <QFile>
+#include <QSocketNotifier>
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <new>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace DBusSoundRecorder {
+
+inline ostream &operator<<(ostream &stream, const QString &str)
+{
+    return stream << str.toLocal8Bit().data();
+}
+
+/// \brief The magic at the beginning of the shared memory which is also sent along with the file descriptor.
+constexpr char fanoutMagic[8] = { 'D', 'B', 'S', 'R', 'P', 'C', 'M', '\0' };
+/// \brief The alignment of the ring buffer within the shared memory.
+constexpr std::size_t pageSize = 4096;
+
+PcmFanout::PcmFanout(QObject *parent)
+    : QObject(parent)
+    , m_serverFd(-1)
+    , m_serverNotifier(nullptr)
+    , m_readOnlyFd(-1)
+    , m_memorySize(0)
+    , m_header(nullptr)
+{
+}
+
+/*!
+ * \brief Disconnects all readers and removes the socket.
+ * \remarks The shared memory is marked as closed; readers which have mapped it keep it until they unmap it.
+ */
+PcmFanout::~PcmFanout()
+{
+    for (const auto fd : m_readers.keys()) {
+        closeReader(fd);
+    }
+    if (m_serverFd >= 0) {
+        delete m_serverNotifier;
+        ::close(m_serverFd);
+        ::unlink(QFile::encodeName(m_socketPath).data());
+    }
+    releaseMemory();
+}
+
+/*!
+ * \brief Listens for readers on the Unix domain socket at the specified \a socketPath.
+ * \remarks A stale socket at \a socketPath is replaced. The socket is only accessible by the current user.
+ * \returns Returns whether the socket could be created; otherwise an error is logged.
+ */
+bool PcmFanout::listen(const QString &socketPath)
+{
+    const auto encodedPath = QFile::encodeName(socketPath);
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (static_cast<std::size_t>(encodedPath.size()) >= sizeof(address.sun_path)) {
+        cerr << "Error: Fan-out socket path is too long: " << socketPath << endl;
+        return false;
+    }
+    std::memcpy(address.sun_path, encodedPath.data(), static_cast<std::size_t>(encodedPath.size()));
+    const auto fd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        cerr << "Error: Unable to create fan-out socket: " << strerror(errno) << endl;
+        return false;
+    }
+    ::unlink(encodedPath.data());
+    if (::bind(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) || ::chmod(encodedPath.data(), S_IRUSR | S_IWUSR)
+        || ::listen(fd, SOMAXCONN)) {
+        cerr << "Error: Unable to listen on fan-out socket " << socketPath << ": " << strerror(errno) << endl;
+        ::close(fd);
+        return false;
+    }
+    m_socketPath = socketPath;
+    m_serverFd = fd;
+    m_serverNotifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+    m_serverNotifier->installEventFilter(this);
+    return true;
+}
+
+/*!
+ * \brief Returns the storage for a PcmRingBuffer with the specified \a capacity within the shared memory.
+ * \remarks
+ * - Called whenever capturing is (re)started. The memory is only recreated (and sent to the readers again) if the
+ *   capacity or format changed. Call restart() after the ring buffer has been reset.
+ * - Returns nullptr if the memory can not be created; the capture uses a private buffer then.
+ */
+char *PcmFanout::ringStorage(std::size_t capacity, unsigned int sampleRate, unsigned int channels)
+{
+    if (!m_header || m_header->capacity != capacity || m_header->sampleRate != sampleRate || m_header->channels != channels) {
+        releaseMemory();
+        if (!createMemory(capacity, sampleRate, channels)) {
+            return nullptr;
+        }
+        for (const auto fd : m_readers.keys()) {
+            if (!sendMemory(fd)) {
+                closeReader(fd);
+            }
+        }
+    }
+    return reinterpret_cast<char *>(m_header) + m_header->dataOffset;
+}
+
+/*!
+ * \brief Announces that the stream restarts at offset zero because capturing has been (re)started.
+ * \remarks Increments the generation and discards the markers of the previous stream.
+ */
+void PcmFanout::restart()
+{
+    if (!m_header) {
+        return;
+    }
+    m_header->markerCount.store(0, memory_order_relaxed);
+    m_header->generation.fetch_add(1, memory_order_release);
+    notify();
+}
+
+/*!
+ * \brief Wakes readers waiting for data; to be called after data has been committed to the ring buffer.
+ * \remarks Does not do any syscall if no readers are connected.
+ */
+void PcmFanout::notify()
+{
+    if (!m_header) {
+        return;
+    }
+    m_header->sequence.fetch_add(1, memory_order_release);
+    if (!m_readers.isEmpty()) {
+        ::syscall(SYS_futex, &m_header->sequence, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    }
+}
+
+/*!
+ * \brief Announces that the track described by \a fields starts at the specified stream \a offset.
+ * \remarks Fields with empty values are omitted. Line breaks within values are replaced by spaces.
+ */
+void PcmFanout::addMarker(std::uint64_t offset, const Fields &fields, std::uint32_t flags)
+{
+    if (!m_header) {
+        return;
+    }
+    QByteArray text;
+    for (auto i = fields.cbegin(), end = fields.cend(); i != end; ++i) {
+        if (!i.value().isEmpty()) {
+            auto value = i.value();
+            text += i.key().toUtf8() + '=' + value.replace(QChar('\n'), QChar(' ')).toUtf8() + '\n';
+        }
+    }
+    const auto count = m_header->markerCount.load(memory_order_relaxed);
+    auto &marker = m_header->markers[count % PcmFanoutHeader::markerSlots];
+    const auto sequence = marker.sequence.load(memory_order_relaxed);
+    marker.sequence.store(sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    marker.flags = flags;
+    marker.offset = offset;
+    marker.textSize = static_cast<std::uint32_t>(min<std::size_t>(static_cast<std::size_t>(text.size()), PcmFanoutMarker::textCapacity));
+    std::memcpy(marker.text, text.data(), marker.textSize);
+    marker.sequence.store(sequence + 2, memory_order_release);
+    m_header->markerCount.store(count + 1, memory_order_release);
+    notify();
+}
+
+bool PcmFanout::eventFilter(QObject *object, QEvent *event)
+{
+    if (event->type() != QEvent::SockAct) {
+        return false;
+    }
+    if (object == m_serverNotifier) {
+        acceptReaders();
+    } else if (const auto *const notifier = qobject_cast<QSocketNotifier *>(object)) {
+        // readers are not supposed to send anything, so any activity means the reader is gone
+        const auto fd = static_cast<int>(notifier->socket());
+        char buffer[64];
+        const auto received = ::recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (!received || (received < 0 && errno != EAGAIN && errno != EINTR)) {
+            closeReader(fd);
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * \brief Accepts pending readers and sends them the file descriptor of the shared memory (if created yet).
+ */
+void PcmFanout::acceptReaders()
+{
+    for (int fd; (fd = ::accept4(m_serverFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0;) {
+        if (m_header && !sendMemory(fd)) {
+            ::close(fd);
+            continue;
+        }
+        auto *const notifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+        notifier->installEventFilter(this);
+        m_readers[fd] = notifier;
+        cerr << "PCM reader attached to " << m_socketPath << " (" << m_readers.size() << " readers)" << endl;
+    }
+}
+
+/*!
+ * \brief Creates the shared memory for a ring buffer with the specified \a capacity and initializes its header.
+ */
+bool PcmFanout::createMemory(std::size_t capacity, unsigned int sampleRate, unsigned int channels)
+{
+    const auto dataOffset = (sizeof(PcmFanoutHeader) + pageSize - 1) / pageSize * pageSize;
+    const auto size = dataOffset + PcmRingBuffer::storageSize(capacity);
+    const auto fd = ::memfd_create("dbus-soundrecorder-pcm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        cerr << "Error: Unable to create shared memory for PCM fan-out: " << strerror(errno) << endl;
+        return false;
+    }
+    // don't let readers shrink the memory under the capture's feet
+    void *memory = MAP_FAILED;
+    if (!::ftruncate(fd, static_cast<off_t>(size)) && !::fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)) {
+        memory = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    // readers get a read-only file descriptor of the same memory
+    const auto readOnlyFd = memory != MAP_FAILED ? ::open(QByteArray("/proc/self/fd/" + QByteArray::number(fd)).data(), O_RDONLY | O_CLOEXEC) : -1;
+    ::close(fd);
+    if (readOnlyFd < 0) {
+        cerr << "Error: Unable to map shared memory for PCM fan-out: " << strerror(errno) << endl;
+        if (memory != MAP_FAILED) {
+            ::munmap(memory, size);
+        }
+        return false;
+    }
+    // the memory is zero-initialized so only the constant fields need to be set
+    m_header = new (memory) PcmFanoutHeader;
+    std::memcpy(m_header->magic, fanoutMagic, sizeof(fanoutMagic));
+    m_header->version = 1;
+    m_header->sampleRate = sampleRate;
+    m_header->channels = channels;
+    m_header->dataOffset = dataOffset;
+    m_header->capacity = capacity;
+    m_readOnlyFd = readOnlyFd;
+    m_memorySize = size;
+    return true;
+}
+
+/*!
+ * \brief Marks the shared memory as closed, wakes readers and unmaps it.
+ */
+void PcmFanout::releaseMemory()
+{
+    if (!m_header) {
+        return;
+    }
+    m_header->closed.store(1, memory_order_release);
+    notify();
+    ::munmap(m_header, m_memorySize);
+    ::close(m_readOnlyFd);
+    m_header = nullptr;
+    m_readOnlyFd = -1;
+    m_memorySize = 0;
+}
+
+/*!
+ * \brief Sends the file descriptor of the shared memory to the reader connected via \a readerFd.
+ * \remarks Never blocks; a reader which does not take the message in time is considered gone.
+ */
+bool PcmFanout::sendMemory(int readerFd)
+{
+    char payload[sizeof(fanoutMagic)];
+    std::memcpy(payload, fanoutMagic, sizeof(payload));
+    iovec vector = { payload, sizeof(payload) };
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr message = {};
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    auto *const controlMessage = CMSG_FIRSTHDR(&message);
+    controlMessage->cmsg_level = SOL_SOCKET;
+    controlMessage->cmsg_type = SCM_RIGHTS;
+    controlMessage->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(controlMessage), &m_readOnlyFd, sizeof(int));
+    return ::sendmsg(readerFd, &message, MSG_DONTWAIT | MSG_NOSIGNAL) == static_cast<ssize_t>(sizeof(payload));
+}
+
+/*!
+ * \brief Disconnects the reader connected via \a fd.
+ */
+void PcmFanout::closeReader(int fd)
+{
+    auto *const notifier = m_readers.take(fd);
+    if (!notifier) {
+        return;
+    }
+    notifier->setEnabled(false);
+    notifier->deleteLater();
+    ::close(fd);
+    cerr << "PCM reader detached from " << m_socketPath << " (" << m_readers.size() << " readers)" << endl;
+}
+} // namespace DBusSoundRecorder
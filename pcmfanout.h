@@ -0,0 +1,129 @@
+#ifndef PCMFANOUT_H
+#define PCMFANOUT_H
+
+#include "pcmringbuffer.h"
+
+#include <QMap>
+#include <QObject>
+#include <QString>
+
+#include <atomic>
+#include <cstdint>
+
+QT_FORWARD_DECLARE_CLASS(QSocketNotifier)
+QT_FORWARD_DECLARE_CLASS(QEvent)
+
+namespace DBusSoundRecorder {
+
+/*!
+ * \brief The PcmFanoutMarker struct is a slot within the shared memory announcing the start of a track.
+ *
+ * The slot is written like a seqlock: the sequence is odd while the slot is being written. Readers copy the slot and
+ * discard the copy if the sequence was odd or changed in the meantime.
+ */
+struct PcmFanoutMarker {
+    enum Flags : std::uint32_t {
+        Ad = 0x1, /**< the track is an ad (it is not recorded) */
+        NotPlaying = 0x2, /**< the player is not playing (anymore) */
+    };
+
+    /// \brief The maximum size of the meta data in bytes; longer meta data is truncated.
+    static constexpr std::size_t textCapacity = 1000;
+
+    std::atomic<std::uint32_t> sequence;
+    std::uint32_t flags;
+    std::uint64_t offset; /**< the stream offset the track starts at */
+    std::uint32_t textSize;
+    std::uint32_t reserved;
+    char text[textCapacity]; /**< the meta data as UTF-8 encoded lines of the form "key=value" */
+};
+
+/*!
+ * \brief The PcmFanoutHeader struct is located at the beginning of the shared memory.
+ *
+ * The PCM data is stored in a PcmRingBuffer (including its header) located at dataOffset. The stream offsets used by
+ * the ring buffer and the markers are the same. Whenever data or a marker has been published, the sequence is
+ * incremented and waiters are woken via futex (FUTEX_WAIT on the sequence, the memory is mapped shared).
+ */
+struct PcmFanoutHeader {
+    /// \brief The number of marker slots; the marker with index i is stored in slot i modulo this number.
+    static constexpr std::size_t markerSlots = 64;
+
+    char magic[8]; /**< "DBSRPCM" followed by a null byte */
+    std::uint32_t version; /**< the version of the layout (currently 1) */
+    std::uint32_t sampleRate;
+    std::uint32_t channels; /**< the number of interleaved channels of signed 16-bit little endian samples */
+    std::uint32_t reserved;
+    std::uint64_t dataOffset; /**< the offset of the ring buffer within the shared memory */
+    std::uint64_t capacity; /**< the capacity of the ring buffer in bytes */
+    std::atomic<std::uint32_t> sequence; /**< the futex word incremented when data or a marker has been published */
+    std::atomic<std::uint32_t> generation; /**< incremented when capturing has been restarted (the stream restarts at 0) */
+    std::atomic<std::uint32_t> closed; /**< set when the memory is not written anymore; readers take the next fd */
+    std::uint32_t reserved2;
+    std::atomic<std::uint64_t> markerCount; /**< the number of markers published so far */
+    PcmFanoutMarker markers[markerSlots];
+};
+
+/*!
+ * \brief The PcmFanout class publishes the continuously captured PCM stream to local readers via shared memory.
+ *
+ * The ring buffer of the capture (see PcmCapture::setFanout()) is placed in a memfd, so captured data is written only
+ * once and all readers map the very same memory; there is no copy per reader. The layout is described by
+ * PcmFanoutHeader. The start of each track is announced via a PcmFanoutMarker carrying the meta data of the track.
+ *
+ * Readers attach by connecting to a Unix domain socket (SOCK_SEQPACKET). They receive a read-only file descriptor of
+ * the memory via SCM_RIGHTS and get a new one whenever the memory is recreated. Readers are never waited for: a reader
+ * which falls behind by more than the capacity of the ring buffer loses data (detected like within the process via
+ * the counters of the ring buffer). Waking readers costs one futex syscall per chunk while readers are connected.
+ */
+class PcmFanout : public QObject {
+    Q_OBJECT
+public:
+    using Fields = QMap<QString, QString>;
+
+    explicit PcmFanout(QObject *parent = nullptr);
+    ~PcmFanout() override;
+
+    bool listen(const QString &socketPath);
+    const QString &socketPath() const;
+    int readerCount() const;
+
+    char *ringStorage(std::size_t capacity, unsigned int sampleRate, unsigned int channels);
+    void restart();
+    void notify();
+    void addMarker(std::uint64_t offset, const Fields &fields, std::uint32_t flags = 0);
+
+protected:
+    bool eventFilter(QObject *object, QEvent *event) override;
+
+private:
+    void acceptReaders();
+    bool createMemory(std::size_t capacity, unsigned int sampleRate, unsigned int channels);
+    void releaseMemory();
+    bool sendMemory(int readerFd);
+    void closeReader(int fd);
+
+    QString m_socketPath;
+    int m_serverFd;
+    QSocketNotifier *m_serverNotifier;
+    QMap<int, QSocketNotifier *> m_readers;
+    int m_readOnlyFd;
+    std::size_t m_memorySize;
+    PcmFanoutHeader *m_header;
+};
+
+inline const QString &PcmFanout::socketPath() const
+{
+    return m_socketPath;
+}
+
+/*!
+ * \brief Returns the number of readers which are currently attached.
+ */
+inline int PcmFanout::readerCount() const
+{
+    return m_readers.size();
+}
+} // namespace DBusSoundRecorder
+
+#endif // PCMFANOUT_H
@@ -0,0 +1,220 @@
+#ifndef PCMRINGBUFFER_H
+#define PCMRINGBUFFER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+
+namespace DBusSoundRecorder {
+
+/*!
+ * \brief The PcmRingBuffer class is a fixed-size single-producer ring buffer keeping the most recently captured PCM data.
+ *
+ * Data is addressed by its absolute offset within the captured stream. The producer never blocks and never allocates;
+ * it simply overwrites the oldest data. Readers can access any data which is still buffered, e.g. to seed a new
+ * recording with audio captured before the track change has been noticed.
+ *
+ * The buffer is lock-free and works like a seqlock: the producer announces the range it is about to overwrite before
+ * writing and publishes the amount of written data afterwards; readers validate after copying that the data has not
+ * been (partially) overwritten in the meantime.
+ *
+ * The counters are kept in a Header at the beginning of the storage, followed by the data. So the storage can be
+ * provided externally (e.g. shared memory, see PcmFanout) and be read by other processes using the same protocol.
+ */
+class PcmRingBuffer {
+public:
+    struct Region {
+        char *data;
+        std::size_t size;
+    };
+    struct Header {
+        std::atomic<std::uint64_t> written;
+        std::atomic<std::uint64_t> reserved;
+    };
+    /// \brief The size of the header preceding the data within the storage (keeps the data cache-line aligned).
+    static constexpr std::size_t headerSize = 64;
+
+    explicit PcmRingBuffer(std::size_t capacity = 0);
+
+    static std::size_t storageSize(std::size_t capacity);
+    void reset(std::size_t capacity, char *storage = nullptr);
+    std::size_t capacity() const;
+    std::uint64_t written() const;
+    std::uint64_t oldestOffset() const;
+    bool contains(std::uint64_t offset, std::size_t size) const;
+
+    Region writeRegion(std::size_t maxSize);
+    void commit(std::size_t size);
+    void write(const char *data, std::size_t size);
+
+    bool read(std::uint64_t offset, char *destination, std::size_t size) const;
+    template <typename Visitor> bool visit(std::uint64_t offset, std::size_t size, Visitor &&visitor) const;
+
+private:
+    static_assert(sizeof(Header) <= headerSize, "header exceeds reserved space");
+
+    std::unique_ptr<char[]> m_ownedStorage;
+    std::size_t m_ownedCapacity;
+    Header *m_header;
+    char *m_data;
+    std::size_t m_capacity;
+};
+
+inline PcmRingBuffer::PcmRingBuffer(std::size_t capacity)
+    : m_ownedCapacity(0)
+    , m_header(nullptr)
+    , m_data(nullptr)
+    , m_capacity(0)
+{
+    reset(capacity);
+}
+
+/*!
+ * \brief Returns the number of bytes the storage for a buffer with the specified \a capacity must have.
+ */
+inline std::size_t PcmRingBuffer::storageSize(std::size_t capacity)
+{
+    return headerSize + capacity;
+}
+
+/*!
+ * \brief Discards all data and (re)allocates the buffer for the specified \a capacity.
+ * \remarks
+ * - If \a storage is specified, it is used instead of allocating the buffer. It must be at least storageSize() bytes
+ *   big, suitably aligned and outlive its use by the buffer.
+ * - Must not be called while the buffer is accessed concurrently.
+ */
+inline void PcmRingBuffer::reset(std::size_t capacity, char *storage)
+{
+    if (!storage) {
+        if (!m_ownedStorage || capacity != m_ownedCapacity) {
+            m_ownedStorage = std::make_unique<char[]>(storageSize(capacity));
+            m_ownedCapacity = capacity;
+        }
+        storage = m_ownedStorage.get();
+    } else {
+        m_ownedStorage.reset();
+        m_ownedCapacity = 0;
+    }
+    m_header = new (storage) Header;
+    m_data = storage + headerSize;
+    m_capacity = capacity;
+    m_header->written.store(0, std::memory_order_release);
+    m_header->reserved.store(0, std::memory_order_release);
+}
+
+inline std::size_t PcmRingBuffer::capacity() const
+{
+    return m_capacity;
+}
+
+/*!
+ * \brief Returns the total number of bytes written so far which is also the offset of the next byte to be written.
+ */
+inline std::uint64_t PcmRingBuffer::written() const
+{
+    return m_header->written.load(std::memory_order_acquire);
+}
+
+/*!
+ * \brief Returns the offset of the oldest byte which is still buffered.
+ */
+inline std::uint64_t PcmRingBuffer::oldestOffset() const
+{
+    const auto written = this->written();
+    return written > m_capacity ? written - m_capacity : 0;
+}
+
+/*!
+ * \brief Returns whether the specified range is (still) buffered.
+ */
+inline bool PcmRingBuffer::contains(std::uint64_t offset, std::size_t size) const
+{
+    const auto written = this->written();
+    return offset + size <= written && offset + m_capacity >= written;
+}
+
+/*!
+ * \brief Returns the contiguous region the producer can write to directly (without an intermediate copy).
+ * \remarks The region is at most \a maxSize bytes big and ends at the end of the underlying storage. Call commit()
+ *          after writing to it. Readers treat the whole region as being overwritten until commit() is called.
+ */
+inline PcmRingBuffer::Region PcmRingBuffer::writeRegion(std::size_t maxSize)
+{
+    if (!m_capacity) {
+        return Region{ nullptr, 0 };
+    }
+    const auto written = m_header->written.load(std::memory_order_relaxed);
+    const auto index = static_cast<std::size_t>(written % m_capacity);
+    const auto size = std::min(m_capacity - index, maxSize);
+    m_header->reserved.store(written + size, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    return Region{ m_data + index, size };
+}
+
+/*!
+ * \brief Publishes \a size bytes written to the region returned by writeRegion().
+ */
+inline void PcmRingBuffer::commit(std::size_t size)
+{
+    const auto written = m_header->written.load(std::memory_order_relaxed) + size;
+    m_header->written.store(written, std::memory_order_release);
+    m_header->reserved.store(written, std::memory_order_release);
+}
+
+/*!
+ * \brief Copies the specified \a data into the buffer overwriting the oldest data if necessary.
+ */
+inline void PcmRingBuffer::write(const char *data, std::size_t size)
+{
+    if (!m_capacity) {
+        return;
+    }
+    while (size) {
+        const auto region = writeRegion(size);
+        std::memcpy(region.data, data, region.size);
+        commit(region.size);
+        data += region.size;
+        size -= region.size;
+    }
+}
+
+/*!
+ * \brief Copies \a size bytes starting at the specified stream \a offset to \a destination.
+ * \returns Returns whether the data was still buffered; the contents of \a destination are unspecified otherwise.
+ */
+inline bool PcmRingBuffer::read(std::uint64_t offset, char *destination, std::size_t size) const
+{
+    return visit(offset, size, [&destination](const char *data, std::size_t chunkSize) {
+        std::memcpy(destination, data, chunkSize);
+        destination += chunkSize;
+    });
+}
+
+/*!
+ * \brief Invokes \a visitor with pointer and size of the (at most two) contiguous parts making up the specified range.
+ * \returns Returns whether the data was still buffered after visiting it. If the producer runs on another thread, the
+ *          visitor must not rely on the data before the function returned true.
+ */
+template <typename Visitor> bool PcmRingBuffer::visit(std::uint64_t offset, std::size_t size, Visitor &&visitor) const
+{
+    if (!contains(offset, size)) {
+        return false;
+    }
+    auto index = static_cast<std::size_t>(offset % m_capacity);
+    while (size) {
+        const auto chunkSize = std::min(m_capacity - index, size);
+        visitor(static_cast<const char *>(m_data + index), chunkSize);
+        index = 0;
+        size -= chunkSize;
+    }
+    // check whether the producer (started to) overwrite the data while visiting it
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return offset + m_capacity >= m_header->reserved.load(std::memory_order_relaxed);
+}
+} // namespace DBusSoundRecorder
+
+#endif // PCMRINGBUFFER_H
@@ -0,0 +1,164 @@
+#include "playerdiscovery.h"
+
+#include <QDBusConnection>
+#include <QDBusConnectionInterface>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
+#include <QTimer>
+
+#include <iostream>
+
+using namespace std;
+
+namespace DBusSoundRecorder {
+
+inline ostream &operator<<(ostream &stream, const QString &str)
+{
+    return stream << str.toLocal8Bit().data();
+}
+
+/*!
+ * \brief Returns the prefix of the service names of MPRIS players.
+ */
+inline const QString &mprisServicePrefix()
+{
+    static const auto prefix = QStringLiteral("org.mpris.MediaPlayer2.");
+    return prefix;
+}
+
+PlayerDiscovery::PlayerDiscovery(ProcessPool *encoderPool, const std::shared_ptr<AlbumInfoCache> &albumInfoCache, QObject *parent)
+    : QObject(parent)
+    , m_encoderPool(encoderPool)
+    , m_albumInfoCache(albumInfoCache)
+    , m_reapTimer(new QTimer(this))
+{
+    m_reapTimer->setInterval(1000);
+    connect(m_reapTimer, &QTimer::timeout, this, &PlayerDiscovery::reapDetachedRecorders);
+}
+
+PlayerDiscovery::~PlayerDiscovery()
+{
+}
+
+/*!
+ * \brief Returns whether the specified \a application is a wildcard pattern (rather than the name of a single player).
+ */
+bool PlayerDiscovery::isPattern(const QString &application)
+{
+    return application.contains(QChar('*')) || application.contains(QChar('?')) || application.contains(QChar('['));
+}
+
+/*!
+ * \brief Adds a rule for attaching recorders with the specified \a config.
+ * \remarks The application of \a config is treated as wildcard pattern. Rules added earlier take precedence.
+ */
+void PlayerDiscovery::addRule(const RecorderConfig &config)
+{
+    m_rules << Rule{ QRegularExpression(QRegularExpression::wildcardToRegularExpression(config.application)), config };
+}
+
+/*!
+ * \brief Starts watching the session bus and attaches recorders to all matching players which are already running.
+ */
+void PlayerDiscovery::start()
+{
+    auto *const interface = QDBusConnection::sessionBus().interface();
+    if (!interface) {
+        cerr << "Error: Unable to access the D-Bus interface of the session bus." << endl;
+        return;
+    }
+    if (!connect(interface, &QDBusConnectionInterface::serviceOwnerChanged, this, &PlayerDiscovery::serviceOwnerChanged)) {
+        cerr << "Warning: Unable to connect \"serviceOwnerChanged\" signal of the session bus." << endl;
+    }
+    // names announced via serviceOwnerChanged() before the reply arrives are not attached twice
+    auto *const watcher = new QDBusPendingCallWatcher(interface->asyncCall(QStringLiteral("ListNames")), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, &PlayerDiscovery::namesReceived);
+}
+
+void PlayerDiscovery::serviceOwnerChanged(const QString &service, const QString &oldOwner, const QString &newOwner)
+{
+    Q_UNUSED(oldOwner)
+    if (!service.startsWith(mprisServicePrefix())) {
+        return;
+    }
+    if (newOwner.isEmpty()) {
+        detach(service);
+    } else {
+        attach(service);
+    }
+}
+
+void PlayerDiscovery::namesReceived(QDBusPendingCallWatcher *watcher)
+{
+    watcher->deleteLater();
+    const QDBusPendingReply<QStringList> reply = *watcher;
+    if (reply.isError()) {
+        cerr << "Error: Unable to list the names of the session bus: " << reply.error().message() << endl;
+        return;
+    }
+    for (const auto &service : reply.value()) {
+        if (service.startsWith(mprisServicePrefix())) {
+            attach(service);
+        }
+    }
+}
+
+/*!
+ * \brief Attaches a recorder to the specified MPRIS \a service if a rule matches and none is attached yet.
+ */
+void PlayerDiscovery::attach(const QString &service)
+{
+    if (m_recorders.count(service)) {
+        return;
+    }
+    // re-attach the recorder of a restarted player; its watcher fetches the state from the new owner on its own
+    const auto detached = m_detachedRecorders.find(service);
+    if (detached != m_detachedRecorders.end()) {
+        m_recorders[service] = move(detached->second);
+        m_detachedRecorders.erase(detached);
+        cerr << "Re-attached recorder to MPRIS service \"" << service << '\"' << endl;
+        return;
+    }
+    const auto player = service.mid(mprisServicePrefix().size());
+    for (const auto &rule : m_rules) {
+        if (!rule.pattern.match(player).hasMatch()) {
+            continue;
+        }
+        auto config = rule.config;
+        config.application = player;
+        cerr << "Attaching recorder to MPRIS service \"" << service << "\" (rule [" << rule.config.name << "])" << endl;
+        m_recorders[service] = make_unique<Recorder>(config, m_encoderPool, m_albumInfoCache);
+        return;
+    }
+}
+
+/*!
+ * \brief Detaches the recorder from the specified MPRIS \a service.
+ * \remarks The recorder's watcher notices itself that the service went offline so the current recording is ended
+ *          gracefully. The recorder is only destroyed after it became idle.
+ */
+void PlayerDiscovery::detach(const QString &service)
+{
+    const auto i = m_recorders.find(service);
+    if (i == m_recorders.end()) {
+        return;
+    }
+    cerr << "Detaching recorder from MPRIS service \"" << service << '\"' << endl;
+    m_detachedRecorders[service] = move(i->second);
+    m_recorders.erase(i);
+    m_reapTimer->start();
+}
+
+/*!
+ * \brief Destroys detached recorders which finished recording and encoding.
+ */
+void PlayerDiscovery::reapDetachedRecorders()
+{
+    for (auto i = m_detachedRecorders.begin(); i != m_detachedRecorders.end();) {
+        i = i->second->launcher().isIdle() ? m_detachedRecorders.erase(i) : ++i;
+    }
+    if (m_detachedRecorders.empty()) {
+        m_reapTimer->stop();
+    }
+}
+} // namespace DBusSoundRecorder
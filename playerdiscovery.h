@@ -0,0 +1,75 @@
+#ifndef PLAYERDISCOVERY_H
+#define PLAYERDISCOVERY_H
+
+#include "recorder.h"
+
+#include <QList>
+#include <QObject>
+#include <QRegularExpression>
+
+#include <map>
+#include <memory>
+
+QT_FORWARD_DECLARE_CLASS(QDBusPendingCallWatcher)
+QT_FORWARD_DECLARE_CLASS(QTimer)
+
+namespace DBusSoundRecorder {
+
+/*!
+ * \brief The PlayerDiscovery class watches the session bus for MPRIS services and attaches a Recorder to each of them.
+ *
+ * Players are matched against rules in the order the rules have been added. The application of a rule's config is a
+ * wildcard pattern matched against the part of the service name after "org.mpris.MediaPlayer2." (e.g. "vlc*" matches
+ * "vlc" as well as instance-suffixed names like "vlc.instance1234"). The first matching rule determines the config
+ * (e.g. the sink) of the recorder.
+ *
+ * Recorders are attached as soon as a service appears and detached when it vanishes. A detached recorder is kept until
+ * it finished recording and encoding; if the service comes back in the meantime (e.g. the player has been restarted)
+ * the recorder is re-attached.
+ */
+class PlayerDiscovery : public QObject {
+    Q_OBJECT
+public:
+    explicit PlayerDiscovery(ProcessPool *encoderPool = nullptr,
+        const std::shared_ptr<AlbumInfoCache> &albumInfoCache = std::shared_ptr<AlbumInfoCache>(), QObject *parent = nullptr);
+    ~PlayerDiscovery() override;
+
+    static bool isPattern(const QString &application);
+    void addRule(const RecorderConfig &config);
+    std::size_t attachedPlayers() const;
+
+public Q_SLOTS:
+    void start();
+
+private Q_SLOTS:
+    void serviceOwnerChanged(const QString &service, const QString &oldOwner, const QString &newOwner);
+    void namesReceived(QDBusPendingCallWatcher *watcher);
+    void reapDetachedRecorders();
+
+private:
+    struct Rule {
+        QRegularExpression pattern;
+        RecorderConfig config;
+    };
+
+    void attach(const QString &service);
+    void detach(const QString &service);
+
+    QList<Rule> m_rules;
+    ProcessPool *m_encoderPool;
+    std::shared_ptr<AlbumInfoCache> m_albumInfoCache;
+    std::map<QString, std::unique_ptr<Recorder>> m_recorders;
+    std::map<QString, std::unique_ptr<Recorder>> m_detachedRecorders;
+    QTimer *m_reapTimer;
+};
+
+/*!
+ * \brief Returns the number of players a recorder is currently attached to.
+ */
+inline std::size_t PlayerDiscovery::attachedPlayers() const
+{
+    return m_recorders.size();
+}
+} // namespace DBusSoundRecorder
+
+#endif // PLAYERDISCOVERY_H
@@ -1,10 +1,17 @@
 #include "playerwatcher.h"
+#include "metrics.h"
+#include "trace.h"
 
 #include "playerinterface.h"
 #include "propertiesinterface.h"
 
+#include <QDBusArgument>
 #include <QDBusConnection>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
 #include <QDBusServiceWatcher>
+#include <QDBusVariant>
+#include <QTimer>
 
 #include <iostream>
 
@@ -18,6 +25,27 @@ inline ostream &operator<<(ostream &stream, const QString &str)
     return stream << str.toLocal8Bit().data();
 }
 
+/*!
+ * \brief Returns the player interface name.
+ */
+inline const QString &playerInterfaceName()
+{
+    static const auto name = QStringLiteral("org.mpris.MediaPlayer2.Player");
+    return name;
+}
+
+/*!
+ * \brief Converts the specified \a variant to a QVariantMap.
+ * \remarks Nested maps within a variant (like the "Metadata" property) are not demarshalled automatically.
+ */
+QVariantMap toVariantMap(const QVariant &variant)
+{
+    if (variant.userType() == qMetaTypeId<QDBusArgument>()) {
+        return qdbus_cast<QVariantMap>(variant.value<QDBusArgument>());
+    }
+    return variant.toMap();
+}
+
 PlayerWatcher::PlayerWatcher(const QString &appName, bool ignorePlaybackStatus, QObject *parent)
     : QObject(parent)
     , m_mediaPlayerInterfaceName(QStringLiteral("org.mpris.MediaPlayer2.%1").arg(appName))
@@ -27,13 +55,21 @@ PlayerWatcher::PlayerWatcher(const QString &appName, bool ignorePlaybackStatus,
           m_mediaPlayerInterfaceName, QStringLiteral("/org/mpris/MediaPlayer2"), QDBusConnection::sessionBus(), this))
     , m_playerInterface(new OrgMprisMediaPlayer2PlayerInterface(
           m_mediaPlayerInterfaceName, QStringLiteral("/org/mpris/MediaPlayer2"), QDBusConnection::sessionBus(), this))
+    , m_settleTimer(new QTimer(this))
     , m_isPlaying(false)
     , m_isAd(false)
     , m_trackNumber(0)
     , m_diskNumber(0)
+    , m_position(0)
+    , m_rate(1.0)
+    , m_positionKnown(false)
+    , m_songChangePending(false)
     , m_silent(false)
     , m_ignorePlaybackStatus(ignorePlaybackStatus)
 {
+    m_settleTimer->setSingleShot(true);
+    m_settleTimer->setInterval(100);
+    connect(m_settleTimer, &QTimer::timeout, this, &PlayerWatcher::commitSongChange);
     if (!connect(m_mediaPlayerServiceWatcher, &QDBusServiceWatcher::serviceOwnerChanged, this, &PlayerWatcher::serviceOwnerChanged)) {
         cout << "Warning: Unable to connect \"serviceOwnerChanged\" signal of service watcher." << endl;
     }
@@ -43,10 +79,56 @@ PlayerWatcher::PlayerWatcher(const QString &appName, bool ignorePlaybackStatus,
     //}
     // However, the following seems to work always:
     if (!QDBusConnection::sessionBus().connect(m_mediaPlayerInterfaceName, QStringLiteral("/org/mpris/MediaPlayer2"),
-            QStringLiteral("org.freedesktop.DBus.Properties"), QStringLiteral("PropertiesChanged"), this, SLOT(propertiesChanged()))) {
+            QStringLiteral("org.freedesktop.DBus.Properties"), QStringLiteral("PropertiesChanged"), this,
+            SLOT(propertiesChanged(QString, QVariantMap, QStringList)))) {
         cout << "Warning: Unable to connect \"PropertiesChanged\" signal of properties interface." << endl;
     }
-    propertiesChanged();
+    if (!QDBusConnection::sessionBus().connect(m_mediaPlayerInterfaceName, QStringLiteral("/org/mpris/MediaPlayer2"), playerInterfaceName(),
+            QStringLiteral("Seeked"), this, SLOT(seeked(qlonglong)))) {
+        cout << "Warning: Unable to connect \"Seeked\" signal of player interface." << endl;
+    }
+    fetchProperties();
+}
+
+PlayerWatcher::~PlayerWatcher()
+{
+}
+
+/*!
+ * \brief Records all PropertiesChanged/Seeked events and fetched properties into a trace file at the specified \a path.
+ * \remarks The trace can be replayed via FakePlayer. An empty \a path stops tracing.
+ * \returns Returns whether the trace file could be opened.
+ */
+bool PlayerWatcher::setTraceFile(const QString &path)
+{
+    if (path.isEmpty()) {
+        m_trace.reset();
+        return true;
+    }
+    m_trace = make_unique<TraceWriter>();
+    if (!m_trace->open(path)) {
+        m_trace.reset();
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * \brief Returns the time in milliseconds the meta data must not change before a song change is signaled.
+ */
+int PlayerWatcher::settleTime() const
+{
+    return m_settleTimer->interval();
+}
+
+/*!
+ * \brief Sets the time in milliseconds the meta data must not change before a song change is signaled.
+ * \remarks Bursts of partial meta data updates within that time are coalesced into a single song change. Setting
+ *          a value of zero signals every song change immediately.
+ */
+void PlayerWatcher::setSettleTime(int milliseconds)
+{
+    m_settleTimer->setInterval(milliseconds);
 }
 
 void PlayerWatcher::play()
@@ -76,71 +158,306 @@ void PlayerWatcher::serviceOwnerChanged(const QString &service, const QString &o
     }
     if (newOwner.isEmpty()) {
         cerr << "MPRIS service \"" << service << "\" went offline" << endl;
+        // a player which went away (e.g. crashed) is not playing anymore
+        m_metadata.clear();
+        m_playbackStatus.clear();
+        m_positionKnown = false;
+        updateState();
+    } else {
+        // the cached properties are only updated incrementally so they need to be fetched again from the new owner
+        fetchProperties();
     }
 }
 
-void PlayerWatcher::propertiesChanged()
+/*!
+ * \brief Fetches all properties of the player interface asynchronously.
+ * \remarks This is only required initially. Afterwards the state is updated incrementally from the payload of the
+ *          PropertiesChanged signal.
+ */
+void PlayerWatcher::fetchProperties()
+{
+    auto *const watcher = new QDBusPendingCallWatcher(m_propertiesInterface->GetAll(playerInterfaceName()), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, &PlayerWatcher::propertiesReceived);
+}
+
+/*!
+ * \brief Fetches the specified property of the player interface asynchronously.
+ * \remarks Used for properties which have been invalidated (instead of being passed along with PropertiesChanged).
+ */
+void PlayerWatcher::fetchProperty(const QString &propertyName)
+{
+    auto *const watcher = new QDBusPendingCallWatcher(m_propertiesInterface->Get(playerInterfaceName(), propertyName), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this, propertyName](QDBusPendingCallWatcher *watcher) {
+        watcher->deleteLater();
+        const QDBusPendingReply<QDBusVariant> reply = *watcher;
+        if (reply.isError()) {
+            cerr << "Warning: Unable to get property \"" << propertyName << "\": " << reply.error().message() << endl;
+            return;
+        }
+        if (applyProperties(QVariantMap({ { propertyName, reply.value().variant() } }))) {
+            updateState();
+        }
+    });
+}
+
+void PlayerWatcher::propertiesReceived(QDBusPendingCallWatcher *watcher)
+{
+    watcher->deleteLater();
+    const QDBusPendingReply<QVariantMap> reply = *watcher;
+    if (reply.isError()) {
+        cerr << "Warning: Unable to get properties of \"" << m_mediaPlayerInterfaceName << "\": " << reply.error().message() << endl;
+        return;
+    }
+    if (m_trace) {
+        m_trace->writeProperties(reply.value());
+    }
+    applyProperties(reply.value());
+    updateState();
+}
+
+void PlayerWatcher::propertiesChanged(const QString &interface, const QVariantMap &changedProperties, const QStringList &invalidatedProperties)
+{
+    if (interface != playerInterfaceName()) {
+        return;
+    }
+    if (m_trace) {
+        m_trace->writeChanged(changedProperties, invalidatedProperties);
+    }
+    for (const auto &propertyName : invalidatedProperties) {
+        if (propertyName == QLatin1String("Metadata") || propertyName == QLatin1String("PlaybackStatus")) {
+            fetchProperty(propertyName);
+        }
+    }
+    // ignore changes of properties like volume
+    if (applyProperties(changedProperties)) {
+        updateState();
+    }
+}
+
+/*!
+ * \brief Updates the cached properties from the specified \a properties.
+ * \returns Returns whether a property relevant for determining the state has been updated.
+ */
+bool PlayerWatcher::applyProperties(const QVariantMap &properties)
+{
+    const auto receivedAt = chrono::steady_clock::now();
+    auto relevant = false, positionReceived = false;
+    for (auto i = properties.cbegin(), end = properties.cend(); i != end; ++i) {
+        if (i.key() == QLatin1String("Metadata")) {
+            auto metadata = toVariantMap(i.value());
+            // the position of the previous song is meaningless for the next one; the player does not signal the
+            // position of the next song so it is fetched explicitly
+            if (metadata.value(QStringLiteral("xesam:title")) != m_metadata.value(QStringLiteral("xesam:title"))
+                && !properties.contains(QStringLiteral("Position"))) {
+                m_positionKnown = false;
+                fetchProperty(QStringLiteral("Position"));
+            }
+            m_metadata = move(metadata);
+            relevant = true;
+        } else if (i.key() == QLatin1String("PlaybackStatus")) {
+            // the position only advances while playing so take it over before the status changes
+            setPosition(position(), receivedAt);
+            m_playbackStatus = i.value().toString();
+            relevant = true;
+        } else if (i.key() == QLatin1String("Position")) {
+            setPosition(i.value().toLongLong(), receivedAt);
+            m_positionKnown = true;
+            positionReceived = true;
+        } else if (i.key() == QLatin1String("Rate")) {
+            setPosition(position(), receivedAt);
+            m_rate = i.value().toDouble();
+        }
+    }
+    if (positionReceived) {
+        emit positionChanged(false);
+    }
+    return relevant;
+}
+
+/*!
+ * \brief Returns whether the playback position currently advances.
+ */
+bool PlayerWatcher::isPositionAdvancing() const
+{
+    return isPlaybackActive(m_title);
+}
+
+/*!
+ * \brief Sets the playback \a position (in microseconds) the player has been at the specified \a time.
+ */
+void PlayerWatcher::setPosition(qlonglong position, chrono::steady_clock::time_point time)
+{
+    m_position = position;
+    m_positionTime = time;
+}
+
+/*!
+ * \brief Returns the current playback position within the current song in microseconds.
+ * \remarks The position is extrapolated from the last position reported by the player using the playback rate. If the
+ *          position is not known, the song is assumed to have started at songChangeTime().
+ */
+qlonglong PlayerWatcher::position() const
+{
+    const auto now = chrono::steady_clock::now();
+    if (!m_positionKnown) {
+        return m_songChangeTime == chrono::steady_clock::time_point()
+            ? 0
+            : static_cast<qlonglong>(chrono::duration_cast<chrono::microseconds>(now - m_songChangeTime).count());
+    }
+    if (!isPositionAdvancing()) {
+        return m_position;
+    }
+    return m_position + static_cast<qlonglong>(static_cast<double>(chrono::duration_cast<chrono::microseconds>(now - m_positionTime).count()) * m_rate);
+}
+
+/*!
+ * \brief Returns the time the current song has been (or will be) at the specified \a position (in microseconds).
+ * \remarks Assumes that playback continues at the current rate. If the position is not known, the song is assumed to
+ *          have started at songChangeTime().
+ */
+chrono::steady_clock::time_point PlayerWatcher::timeAtPosition(qlonglong position) const
+{
+    if (!m_positionKnown) {
+        return m_songChangeTime + chrono::microseconds(position);
+    }
+    const auto rate = m_rate > 0.0 ? m_rate : 1.0;
+    return m_positionTime
+        + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double, micro>(static_cast<double>(position - m_position) / rate));
+}
+
+/*!
+ * \brief Returns whether playback is considered active according to the cached properties.
+ */
+bool PlayerWatcher::isPlaybackActive(const QString &title) const
 {
-    // get meta data
-    QVariantMap metadata = m_playerInterface->metadata();
-    m_isAd = metadata.value(QStringLiteral("mpris:trackid")).toString().startsWith(QLatin1String("spotify:ad"));
-    QString title = metadata.value(QStringLiteral("xesam:title")).toString();
-    QString album = metadata.value(QStringLiteral("xesam:album")).toString();
-    QString artist = metadata.value(QStringLiteral("xesam:artist")).toString();
-    bool isPlaying;
     if (m_ignorePlaybackStatus) {
         // determine playback status by checking whether there is a song title
-        isPlaying = !title.isEmpty();
-    } else {
-        isPlaying = !m_playerInterface->playbackStatus().compare(QLatin1String("playing"), Qt::CaseInsensitive);
+        return !title.isEmpty();
     }
-    if (isPlaying) {
-        if (!m_isPlaying) {
+    return !m_playbackStatus.compare(QLatin1String("playing"), Qt::CaseInsensitive);
+}
+
+/*!
+ * \brief Determines the playback status and the current song from the cached properties and emits the corresponding signals.
+ * \remarks A song change is not signaled immediately. Players like Spotify send meta data in several partial updates
+ *          so a song change is only committed after the meta data has not changed for the settle time. The song change
+ *          time is still the time of the first update within such a burst (see songChangeTime()).
+ */
+void PlayerWatcher::updateState()
+{
+    const auto receivedAt = chrono::steady_clock::now();
+    // get meta data
+    const auto &metadata = m_metadata;
+    m_isAd = metadata.value(QStringLiteral("mpris:trackid")).toString().startsWith(QLatin1String("spotify:ad"));
+    const auto title = metadata.value(QStringLiteral("xesam:title")).toString();
+    const auto album = metadata.value(QStringLiteral("xesam:album")).toString();
+    const auto artist = metadata.value(QStringLiteral("xesam:artist")).toString();
+    if (isPlaybackActive(title)) {
+        if (!m_isPlaying && !m_songChangePending) {
             cerr << "Playback started" << endl;
         }
         // use title, album and artist to identify song
         if (m_title != title || m_album != album || m_artist != artist) {
-            // next song playing
-            m_title = title;
-            m_album = album;
-            m_artist = artist;
-            // read additional meta data
-            m_year = metadata.value(QStringLiteral("xesam:contentCreated")).toString();
-            m_genre = metadata.value(QStringLiteral("xesam:genre")).toString();
-            m_trackNumber = metadata.value(QStringLiteral("xesam:tracknumber")).toUInt();
-            if (!m_trackNumber) {
-                m_trackNumber = metadata.value(QStringLiteral("xesam:trackNumber")).toUInt();
+            // next song playing, wait until meta data settled
+            if (m_album != album || m_artist != artist) {
+                // allow preparing for the new album while meta data settles
+                emit albumChanged(artist, album);
+            }
+            if (!m_songChangePending) {
+                m_songChangePending = true;
+                m_songChangeTime = receivedAt;
             }
-            m_diskNumber = metadata.value(QStringLiteral("xesam:discnumber")).toUInt();
-            if (!m_diskNumber) {
-                m_diskNumber = metadata.value(QStringLiteral("xesam:discNumber")).toUInt();
+            if (m_settleTimer->interval() > 0) {
+                m_settleTimer->start();
+            } else {
+                commitSongChange();
             }
-            m_length = TimeSpan(metadata.value(QStringLiteral("mpris:length")).toULongLong() * 10);
-            // notify
-            cerr << "Next song: " << m_title << endl;
+        } else {
+            // a burst might have reverted to the current song
+            m_songChangePending = false;
+            m_settleTimer->stop();
             if (!m_isPlaying && !m_silent) {
                 m_isPlaying = true;
                 emit playbackStarted();
             }
-            if (!m_silent) {
-                m_isPlaying = true;
-                emit nextSong();
+            // take over corrections of the current song's meta data (e.g. a track number sent in a later update)
+            if (readAdditionalMetadata() && m_isPlaying && !m_silent) {
+                cerr << "Meta data of current song updated" << endl;
+                emit metadataUpdated();
             }
-        } else if (!m_isPlaying) {
+        }
+    } else {
+        m_songChangePending = false;
+        m_settleTimer->stop();
+        if (m_isPlaying) {
+            m_isPlaying = false;
+            cerr << "Playback stopped" << endl;
             if (!m_silent) {
-                m_isPlaying = true;
-                emit playbackStarted();
+                emit playbackStopped();
             }
         }
-    } else if (m_isPlaying) {
-        m_isPlaying = false;
-        cerr << "Playback stopped" << endl;
-        if (!m_silent) {
-            emit playbackStopped();
-        }
     }
 }
 
+/*!
+ * \brief Takes over the meta data of the next song and emits nextSong() after the meta data settled.
+ */
+void PlayerWatcher::commitSongChange()
+{
+    if (!m_songChangePending) {
+        return;
+    }
+    m_songChangePending = false;
+    const auto &metadata = m_metadata;
+    m_isAd = metadata.value(QStringLiteral("mpris:trackid")).toString().startsWith(QLatin1String("spotify:ad"));
+    m_title = metadata.value(QStringLiteral("xesam:title")).toString();
+    m_album = metadata.value(QStringLiteral("xesam:album")).toString();
+    m_artist = metadata.value(QStringLiteral("xesam:artist")).toString();
+    readAdditionalMetadata();
+    Metrics::instance().observe(Metrics::Phase::Resolved, m_songChangeTime);
+    // notify
+    cerr << "Next song: " << m_title << endl;
+    if (!m_isPlaying && !m_silent) {
+        m_isPlaying = true;
+        emit playbackStarted();
+    }
+    if (!m_silent) {
+        m_isPlaying = true;
+        emit nextSong();
+    }
+}
+
+/*!
+ * \brief Reads the meta data which does not identify the song from the cached properties.
+ * \returns Returns whether any of it has changed.
+ */
+bool PlayerWatcher::readAdditionalMetadata()
+{
+    const auto &metadata = m_metadata;
+    const auto year = metadata.value(QStringLiteral("xesam:contentCreated")).toString();
+    const auto genre = metadata.value(QStringLiteral("xesam:genre")).toString();
+    const auto artUrl = metadata.value(QStringLiteral("mpris:artUrl")).toString();
+    auto trackNumber = metadata.value(QStringLiteral("xesam:tracknumber")).toUInt();
+    if (!trackNumber) {
+        trackNumber = metadata.value(QStringLiteral("xesam:trackNumber")).toUInt();
+    }
+    auto diskNumber = metadata.value(QStringLiteral("xesam:discnumber")).toUInt();
+    if (!diskNumber) {
+        diskNumber = metadata.value(QStringLiteral("xesam:discNumber")).toUInt();
+    }
+    const auto length = TimeSpan(metadata.value(QStringLiteral("mpris:length")).toULongLong() * 10);
+    if (year == m_year && genre == m_genre && artUrl == m_artUrl && trackNumber == m_trackNumber && diskNumber == m_diskNumber && length == m_length) {
+        return false;
+    }
+    m_year = year;
+    m_genre = genre;
+    m_artUrl = artUrl;
+    m_trackNumber = trackNumber;
+    m_diskNumber = diskNumber;
+    m_length = length;
+    return true;
+}
+
 void PlayerWatcher::notificationReceived()
 {
     cout << "It works!" << endl;
@@ -148,6 +465,12 @@ void PlayerWatcher::notificationReceived()
 
 void PlayerWatcher::seeked(qlonglong pos)
 {
+    if (m_trace) {
+        m_trace->writeSeeked(pos);
+    }
     cerr << "Seeked: " << pos << endl;
+    setPosition(pos, chrono::steady_clock::now());
+    m_positionKnown = true;
+    emit positionChanged(true);
 }
 } // namespace DBusSoundRecorder
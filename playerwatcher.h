@@ -4,18 +4,27 @@
 #include <c++utilities/chrono/timespan.h>
 
 #include <QObject>
+#include <QVariantMap>
+
+#include <chrono>
+#include <memory>
 
 QT_FORWARD_DECLARE_CLASS(QDBusServiceWatcher)
+QT_FORWARD_DECLARE_CLASS(QDBusPendingCallWatcher)
+QT_FORWARD_DECLARE_CLASS(QTimer)
 
 class OrgFreedesktopDBusPropertiesInterface;
 class OrgMprisMediaPlayer2PlayerInterface;
 
 namespace DBusSoundRecorder {
 
+class TraceWriter;
+
 class PlayerWatcher : public QObject {
     Q_OBJECT
 public:
     explicit PlayerWatcher(const QString &appName, bool ignorePlaybackStatus = false, QObject *parent = nullptr);
+    ~PlayerWatcher() override;
 
     void play();
     void stop();
@@ -30,29 +39,56 @@ public:
     const QString &artist() const;
     const QString &year() const;
     const QString &genre() const;
+    const QString &artUrl() const;
     unsigned int trackNumber() const;
     unsigned int diskNumber() const;
     CppUtilities::TimeSpan length() const;
+    std::chrono::steady_clock::time_point songChangeTime() const;
+    bool isSongChangePending() const;
+    bool isPositionKnown() const;
+    double rate() const;
+    qlonglong position() const;
+    std::chrono::steady_clock::time_point timeAtPosition(qlonglong position) const;
     void setSilent(bool silent);
+    int settleTime() const;
+    void setSettleTime(int milliseconds);
+    bool setTraceFile(const QString &path);
 
 Q_SIGNALS:
+    void albumChanged(const QString &artist, const QString &album);
     void nextSong();
     void playbackStarted();
     void playbackStopped();
+    void positionChanged(bool seeked);
+    void metadataUpdated();
 
 private Q_SLOTS:
     void serviceOwnerChanged(const QString &service, const QString &oldOwner, const QString &newOwner);
-    void propertiesChanged();
+    void propertiesChanged(const QString &interface, const QVariantMap &changedProperties, const QStringList &invalidatedProperties);
+    void propertiesReceived(QDBusPendingCallWatcher *watcher);
+    void commitSongChange();
     void notificationReceived();
     void seeked(qlonglong pos);
 
 private:
+    void fetchProperties();
+    void fetchProperty(const QString &propertyName);
+    bool applyProperties(const QVariantMap &properties);
+    bool readAdditionalMetadata();
+    bool isPlaybackActive(const QString &title) const;
+    bool isPositionAdvancing() const;
+    void setPosition(qlonglong position, std::chrono::steady_clock::time_point time);
+    void updateState();
+
     QString m_mediaPlayerInterfaceName;
     QDBusServiceWatcher *m_mediaPlayerServiceWatcher;
     QString m_notifyInterfaceName;
     QDBusServiceWatcher *m_notifyServiceWatcher;
     OrgFreedesktopDBusPropertiesInterface *m_propertiesInterface;
     OrgMprisMediaPlayer2PlayerInterface *m_playerInterface;
+    QVariantMap m_metadata;
+    QString m_playbackStatus;
+    QTimer *m_settleTimer;
     bool m_isPlaying;
     bool m_isAd;
     QString m_title;
@@ -60,11 +96,19 @@ private:
     QString m_artist;
     QString m_year;
     QString m_genre;
+    QString m_artUrl;
     unsigned int m_trackNumber;
     unsigned int m_diskNumber;
     CppUtilities::TimeSpan m_length;
+    std::chrono::steady_clock::time_point m_songChangeTime;
+    qlonglong m_position;
+    std::chrono::steady_clock::time_point m_positionTime;
+    double m_rate;
+    bool m_positionKnown;
+    bool m_songChangePending;
     bool m_silent;
     bool m_ignorePlaybackStatus;
+    std::unique_ptr<TraceWriter> m_trace;
 };
 
 inline bool PlayerWatcher::isPlaying() const
@@ -107,6 +151,14 @@ inline const QString &PlayerWatcher::genre() const
     return m_genre;
 }
 
+/*!
+ * \brief Returns the URL of the cover art of the current song (usually a local "file://" URL).
+ */
+inline const QString &PlayerWatcher::artUrl() const
+{
+    return m_artUrl;
+}
+
 inline unsigned int PlayerWatcher::trackNumber() const
 {
     return m_trackNumber;
@@ -122,6 +174,42 @@ inline CppUtilities::TimeSpan PlayerWatcher::length() const
     return m_length;
 }
 
+/*!
+ * \brief Returns the time when the change to the current song has been noticed.
+ * \remarks If the meta data has been sent in several partial updates, this is the time of the first update and not
+ *          the time the song change has been committed after the settle time.
+ */
+inline std::chrono::steady_clock::time_point PlayerWatcher::songChangeTime() const
+{
+    return m_songChangeTime;
+}
+
+/*!
+ * \brief Returns whether the meta data of the next song is currently settling (see nextSong()).
+ */
+inline bool PlayerWatcher::isSongChangePending() const
+{
+    return m_songChangePending;
+}
+
+/*!
+ * \brief Returns whether the playback position within the current song is known.
+ * \remarks The position is unknown until the player reported it after the song changed. Use songChangeTime() as
+ *          approximation for the start of the song in this case.
+ */
+inline bool PlayerWatcher::isPositionKnown() const
+{
+    return m_positionKnown;
+}
+
+/*!
+ * \brief Returns the playback rate of the player (1.0 means normal speed).
+ */
+inline double PlayerWatcher::rate() const
+{
+    return m_rate;
+}
+
 inline void PlayerWatcher::setSilent(bool silent)
 {
     m_silent = silent;
@@ -0,0 +1,114 @@
+#include "processpool.h"
+#include "ffmpegprocess.h"
+
+#include <QThread>
+
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+namespace DBusSoundRecorder {
+
+inline ostream &operator<<(ostream &stream, const QString &str)
+{
+    return stream << str.toLocal8Bit().data();
+}
+
+/*!
+ * \brief Constructs a new pool which runs as many jobs in parallel as there are cores.
+ */
+ProcessPool::ProcessPool(QObject *parent)
+    : QObject(parent)
+    , m_maxJobs(max(QThread::idealThreadCount(), 1))
+    , m_maxBacklog(64)
+    , m_niceness(10)
+    , m_runningJobs(0)
+{
+}
+
+void ProcessPool::setMaxJobs(int maxJobs)
+{
+    m_maxJobs = max(maxJobs, 1);
+    startJobs();
+}
+
+/*!
+ * \brief Enqueues a job running \a program with \a arguments; \a callback is invoked when the process finished.
+ * \returns Returns whether the job has been enqueued; returns false if the backlog limit has been reached.
+ */
+bool ProcessPool::enqueue(const QString &program, const QStringList &arguments, Callback callback)
+{
+    if (m_queue.size() >= m_maxBacklog) {
+        return false;
+    }
+    auto outputCallback = OutputCallback();
+    if (callback) {
+        outputCallback = [callback = std::move(callback)](int exitCode, QProcess::ExitStatus exitStatus, const QByteArray &) {
+            callback(exitCode, exitStatus);
+        };
+    }
+    m_queue.enqueue(Job{ program, arguments, std::move(outputCallback), false });
+    startJobs();
+    return true;
+}
+
+/*!
+ * \brief Enqueues a job like enqueue() but passes the output of the process (stdout and stderr) to \a callback.
+ * \remarks The output is buffered in memory so this is only meant for processes with little output.
+ */
+bool ProcessPool::enqueueCapturingOutput(const QString &program, const QStringList &arguments, OutputCallback callback)
+{
+    if (m_queue.size() >= m_maxBacklog) {
+        return false;
+    }
+    m_queue.enqueue(Job{ program, arguments, std::move(callback), true });
+    startJobs();
+    return true;
+}
+
+void ProcessPool::startJobs()
+{
+    while (m_runningJobs < m_maxJobs && !m_queue.isEmpty()) {
+        auto job = m_queue.dequeue();
+        auto *const process = new FfmpegProcess(this);
+        auto callback = std::move(job.callback);
+        process->setProcessChannelMode(job.capturingOutput ? QProcess::MergedChannels : QProcess::ForwardedChannels);
+        process->setNiceness(m_niceness);
+        process->setProgram(job.program);
+        process->setArguments(job.arguments);
+        connect(process, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished), this,
+            [this, process, callback](int exitCode, QProcess::ExitStatus exitStatus) {
+                process->deleteLater();
+                --m_runningJobs;
+                if (callback) {
+                    callback(exitCode, exitStatus, process->readAll());
+                }
+                startJobs();
+            });
+        connect(process,
+#if QT_VERSION < QT_VERSION_CHECK(5, 6, 0) || (QT_DEPRECATED_SINCE(5, 6) && QT_VERSION < QT_VERSION_CHECK(6, 0, 0))
+            static_cast<void (QProcess::*)(QProcess::ProcessError)>(
+#endif
+                &QProcess::error
+#if QT_VERSION < QT_VERSION_CHECK(5, 6, 0) || (QT_DEPRECATED_SINCE(5, 6) && QT_VERSION < QT_VERSION_CHECK(6, 0, 0))
+                )
+#endif
+                ,
+            this, [this, process, callback](QProcess::ProcessError error) {
+                if (error != QProcess::FailedToStart) {
+                    return;
+                }
+                cerr << "Failed to start " << process->program() << ": " << process->errorString() << endl;
+                process->deleteLater();
+                --m_runningJobs;
+                if (callback) {
+                    callback(-1, QProcess::CrashExit, QByteArray());
+                }
+                startJobs();
+            });
+        ++m_runningJobs;
+        process->start();
+    }
+}
+} // namespace DBusSoundRecorder
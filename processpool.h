@@ -0,0 +1,97 @@
+#ifndef PROCESSPOOL_H
+#define PROCESSPOOL_H
+
+#include <QObject>
+#include <QProcess>
+#include <QQueue>
+#include <QStringList>
+
+#include <functional>
+
+namespace DBusSoundRecorder {
+
+class FfmpegProcess;
+
+/*!
+ * \brief The ProcessPool class runs background jobs as processes with bounded concurrency.
+ *
+ * Jobs are queued and at most maxJobs() of them are running at the same time. The number of queued jobs is limited
+ * by maxBacklog() so a slow machine does not accumulate an unbounded amount of work. Processes are started with the
+ * configured niceness so they do not compete with capturing. The output of a process is forwarded unless the job has
+ * been enqueued via enqueueCapturingOutput().
+ */
+class ProcessPool : public QObject {
+    Q_OBJECT
+public:
+    using Callback = std::function<void(int exitCode, QProcess::ExitStatus exitStatus)>;
+    using OutputCallback = std::function<void(int exitCode, QProcess::ExitStatus exitStatus, const QByteArray &output)>;
+
+    explicit ProcessPool(QObject *parent = nullptr);
+
+    int maxJobs() const;
+    void setMaxJobs(int maxJobs);
+    int maxBacklog() const;
+    void setMaxBacklog(int maxBacklog);
+    int niceness() const;
+    void setNiceness(int niceness);
+    int runningJobs() const;
+    int queuedJobs() const;
+
+    bool enqueue(const QString &program, const QStringList &arguments, Callback callback);
+    bool enqueueCapturingOutput(const QString &program, const QStringList &arguments, OutputCallback callback);
+
+private Q_SLOTS:
+    void startJobs();
+
+private:
+    struct Job {
+        QString program;
+        QStringList arguments;
+        OutputCallback callback;
+        bool capturingOutput;
+    };
+
+    QQueue<Job> m_queue;
+    int m_maxJobs;
+    int m_maxBacklog;
+    int m_niceness;
+    int m_runningJobs;
+};
+
+inline int ProcessPool::maxJobs() const
+{
+    return m_maxJobs;
+}
+
+inline int ProcessPool::maxBacklog() const
+{
+    return m_maxBacklog;
+}
+
+inline void ProcessPool::setMaxBacklog(int maxBacklog)
+{
+    m_maxBacklog = maxBacklog;
+}
+
+inline int ProcessPool::niceness() const
+{
+    return m_niceness;
+}
+
+inline void ProcessPool::setNiceness(int niceness)
+{
+    m_niceness = niceness;
+}
+
+inline int ProcessPool::runningJobs() const
+{
+    return m_runningJobs;
+}
+
+inline int ProcessPool::queuedJobs() const
+{
+    return m_queue.size();
+}
+} // namespace DBusSoundRecorder
+
+#endif // PROCESSPOOL_H
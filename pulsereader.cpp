@@ -0,0 +1,66 @@
+#include "pulsereader.h"
+#include "pcmringbuffer.h"
+
+#include <QCoreApplication>
+
+#include <pulse/error.h>
+#include <pulse/simple.h>
+
+using namespace std;
+
+namespace DBusSoundRecorder {
+
+/// \brief The duration of the chunks read from the source in microseconds (also the latency of stopping).
+constexpr pa_usec_t chunkDuration = 20000;
+
+/*!
+ * \brief Constructs a new reader capturing the specified \a source into \a buffer.
+ * \remarks The source "default" (or an empty string) refers to the default source of the server. The data is captured
+ *          as signed 16-bit little endian PCM with the specified \a sampleRate and number of \a channels.
+ */
+PulseReader::PulseReader(PcmRingBuffer &buffer, const QString &source, unsigned int sampleRate, unsigned int channels, QObject *parent)
+    : QThread(parent)
+    , m_buffer(buffer)
+    , m_source(source == QLatin1String("default") ? QByteArray() : source.toUtf8())
+    , m_sampleRate(sampleRate)
+    , m_channels(channels)
+    , m_stopRequested(false)
+{
+}
+
+void PulseReader::run()
+{
+    pa_sample_spec spec;
+    spec.format = PA_SAMPLE_S16LE;
+    spec.rate = m_sampleRate;
+    spec.channels = static_cast<uint8_t>(m_channels);
+    // request small fragments so reading returns timely (and stopping does not block long)
+    const auto chunkSize = pa_usec_to_bytes(chunkDuration, &spec);
+    pa_buffer_attr attributes;
+    attributes.maxlength = static_cast<uint32_t>(-1);
+    attributes.tlength = static_cast<uint32_t>(-1);
+    attributes.prebuf = static_cast<uint32_t>(-1);
+    attributes.minreq = static_cast<uint32_t>(-1);
+    attributes.fragsize = static_cast<uint32_t>(chunkSize);
+    auto error = 0;
+    const auto appName = QCoreApplication::applicationName().toUtf8();
+    auto *const stream = pa_simple_new(nullptr, appName.data(), PA_STREAM_RECORD, m_source.isEmpty() ? nullptr : m_source.data(), "capture", &spec,
+        nullptr, &attributes, &error);
+    if (!stream) {
+        emit failed(QString::fromUtf8(pa_strerror(error)));
+        return;
+    }
+    while (!m_stopRequested.load(memory_order_relaxed)) {
+        const auto region = m_buffer.writeRegion(chunkSize);
+        if (pa_simple_read(stream, region.data, region.size, &error) < 0) {
+            m_buffer.commit(0);
+            emit failed(QString::fromUtf8(pa_strerror(error)));
+            break;
+        }
+        const auto offset = m_buffer.written();
+        m_buffer.commit(region.size);
+        emit pcmRead(static_cast<qint64>(offset), static_cast<qint64>(region.size), static_cast<qint64>(Clock::now().time_since_epoch().count()));
+    }
+    pa_simple_free(stream);
+}
+} // namespace DBusSoundRecorder
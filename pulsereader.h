@@ -0,0 +1,54 @@
+#ifndef PULSEREADER_H
+#define PULSEREADER_H
+
+#include <QThread>
+
+#include <atomic>
+#include <chrono>
+
+namespace DBusSoundRecorder {
+
+class PcmRingBuffer;
+
+/*!
+ * \brief The PulseReader class captures a Pulse Audio source via libpulse directly into a PcmRingBuffer.
+ *
+ * The source stream is opened once and read on a dedicated thread for the whole session. Data is read right into the
+ * ring buffer (which is lock-free and designed for a concurrent producer) so there is no intermediate buffer and no
+ * ffmpeg process whose output needs to be piped. Each chunk is announced via pcmRead() which is delivered to the
+ * thread the reader has been created in.
+ */
+class PulseReader : public QThread {
+    Q_OBJECT
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit PulseReader(PcmRingBuffer &buffer, const QString &source, unsigned int sampleRate, unsigned int channels, QObject *parent = nullptr);
+
+    void requestStop();
+
+Q_SIGNALS:
+    void pcmRead(qint64 offset, qint64 size, qint64 readTime);
+    void failed(const QString &message);
+
+protected:
+    void run() override;
+
+private:
+    PcmRingBuffer &m_buffer;
+    const QByteArray m_source;
+    const unsigned int m_sampleRate;
+    const unsigned int m_channels;
+    std::atomic<bool> m_stopRequested;
+};
+
+/*!
+ * \brief Asks the reader to stop after the chunk which is currently read.
+ */
+inline void PulseReader::requestStop()
+{
+    m_stopRequested.store(true, std::memory_order_relaxed);
+}
+} // namespace DBusSoundRecorder
+
+#endif // PULSEREADER_H
@@ -0,0 +1,266 @@
+#include "recorder.h"
+#include "fileverifier.h"
+#include "stagingarea.h"
+
+#include <c++utilities/conversion/stringconversion.h>
+#include <c++utilities/io/inifile.h>
+
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+using namespace CppUtilities;
+
+namespace DBusSoundRecorder {
+
+inline ostream &operator<<(ostream &stream, const QString &str)
+{
+    return stream << str.toLocal8Bit().data();
+}
+
+inline bool parseBool(const std::string &value)
+{
+    if (value == "yes" || value == "true" || value == "on" || value == "1") {
+        return true;
+    } else if (value == "no" || value == "false" || value == "off" || value == "0") {
+        return false;
+    }
+    throw runtime_error("\"" + value + "\" is not a boolean value");
+}
+
+/*!
+ * \brief Assigns the specified \a value to the setting with the specified \a key.
+ * \remarks The keys correspond to the long names of the arguments of the record operation.
+ * \throws Throws std::runtime_error (or a derived class) if \a value is invalid or \a key unknown.
+ */
+void RecorderConfig::setValue(const std::string &key, const std::string &value)
+{
+    if (key == "application") {
+        application = QString::fromLocal8Bit(value.data());
+    } else if (key == "ignore-playback-status") {
+        ignorePlaybackStatus = parseBool(value);
+    } else if (key == "settle-time") {
+        settleTime = stringToNumber<int>(value);
+    } else if (key == "sink") {
+        sink = QString::fromLocal8Bit(value.data());
+    } else if (key == "ffmpeg-input-options") {
+        inputOptions = QString::fromLocal8Bit(value.data());
+    } else if (key == "ffmpeg-bin") {
+        ffmpegBinary = QString::fromLocal8Bit(value.data());
+    } else if (key == "ffmpeg-options") {
+        options = QString::fromLocal8Bit(value.data());
+    } else if (key == "target-dir") {
+        targetDir = QString::fromLocal8Bit(value.data());
+    } else if (key == "target-extension") {
+        targetExtension = QString::fromLocal8Bit(value.data());
+    } else if (key == "continuous") {
+        continuous = parseBool(value);
+    } else if (key == "capture-backend") {
+        if (value == "ffmpeg") {
+            captureBackend = CaptureBackend::FFmpeg;
+        } else if (value == "pulse") {
+            if (!PcmCapture::isBackendAvailable(CaptureBackend::PulseAudio)) {
+                throw runtime_error("capturing via libpulse has not been enabled at build time");
+            }
+            captureBackend = CaptureBackend::PulseAudio;
+        } else {
+            throw runtime_error("\"" + value + "\" is not a capture backend (must be ffmpeg or pulse)");
+        }
+    } else if (key == "sample-rate") {
+        sampleRate = stringToNumber<unsigned int>(value);
+    } else if (key == "channels") {
+        channels = stringToNumber<unsigned int>(value);
+    } else if (key == "preroll") {
+        preroll = stringToNumber<unsigned int>(value);
+    } else if (key == "preroll-buffer") {
+        prerollBuffer = stringToNumber<double>(value);
+    } else if (key == "refine-cuts") {
+        refineWindow = stringToNumber<unsigned int>(value);
+    } else if (key == "silence-threshold") {
+        silenceThreshold = stringToNumber<double>(value);
+    } else if (key == "analyze-loudness") {
+        analyzeLoudness = parseBool(value);
+    } else if (key == "pcm-fanout") {
+        pcmFanout = QString::fromLocal8Bit(value.data());
+    } else if (key == "spool-dir") {
+        spoolDir = QString::fromLocal8Bit(value.data());
+    } else if (key == "staging-dir") {
+        stagingDir = QString::fromLocal8Bit(value.data());
+    } else if (key == "index") {
+        index = QString::fromLocal8Bit(value.data());
+    } else if (key == "journal") {
+        journal = QString::fromLocal8Bit(value.data());
+    } else if (key == "journal-recovery") {
+        if (value == "repair") {
+            journalRecovery = RecordingJournal::Recovery::Repair;
+        } else if (value == "quarantine") {
+            journalRecovery = RecordingJournal::Recovery::Quarantine;
+        } else if (value == "delete") {
+            journalRecovery = RecordingJournal::Recovery::Delete;
+        } else {
+            throw runtime_error("\"" + value + "\" is not a recovery strategy (must be repair, quarantine or delete)");
+        }
+    } else if (key == "skip-recorded") {
+        skipRecorded = parseBool(value);
+    } else if (key == "fingerprint") {
+        fingerprint = parseBool(value);
+    } else if (key == "verify") {
+        verify = parseBool(value);
+    } else if (key == "verify-report") {
+        verifyReport = QString::fromLocal8Bit(value.data());
+    } else if (key == "verify-quarantine") {
+        verifyQuarantine = QString::fromLocal8Bit(value.data());
+    } else if (key == "tag-afterwards") {
+        tagAfterwards = parseBool(value);
+        if (tagAfterwards && !FfmpegLauncher::isTaggingAfterwardsSupported()) {
+            throw runtime_error("tagging afterwards (via tagparser) has not been enabled at build time");
+        }
+    } else if (key == "trace") {
+        trace = QString::fromLocal8Bit(value.data());
+    } else {
+        throw runtime_error("unknown setting \"" + key + "\"");
+    }
+}
+
+/*!
+ * \brief Reads the recorder configurations from the INI file at the specified \a path.
+ * \remarks
+ *  - Each section configures one recorder; the section name is used as name of the recorder.
+ *  - Settings specified before the first section apply to all recorders (unless overridden within a section).
+ *  - The keys are the same as the long names of the arguments of the record operation.
+ * \throws Throws std::runtime_error (or a derived class) if the file can not be read or is invalid.
+ */
+vector<RecorderConfig> readRecorderConfigs(const QString &path)
+{
+    IniFile ini;
+    try {
+        fstream file;
+        file.exceptions(ios_base::badbit | ios_base::failbit);
+        file.open(path.toLocal8Bit().data(), ios_base::in);
+        ini.parse(file);
+    } catch (const ios_base::failure &) {
+        throw runtime_error("unable to read config file \"" + path.toStdString() + "\"");
+    }
+    RecorderConfig defaults;
+    vector<RecorderConfig> configs;
+    for (const auto &scope : ini.data()) {
+        auto config = scope.first.empty() ? RecorderConfig() : defaults;
+        config.name = QString::fromLocal8Bit(scope.first.data());
+        for (const auto &entry : scope.second) {
+            try {
+                config.setValue(entry.first, entry.second);
+            } catch (const runtime_error &e) {
+                throw runtime_error("invalid config file \"" + path.toStdString() + "\": [" + scope.first + "] " + entry.first + ": " + e.what());
+            }
+        }
+        if (scope.first.empty()) {
+            defaults = config;
+            continue;
+        }
+        if (config.application.isEmpty()) {
+            throw runtime_error("invalid config file \"" + path.toStdString() + "\": no application specified in [" + scope.first + "]");
+        }
+        configs.emplace_back(move(config));
+    }
+    if (configs.empty()) {
+        throw runtime_error("config file \"" + path.toStdString() + "\" does not contain any recorders");
+    }
+    return configs;
+}
+
+/*!
+ * \brief Constructs a new recorder with the specified \a config.
+ * \remarks If \a encoderPool or \a albumInfoCache are specified, they are used instead of creating them for this
+ *          recorder only. In this case the encoder settings of \a config are ignored.
+ */
+Recorder::Recorder(const RecorderConfig &config, ProcessPool *encoderPool, const std::shared_ptr<AlbumInfoCache> &albumInfoCache)
+    : m_name(config.name)
+    , m_watcher(config.application, config.ignorePlaybackStatus)
+    , m_launcher(m_watcher)
+{
+    if (config.settleTime >= 0) {
+        m_watcher.setSettleTime(config.settleTime);
+    }
+    if (!config.trace.isEmpty()) {
+        m_watcher.setTraceFile(config.trace);
+    }
+    if (!config.sink.isEmpty()) {
+        m_launcher.setSink(config.sink);
+    }
+    if (!config.inputOptions.isEmpty()) {
+        m_launcher.setFFmpegInputOptions(config.inputOptions);
+    }
+    if (!config.ffmpegBinary.isEmpty()) {
+        m_launcher.setFFmpegBinary(config.ffmpegBinary);
+    }
+    if (!config.options.isEmpty()) {
+        m_launcher.setFFmpegOptions(config.options);
+    }
+    if (!config.targetDir.isEmpty()) {
+        m_launcher.setTargetDir(config.targetDir);
+    }
+    if (!config.targetExtension.isEmpty()) {
+        m_launcher.setTargetExtension(config.targetExtension);
+    }
+    // capturing via libpulse and publishing the captured stream is only done continuously
+    m_launcher.setContinuousCapture(
+        config.continuous || !config.spoolDir.isEmpty() || !config.pcmFanout.isEmpty() || config.captureBackend != CaptureBackend::FFmpeg);
+    m_launcher.setCaptureBackend(config.captureBackend);
+    if (config.sampleRate) {
+        m_launcher.setSampleRate(config.sampleRate);
+    }
+    if (config.channels) {
+        m_launcher.setChannels(config.channels);
+    }
+    m_launcher.setPreroll(config.preroll);
+    if (config.prerollBuffer > 0.0) {
+        m_launcher.setPrerollBuffer(config.prerollBuffer);
+    }
+    m_launcher.setRefineWindow(config.refineWindow);
+    if (config.silenceThreshold < 0.0) {
+        m_launcher.setSilenceThreshold(config.silenceThreshold);
+    }
+    m_launcher.setAnalyzingLoudness(config.analyzeLoudness);
+    if (!m_launcher.setPcmFanoutSocket(config.pcmFanout)) {
+        throw runtime_error("unable to listen on PCM fan-out socket \"" + config.pcmFanout.toStdString() + "\"");
+    }
+    if (!m_launcher.setSpoolDir(config.spoolDir)) {
+        throw runtime_error("unable to create spool directory \"" + config.spoolDir.toStdString() + "\"");
+    }
+    if (!config.stagingDir.isEmpty()) {
+        m_launcher.setStagingArea(StagingArea::open(config.stagingDir));
+    }
+    m_launcher.setRecordingIndex(config.index);
+    m_launcher.setSkipRecorded(config.skipRecorded);
+    m_launcher.setFingerprinting(config.fingerprint);
+    if (!config.journal.isEmpty()) {
+        // recover files left incomplete before recording anything (only done once if recorders share the journal)
+        const auto journal = RecordingJournal::open(config.journal);
+        journal->recover(config.journalRecovery, m_launcher.ffmpegBinary());
+        m_launcher.setRecordingJournal(journal);
+    }
+    m_launcher.setTaggingAfterwards(config.tagAfterwards);
+    if (config.verify || !config.verifyReport.isEmpty() || !config.verifyQuarantine.isEmpty()) {
+        const auto verifier = make_shared<FileVerifier>();
+        verifier->setFFmpegBinary(m_launcher.ffmpegBinary());
+        verifier->setReportPath(config.verifyReport);
+        verifier->setQuarantineDir(config.verifyQuarantine);
+        m_launcher.setFileVerifier(verifier);
+    }
+    if (encoderPool) {
+        m_launcher.setEncoderPool(encoderPool);
+    } else {
+        if (config.encoderJobs > 0) {
+            m_launcher.setEncoderJobs(config.encoderJobs);
+        }
+        if (config.encoderBacklog >= 0) {
+            m_launcher.setEncoderBacklog(config.encoderBacklog);
+        }
+    }
+    if (albumInfoCache) {
+        m_launcher.setAlbumInfoCache(albumInfoCache);
+    }
+    cerr << "Watching MPRIS service of the specified application \"" << config.application << "\" ..." << endl;
+}
+} // namespace DBusSoundRecorder
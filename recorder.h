@@ -0,0 +1,98 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include "ffmpeglauncher.h"
+#include "pcmcapture.h"
+#include "playerwatcher.h"
+#include "recordingjournal.h"
+
+#include <QString>
+
+#include <memory>
+#include <vector>
+
+namespace DBusSoundRecorder {
+
+/*!
+ * \brief The RecorderConfig struct holds the configuration of a Recorder.
+ * \remarks Empty strings and negative/zero numbers denote that the default of the underlying class is used.
+ */
+struct RecorderConfig {
+    QString name;
+    QString application;
+    bool ignorePlaybackStatus = false;
+    int settleTime = -1;
+    QString sink;
+    QString inputOptions;
+    QString ffmpegBinary;
+    QString options;
+    QString targetDir;
+    QString targetExtension;
+    bool continuous = false;
+    CaptureBackend captureBackend = CaptureBackend::FFmpeg;
+    unsigned int sampleRate = 0;
+    unsigned int channels = 0;
+    unsigned int preroll = 0;
+    double prerollBuffer = 0.0;
+    unsigned int refineWindow = 0;
+    double silenceThreshold = 0.0; // in dBFS so only zero denotes the default
+    bool analyzeLoudness = false;
+    QString pcmFanout;
+    QString spoolDir;
+    QString stagingDir;
+    QString index;
+    QString journal;
+    RecordingJournal::Recovery journalRecovery = RecordingJournal::Recovery::Quarantine;
+    bool skipRecorded = false;
+    bool fingerprint = false;
+    bool tagAfterwards = false;
+    bool verify = false;
+    QString verifyReport;
+    QString verifyQuarantine;
+    QString trace;
+    int encoderJobs = 0;
+    int encoderBacklog = -1;
+
+    void setValue(const std::string &key, const std::string &value);
+};
+
+std::vector<RecorderConfig> readRecorderConfigs(const QString &path);
+
+/*!
+ * \brief The Recorder class binds a PlayerWatcher to an FfmpegLauncher recording the corresponding sink.
+ *
+ * Each recorder has its own state but all recorders within the process share the session bus connection and the
+ * event loop. Hence many players can be recorded by a single process.
+ */
+class Recorder {
+public:
+    explicit Recorder(const RecorderConfig &config, ProcessPool *encoderPool = nullptr,
+        const std::shared_ptr<AlbumInfoCache> &albumInfoCache = std::shared_ptr<AlbumInfoCache>());
+
+    const QString &name() const;
+    PlayerWatcher &watcher();
+    FfmpegLauncher &launcher();
+
+private:
+    const QString m_name;
+    PlayerWatcher m_watcher;
+    FfmpegLauncher m_launcher;
+};
+
+inline const QString &Recorder::name() const
+{
+    return m_name;
+}
+
+inline PlayerWatcher &Recorder::watcher()
+{
+    return m_watcher;
+}
+
+inline FfmpegLauncher &Recorder::launcher()
+{
+    return m_launcher;
+}
+} // namespace DBusSoundRecorder
+
+#endif // RECORDER_H
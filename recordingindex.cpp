@@ -0,0 +1,171 @@
+#include "recordingindex.h"
+
+#include <QFileInfo>
+#include <QList>
+#include <QStringList>
+
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+using namespace CppUtilities;
+
+namespace DBusSoundRecorder {
+
+inline ostream &operator<<(ostream &stream, const QString &str)
+{
+    return stream << str.toLocal8Bit().data();
+}
+
+inline QByteArray encodeField(const QString &field)
+{
+    return field.toUtf8().toPercentEncoding(QByteArrayLiteral(" /()-.,'&!"));
+}
+
+inline QString decodeField(const QByteArray &field)
+{
+    return QString::fromUtf8(QByteArray::fromPercentEncoding(field));
+}
+
+RecordingIndex::RecordingIndex(const QString &path)
+    : m_path(path)
+    , m_file(path)
+{
+}
+
+/*!
+ * \brief Returns the index stored at the specified \a path, loading it if not opened yet.
+ * \remarks All launchers using the same path share the index so they see the files and recordings of each other.
+ */
+std::shared_ptr<RecordingIndex> RecordingIndex::open(const QString &path)
+{
+    static QHash<QString, std::weak_ptr<RecordingIndex>> openIndices;
+    const auto absolutePath = QFileInfo(path).absoluteFilePath();
+    auto index = openIndices.value(absolutePath).lock();
+    if (!index) {
+        index = std::shared_ptr<RecordingIndex>(new RecordingIndex(absolutePath));
+        index->load();
+        openIndices[absolutePath] = index;
+    }
+    return index;
+}
+
+/*!
+ * \brief Returns the key identifying the track with the specified meta data.
+ * \remarks The meta data is normalized so differences in case and whitespace do not matter.
+ */
+QString RecordingIndex::key(const QString &artist, const QString &album, const QString &title, unsigned int trackNumber)
+{
+    return QStringList({ artist.simplified().toCaseFolded(), album.simplified().toCaseFolded(), title.simplified().toCaseFolded(),
+                           QString::number(trackNumber) })
+        .join(QChar('\t'));
+}
+
+/*!
+ * \brief Reads the log and opens it for appending.
+ * \remarks Lines which can not be parsed (e.g. because the last write has been interrupted) are ignored.
+ */
+void RecordingIndex::load()
+{
+    if (m_file.open(QIODevice::ReadOnly)) {
+        auto lineNumber = 0u;
+        while (!m_file.atEnd()) {
+            ++lineNumber;
+            auto line = m_file.readLine();
+            if (line.endsWith('\n')) {
+                line.chop(1);
+            }
+            const auto fields = line.split('\t');
+            if (fields.front() == "F" && fields.size() == 4) {
+                auto &suffix = m_suffixes[decodeField(fields[1])];
+                suffix = max(suffix, fields[2].toUInt());
+            } else if (fields.front() == "R" && fields.size() == 6) {
+                auto &entry = m_recordings[decodeField(fields[1])];
+                entry.path = decodeField(fields[2]);
+                entry.duration = TimeSpan::fromMilliseconds(fields[3].toDouble());
+                entry.complete = fields[4] == "1";
+                entry.fingerprint = QByteArray::fromHex(fields[5]);
+                if (entry.complete && !entry.fingerprint.isEmpty()) {
+                    m_fingerprints.add(decodeField(fields[1]), false, FingerprintIndex::decode(entry.fingerprint));
+                }
+            } else if (fields.front() == "A" && fields.size() == 2) {
+                m_fingerprints.add(QString(), true, FingerprintIndex::decode(QByteArray::fromHex(fields[1])));
+            } else if (!fields.front().isEmpty()) {
+                cerr << "Warning: Ignoring invalid line " << lineNumber << " of recording index " << m_path << endl;
+            }
+        }
+        m_file.close();
+    }
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        cerr << "Error: Unable to open recording index " << m_path << ": " << m_file.errorString() << endl;
+    }
+}
+
+/*!
+ * \brief Appends a line with the specified \a fields to the log.
+ */
+void RecordingIndex::append(const QList<QByteArray> &fields)
+{
+    if (!m_file.isOpen()) {
+        return;
+    }
+    auto line = fields.join('\t');
+    line.append('\n');
+    if (m_file.write(line) != line.size() || !m_file.flush()) {
+        cerr << "Error: Unable to write recording index " << m_path << ": " << m_file.errorString() << endl;
+    }
+}
+
+/*!
+ * \brief Records that \a path is used for the file name at \a basePath with the specified \a suffix.
+ */
+void RecordingIndex::addFile(const QString &basePath, unsigned int suffix, const QString &path)
+{
+    auto &lastSuffix = m_suffixes[basePath];
+    lastSuffix = max(lastSuffix, suffix);
+    append({ QByteArrayLiteral("F"), encodeField(basePath), QByteArray::number(suffix), encodeField(path) });
+}
+
+/*!
+ * \brief Records that the track with the specified \a key has been recorded as specified by \a entry.
+ * \remarks A previous entry for the same track is superseded (unless it is complete and \a entry is not).
+ */
+void RecordingIndex::addRecording(const QString &key, const Entry &entry)
+{
+    auto &existingEntry = m_recordings[key];
+    if (existingEntry.complete && !entry.complete) {
+        return;
+    }
+    existingEntry = entry;
+    if (entry.complete && !entry.fingerprint.isEmpty()) {
+        m_fingerprints.add(key, false, FingerprintIndex::decode(entry.fingerprint));
+    }
+    append({ QByteArrayLiteral("R"), encodeField(key), encodeField(entry.path), QByteArray::number(entry.duration.totalMilliseconds(), 'f', 0),
+        QByteArray(entry.complete ? "1" : "0"), entry.fingerprint.toHex() });
+}
+
+/*!
+ * \brief Records that the file at \a path recorded for the track with the specified \a key is not complete after all.
+ * \remarks Does nothing if the track has been recorded into another file since then. So the track is not skipped when
+ *          it is played next time (see isRecorded()).
+ */
+void RecordingIndex::markIncomplete(const QString &key, const QString &path)
+{
+    const auto entry = m_recordings.find(key);
+    if (entry == m_recordings.end() || entry->path != path || !entry->complete) {
+        return;
+    }
+    entry->complete = false;
+    append({ QByteArrayLiteral("R"), encodeField(key), encodeField(entry->path), QByteArray::number(entry->duration.totalMilliseconds(), 'f', 0),
+        QByteArrayLiteral("0"), entry->fingerprint.toHex() });
+}
+
+/*!
+ * \brief Records that an ad with the specified \a fingerprint (see FingerprintIndex::encode()) has been heard.
+ */
+void RecordingIndex::addAd(const QByteArray &fingerprint)
+{
+    m_fingerprints.add(QString(), true, FingerprintIndex::decode(fingerprint));
+    append({ QByteArrayLiteral("A"), fingerprint.toHex() });
+}
+} // namespace DBusSoundRecorder
@@ -0,0 +1,108 @@
+#ifndef RECORDINGINDEX_H
+#define RECORDINGINDEX_H
+
+#include "fingerprint.h"
+
+#include <c++utilities/chrono/timespan.h>
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QString>
+
+#include <memory>
+
+namespace DBusSoundRecorder {
+
+/*!
+ * \brief The RecordingIndex class keeps track of recorded tracks and of the file names used for them.
+ *
+ * The index is stored as an append-only log which is loaded once when the index is opened. Lookups are done in
+ * memory in constant time:
+ *  - whether a track has already been recorded completely (to skip it)
+ *  - the highest suffix used for a file name (to pick the next free one without probing all existing files)
+ *
+ * The fingerprints of completely recorded tracks and of known ads are kept in a FingerprintIndex so tracks can also be
+ * recognized by their sound (see fingerprints()).
+ *
+ * Tracks are identified by a key made of normalized artist, album, title and track number (see key()).
+ */
+class RecordingIndex {
+public:
+    struct Entry {
+        QString path;
+        CppUtilities::TimeSpan duration;
+        bool complete = false;
+        QByteArray fingerprint;
+    };
+
+    static std::shared_ptr<RecordingIndex> open(const QString &path);
+    static QString key(const QString &artist, const QString &album, const QString &title, unsigned int trackNumber);
+
+    const QString &path() const;
+    const Entry *find(const QString &key) const;
+    bool isRecorded(const QString &key) const;
+    unsigned int lastSuffix(const QString &basePath) const;
+
+    void addFile(const QString &basePath, unsigned int suffix, const QString &path);
+    void addRecording(const QString &key, const Entry &entry);
+    void markIncomplete(const QString &key, const QString &path);
+    const FingerprintIndex &fingerprints() const;
+    void addAd(const QByteArray &fingerprint);
+
+private:
+    explicit RecordingIndex(const QString &path);
+    void load();
+    void append(const QList<QByteArray> &fields);
+
+    const QString m_path;
+    QFile m_file;
+    QHash<QString, Entry> m_recordings;
+    QHash<QString, unsigned int> m_suffixes;
+    FingerprintIndex m_fingerprints;
+};
+
+inline const QString &RecordingIndex::path() const
+{
+    return m_path;
+}
+
+/*!
+ * \brief Returns the most recent entry for the track with the specified \a key or nullptr if there is none.
+ */
+inline const RecordingIndex::Entry *RecordingIndex::find(const QString &key) const
+{
+    const auto i = m_recordings.constFind(key);
+    return i != m_recordings.cend() ? &i.value() : nullptr;
+}
+
+/*!
+ * \brief Returns whether the track with the specified \a key has already been recorded completely.
+ */
+inline bool RecordingIndex::isRecorded(const QString &key) const
+{
+    const auto *const entry = find(key);
+    return entry && entry->complete;
+}
+
+/*!
+ * \brief Returns the fingerprints of the tracks which have been recorded completely and of the known ads.
+ * \remarks The keys of ads are empty.
+ */
+inline const FingerprintIndex &RecordingIndex::fingerprints() const
+{
+    return m_fingerprints;
+}
+
+/*!
+ * \brief Returns the highest suffix used for the file name at the specified \a basePath or zero if it has not been used.
+ * \remarks The suffix 1 denotes the file name without suffix.
+ */
+inline unsigned int RecordingIndex::lastSuffix(const QString &basePath) const
+{
+    return m_suffixes.value(basePath);
+}
+} // namespace DBusSoundRecorder
+
+#endif // RECORDINGINDEX_H
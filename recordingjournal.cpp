@@ -0,0 +1,334 @@
+#include "recordingjournal.h"
+#include "fileverifier.h"
+#include "stagingarea.h"
+
+#include <QFileInfo>
+#include <QProcess>
+#include <QSaveFile>
+#include <QStringList>
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+#include <unistd.h>
+
+using namespace std;
+
+namespace DBusSoundRecorder {
+
+inline ostream &operator<<(ostream &stream, const QString &str)
+{
+    return stream << str.toLocal8Bit().data();
+}
+
+inline QByteArray encodeField(const QString &field)
+{
+    return field.toUtf8().toPercentEncoding(QByteArrayLiteral(" /()-.,'&!"));
+}
+
+inline QString decodeField(const QByteArray &field)
+{
+    return QString::fromUtf8(QByteArray::fromPercentEncoding(field));
+}
+
+/// \brief The number of lines after which a checkpoint is written.
+constexpr unsigned int checkpointInterval = 256;
+/// \brief The size in bytes above which the journal is compacted instead of writing a checkpoint.
+constexpr qint64 compactionThreshold = 1024 * 1024;
+/// \brief The size in bytes of the chunks read from the end of the journal when looking for the last checkpoint.
+constexpr qint64 tailChunkSize = 64 * 1024;
+
+RecordingJournal::RecordingJournal(const QString &path)
+    : m_path(path)
+    , m_file(path)
+    , m_nextId(1)
+    , m_linesSinceCheckpoint(0)
+{
+}
+
+/*!
+ * \brief Returns the journal stored at the specified \a path, loading it if not opened yet.
+ * \remarks All launchers using the same path share the journal.
+ */
+std::shared_ptr<RecordingJournal> RecordingJournal::open(const QString &path)
+{
+    static QHash<QString, std::weak_ptr<RecordingJournal>> openJournals;
+    const auto absolutePath = QFileInfo(path).absoluteFilePath();
+    auto journal = openJournals.value(absolutePath).lock();
+    if (!journal) {
+        journal = std::shared_ptr<RecordingJournal>(new RecordingJournal(absolutePath));
+        journal->load();
+        openJournals[absolutePath] = journal;
+    }
+    return journal;
+}
+
+/*!
+ * \brief Returns the part of the journal starting at the last checkpoint.
+ * \remarks The journal is read backwards in chunks so its size does not matter. Returns the whole journal if it does
+ *          not contain a checkpoint.
+ */
+QByteArray RecordingJournal::readTail()
+{
+    QByteArray tail;
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        return tail;
+    }
+    for (auto pos = m_file.size(); pos > 0;) {
+        const auto chunkStart = max(pos - tailChunkSize, static_cast<qint64>(0));
+        if (!m_file.seek(chunkStart)) {
+            break;
+        }
+        tail.prepend(m_file.read(pos - chunkStart));
+        pos = chunkStart;
+        const auto checkpoint = tail.lastIndexOf("\nK\n");
+        if (checkpoint >= 0) {
+            tail.remove(0, checkpoint + 1);
+            break;
+        }
+    }
+    m_file.close();
+    return tail;
+}
+
+/*!
+ * \brief Reads the tail of the journal, compacts it and opens it for appending.
+ * \remarks All recordings which are still in progress according to the journal have been left incomplete. Lines which
+ *          can not be parsed (e.g. because the last write has been interrupted) are ignored.
+ */
+void RecordingJournal::load()
+{
+    auto lastId = quint64(0);
+    for (const auto &line : readTail().split('\n')) {
+        const auto fields = line.split('\t');
+        const auto id = fields.size() > 1 ? fields[1].toULongLong() : quint64(0);
+        lastId = max(lastId, id);
+        if (fields.front() == "S" && (fields.size() == 5 || fields.size() == 6)) {
+            // note: the target path is omitted by journals written before staging has been supported
+            auto &entry = m_incompleteEntries[id];
+            entry.path = decodeField(fields[2]);
+            entry.length = fields[3].toLongLong();
+            entry.key = decodeField(fields[4]);
+            entry.targetPath = fields.size() > 5 ? decodeField(fields[5]) : entry.path;
+        } else if (fields.front() == "M" && fields.size() == 3) {
+            const auto entry = m_incompleteEntries.find(id);
+            if (entry != m_incompleteEntries.end()) {
+                entry->key = decodeField(fields[2]);
+            }
+        } else if (fields.front() == "C" && fields.size() == 2) {
+            m_incompleteEntries.remove(id);
+        } else if (fields.front() == "K" && fields.size() == 1) {
+            m_incompleteEntries.clear();
+        } else if (!fields.front().isEmpty()) {
+            cerr << "Warning: Ignoring invalid line of recording journal " << m_path << endl;
+        }
+    }
+    m_nextId = lastId + 1;
+    if (!m_incompleteEntries.isEmpty()) {
+        cerr << "Warning: " << m_incompleteEntries.size() << " recording(s) have been left incomplete according to journal " << m_path << endl;
+    }
+    compact();
+}
+
+/*!
+ * \brief Replaces the journal by a checkpoint of the recordings which are still in progress or incomplete.
+ */
+void RecordingJournal::compact()
+{
+    if (m_file.isOpen()) {
+        m_file.close();
+    }
+    const auto data = checkpointData();
+    QSaveFile file(m_path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit()) {
+        cerr << "Error: Unable to write recording journal " << m_path << ": " << file.errorString() << endl;
+    }
+    m_linesSinceCheckpoint = 0;
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        cerr << "Error: Unable to open recording journal " << m_path << ": " << m_file.errorString() << endl;
+    }
+}
+
+/*!
+ * \brief Returns a checkpoint line followed by the lines logging the start of the recordings which are still in progress
+ *        or incomplete.
+ */
+QByteArray RecordingJournal::checkpointData() const
+{
+    QByteArray data("K\n");
+    for (const auto *const entries : { &m_incompleteEntries, &m_openEntries }) {
+        for (auto i = entries->cbegin(), end = entries->cend(); i != end; ++i) {
+            data += startFields(i.key(), i.value()).join('\t') + '\n';
+        }
+    }
+    return data;
+}
+
+/*!
+ * \brief Returns the fields of the line logging the start of the recording with the specified \a id and \a entry.
+ */
+QList<QByteArray> RecordingJournal::startFields(quint64 id, const Entry &entry)
+{
+    return { QByteArrayLiteral("S"), QByteArray::number(id), encodeField(entry.path), QByteArray::number(entry.length), encodeField(entry.key),
+        encodeField(entry.targetPath) };
+}
+
+/*!
+ * \brief Appends a line with the specified \a fields to the journal.
+ * \remarks If \a sync is set, the data is synced to disk before returning.
+ */
+void RecordingJournal::append(const QList<QByteArray> &fields, bool sync)
+{
+    if (!m_file.isOpen()) {
+        return;
+    }
+    auto line = fields.join('\t');
+    line.append('\n');
+    if (m_file.write(line) != line.size() || !m_file.flush() || (sync && ::fdatasync(m_file.handle()))) {
+        cerr << "Error: Unable to write recording journal " << m_path << ": " << m_file.errorString() << endl;
+    }
+    if (++m_linesSinceCheckpoint >= checkpointInterval) {
+        checkpoint();
+    }
+}
+
+/*!
+ * \brief Appends a checkpoint repeating the recordings which are still in progress or incomplete.
+ * \remarks Compacts the journal instead if it has grown too much.
+ */
+void RecordingJournal::checkpoint()
+{
+    if (m_file.size() > compactionThreshold) {
+        compact();
+        return;
+    }
+    m_linesSinceCheckpoint = 0;
+    const auto data = checkpointData();
+    if (m_file.write(data) != data.size() || !m_file.flush()) {
+        cerr << "Error: Unable to write recording journal " << m_path << ": " << m_file.errorString() << endl;
+    }
+}
+
+/*!
+ * \brief Logs the start of the recording of the track with the specified \a key into the file at \a path.
+ * \remarks The \a targetPath is the path the file is moved to when it is finished (the same as \a path unless it is
+ *          staged). The \a length is the expected length in milliseconds (zero if unknown). The line is synced to disk.
+ * \returns Returns the ID to refer to the recording in subsequent calls.
+ */
+quint64 RecordingJournal::addStart(const QString &path, const QString &targetPath, qint64 length, const QString &key)
+{
+    const auto id = m_nextId++;
+    auto &entry = m_openEntries[id];
+    entry.path = path;
+    entry.targetPath = targetPath;
+    entry.length = length;
+    entry.key = key;
+    append(startFields(id, entry), true);
+    return id;
+}
+
+/*!
+ * \brief Logs that the meta data of the recording with the specified \a id has been updated.
+ */
+void RecordingJournal::addMetaData(quint64 id, const QString &key)
+{
+    const auto entry = m_openEntries.find(id);
+    if (entry == m_openEntries.end()) {
+        return;
+    }
+    entry->key = key;
+    append({ QByteArrayLiteral("M"), QByteArray::number(id), encodeField(key) });
+}
+
+/*!
+ * \brief Logs that the file of the recording with the specified \a id is complete.
+ */
+void RecordingJournal::addCompletion(quint64 id)
+{
+    if (!m_openEntries.remove(id) && !m_incompleteEntries.remove(id)) {
+        return;
+    }
+    append({ QByteArrayLiteral("C"), QByteArray::number(id) });
+}
+
+/*!
+ * \brief Recovers the files which have been left incomplete using the specified strategy.
+ * \remarks
+ * - Files which do not exist anymore are skipped and empty files are always deleted.
+ * - Repairing uses the ffmpeg binary at \a ffmpegBinary. It only works for containers which are readable without
+ *   trailing index (e.g. fragmented MP4, Matroska, Ogg, MP3). Files which can not be repaired are quarantined.
+ * - Repaired staged files are moved into their target path. They are quarantined if the target path is taken.
+ * - This function blocks until all files have been recovered. It does nothing if all files have been recovered.
+ */
+void RecordingJournal::recover(Recovery recovery, const QString &ffmpegBinary)
+{
+    const auto entries = m_incompleteEntries;
+    for (auto i = entries.cbegin(), end = entries.cend(); i != end; ++i) {
+        const auto &path = i->path;
+        const QFileInfo fileInfo(path);
+        if (!fileInfo.exists()) {
+            addCompletion(i.key());
+            continue;
+        }
+        auto recovered = false;
+        if (!fileInfo.size()) {
+            recovered = QFile::remove(path);
+            cerr << "Removed empty file " << path << endl;
+        } else if (recovery == Recovery::Delete) {
+            recovered = QFile::remove(path);
+            cerr << "Removed incomplete file " << path << endl;
+        } else if (recovery == Recovery::Repair && repair(path, ffmpegBinary)) {
+            cerr << "Repaired incomplete file " << path << endl;
+            // move a staged file into the library like it would have been after finishing it (but never replace a file)
+            if (i->targetPath.isEmpty() || i->targetPath == path) {
+                recovered = true;
+            } else if (!QFileInfo::exists(i->targetPath) && StagingArea::move(path, i->targetPath)) {
+                recovered = true;
+                cerr << "Moved repaired file " << path << " to " << i->targetPath << endl;
+            } else {
+                recovered = quarantine(path);
+            }
+        } else {
+            recovered = quarantine(path);
+        }
+        if (recovered) {
+            addCompletion(i.key());
+        } else {
+            cerr << "Error: Unable to recover incomplete file " << path << endl;
+        }
+    }
+}
+
+/*!
+ * \brief Remuxes the file at the specified \a path via ffmpeg, replacing it only if remuxing succeeded.
+ */
+bool RecordingJournal::repair(const QString &path, const QString &ffmpegBinary) const
+{
+    const QFileInfo fileInfo(path);
+    const auto repairedPath = QStringLiteral("%1/.%2.repaired.%3").arg(fileInfo.absolutePath(), fileInfo.completeBaseName(), fileInfo.suffix());
+    QProcess ffmpeg;
+    ffmpeg.setProcessChannelMode(QProcess::ForwardedChannels);
+    ffmpeg.start(ffmpegBinary,
+        { QStringLiteral("-nostdin"), QStringLiteral("-y"), QStringLiteral("-v"), QStringLiteral("error"), QStringLiteral("-i"), path,
+            QStringLiteral("-map"), QStringLiteral("0"), QStringLiteral("-c"), QStringLiteral("copy"), repairedPath });
+    if (!ffmpeg.waitForFinished(-1) || ffmpeg.exitStatus() != QProcess::NormalExit || ffmpeg.exitCode() || QFileInfo(repairedPath).size() <= 0) {
+        QFile::remove(repairedPath);
+        return false;
+    }
+    // replace the file atomically so it is never lost
+    if (::rename(QFile::encodeName(repairedPath).data(), QFile::encodeName(path).data())) {
+        QFile::remove(repairedPath);
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * \brief Moves the file at the specified \a path into the quarantine directory.
+ */
+bool RecordingJournal::quarantine(const QString &path) const
+{
+    return !quarantineFile(path, quarantineDir()).isEmpty();
+}
+} // namespace DBusSoundRecorder
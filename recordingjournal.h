@@ -0,0 +1,94 @@
+#ifndef RECORDINGJOURNAL_H
+#define RECORDINGJOURNAL_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QString>
+
+#include <memory>
+
+namespace DBusSoundRecorder {
+
+/*!
+ * \brief The RecordingJournal class is a write-ahead log of the recordings which are in progress.
+ *
+ * The start of a recording (write and target path, expected length and the key of the track) is synced to disk before the
+ * recording is started. Updates of the meta data and the completion of a recording are logged as well. So if the
+ * process dies or the machine reboots, the files which have been left incomplete are known after restarting without
+ * walking the target directory.
+ *
+ * From time to time a checkpoint is written which repeats the recordings which are still in progress. Hence only the
+ * tail of the journal following the last checkpoint needs to be read when opening it. The journal is compacted when
+ * opening it and when it has grown too much.
+ */
+class RecordingJournal {
+public:
+    enum class Recovery {
+        Repair, /**< incomplete files are remuxed via ffmpeg (and quarantined if that fails) */
+        Quarantine, /**< incomplete files are moved into the quarantine directory */
+        Delete, /**< incomplete files are deleted */
+    };
+    struct Entry {
+        QString path;
+        QString targetPath; /**< the path the file is moved to when finished (differs from path if it is staged) */
+        qint64 length = 0;
+        QString key;
+    };
+
+    static std::shared_ptr<RecordingJournal> open(const QString &path);
+
+    const QString &path() const;
+    QString quarantineDir() const;
+    const QHash<quint64, Entry> &incompleteEntries() const;
+    void recover(Recovery recovery, const QString &ffmpegBinary);
+
+    quint64 addStart(const QString &path, const QString &targetPath, qint64 length, const QString &key);
+    void addMetaData(quint64 id, const QString &key);
+    void addCompletion(quint64 id);
+
+private:
+    explicit RecordingJournal(const QString &path);
+    QByteArray readTail();
+    void load();
+    void compact();
+    void append(const QList<QByteArray> &fields, bool sync = false);
+    void checkpoint();
+    QByteArray checkpointData() const;
+    static QList<QByteArray> startFields(quint64 id, const Entry &entry);
+    bool repair(const QString &path, const QString &ffmpegBinary) const;
+    bool quarantine(const QString &path) const;
+
+    const QString m_path;
+    QFile m_file;
+    QHash<quint64, Entry> m_incompleteEntries;
+    QHash<quint64, Entry> m_openEntries;
+    quint64 m_nextId;
+    unsigned int m_linesSinceCheckpoint;
+};
+
+inline const QString &RecordingJournal::path() const
+{
+    return m_path;
+}
+
+/*!
+ * \brief Returns the directory incomplete files are moved into by the Recovery::Quarantine strategy.
+ */
+inline QString RecordingJournal::quarantineDir() const
+{
+    return m_path + QStringLiteral(".quarantine");
+}
+
+/*!
+ * \brief Returns the recordings which have been left incomplete when the journal has been used last and have not been
+ *        recovered yet.
+ */
+inline const QHash<quint64, RecordingJournal::Entry> &RecordingJournal::incompleteEntries() const
+{
+    return m_incompleteEntries;
+}
+} // namespace DBusSoundRecorder
+
+#endif // RECORDINGJOURNAL_H
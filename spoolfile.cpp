@@ -0,0 +1,98 @@
+#include "spoolfile.h"
+
+#include <QtEndian>
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace DBusSoundRecorder {
+
+/// \brief The size of the RIFF/WAVE header written by SpoolFile.
+constexpr qint64 wavHeaderSize = 44;
+
+template <typename NumberType> inline void putLittleEndian(char *&buffer, NumberType value)
+{
+    qToLittleEndian(value, buffer);
+    buffer += sizeof(NumberType);
+}
+
+inline void putChars(char *&buffer, const char *chars, std::size_t size)
+{
+    memcpy(buffer, chars, size);
+    buffer += size;
+}
+
+SpoolFile::SpoolFile()
+    : m_dataSize(0)
+{
+}
+
+/*!
+ * \brief Creates the spool file at the specified \a path and writes the header for the specified format.
+ * \remarks The sizes within the header are only filled in by finish().
+ */
+bool SpoolFile::open(const QString &path, unsigned int sampleRate, unsigned int channels)
+{
+    m_path = path;
+    m_dataSize = 0;
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return false;
+    }
+    char header[wavHeaderSize];
+    auto *i = header;
+    putChars(i, "RIFF", 4);
+    putLittleEndian<quint32>(i, 0);
+    putChars(i, "WAVEfmt ", 8);
+    putLittleEndian<quint32>(i, 16);
+    putLittleEndian<quint16>(i, 1); // PCM
+    putLittleEndian<quint16>(i, static_cast<quint16>(channels));
+    putLittleEndian<quint32>(i, sampleRate);
+    putLittleEndian<quint32>(i, sampleRate * channels * 2);
+    putLittleEndian<quint16>(i, static_cast<quint16>(channels * 2));
+    putLittleEndian<quint16>(i, 16);
+    putChars(i, "data", 4);
+    putLittleEndian<quint32>(i, 0);
+    return m_file.write(header, wavHeaderSize) == wavHeaderSize;
+}
+
+bool SpoolFile::write(const char *data, qint64 size)
+{
+    const auto written = m_file.write(data, size);
+    if (written > 0) {
+        m_dataSize += written;
+    }
+    return written == size;
+}
+
+/*!
+ * \brief Fills in the sizes within the header and closes the file.
+ */
+bool SpoolFile::finish()
+{
+    if (!m_file.isOpen()) {
+        return false;
+    }
+    char size[4];
+    auto *i = size;
+    const auto dataSize = static_cast<quint32>(min<qint64>(m_dataSize, 0xFFFFFFFF - wavHeaderSize));
+    putLittleEndian<quint32>(i, dataSize + wavHeaderSize - 8);
+    auto ok = m_file.seek(4) && m_file.write(size, 4) == 4;
+    i = size;
+    putLittleEndian<quint32>(i, dataSize);
+    ok = ok && m_file.seek(wavHeaderSize - 4) && m_file.write(size, 4) == 4;
+    m_file.close();
+    return ok && m_file.error() == QFileDevice::NoError;
+}
+
+/*!
+ * \brief Closes and removes the file.
+ */
+void SpoolFile::discard()
+{
+    m_file.close();
+    m_file.remove();
+}
+} // namespace DBusSoundRecorder
@@ -0,0 +1,35 @@
+#ifndef SPOOLFILE_H
+#define SPOOLFILE_H
+
+#include <QFile>
+
+namespace DBusSoundRecorder {
+
+/*!
+ * \brief The SpoolFile class writes captured PCM data (signed 16-bit little endian) losslessly into a WAV file.
+ *
+ * Writing a spool file is cheap enough to be done while capturing; encoding happens later in the background.
+ */
+class SpoolFile {
+public:
+    SpoolFile();
+
+    const QString &path() const;
+    bool open(const QString &path, unsigned int sampleRate, unsigned int channels);
+    bool write(const char *data, qint64 size);
+    bool finish();
+    void discard();
+
+private:
+    QFile m_file;
+    QString m_path;
+    qint64 m_dataSize;
+};
+
+inline const QString &SpoolFile::path() const
+{
+    return m_path;
+}
+} // namespace DBusSoundRecorder
+
+#endif // SPOOLFILE_H
@@ -0,0 +1,205 @@
+#include "stagingarea.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QRunnable>
+
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace DBusSoundRecorder {
+
+inline ostream &operator<<(ostream &stream, const QString &str)
+{
+    return stream << str.toLocal8Bit().data();
+}
+
+/// \brief The size of the chunks used when copying a file to another file system.
+constexpr qint64 copyChunkSize = 1024 * 1024;
+
+/*!
+ * \brief The StagingCommitJob class moves a staged file into its target path in the background.
+ */
+class StagingCommitJob : public QRunnable {
+public:
+    StagingCommitJob(const std::function<bool()> &move, const StagingArea::Callback &done);
+    void run() override;
+
+private:
+    const std::function<bool()> m_move;
+    const StagingArea::Callback m_done;
+};
+
+StagingCommitJob::StagingCommitJob(const std::function<bool()> &move, const StagingArea::Callback &done)
+    : m_move(move)
+    , m_done(done)
+{
+}
+
+void StagingCommitJob::run()
+{
+    const auto committed = m_move();
+    QMetaObject::invokeMethod(QCoreApplication::instance(), [done = m_done, committed] { done(committed); }, Qt::QueuedConnection);
+}
+
+StagingArea::StagingArea(const QString &dirPath)
+    : m_dirPath(dirPath)
+{
+    m_threadPool.setMaxThreadCount(1);
+}
+
+/*!
+ * \brief Waits until all files which are being committed have been moved.
+ */
+StagingArea::~StagingArea()
+{
+    m_threadPool.waitForDone();
+}
+
+/*!
+ * \brief Returns the staging area for the directory at the specified \a dirPath, creating the directory if needed.
+ * \remarks All launchers using the same directory share the staging area so they see the reservations of each other.
+ */
+std::shared_ptr<StagingArea> StagingArea::open(const QString &dirPath)
+{
+    static QHash<QString, std::weak_ptr<StagingArea>> openAreas;
+    const auto absolutePath = QDir(dirPath).absolutePath();
+    auto area = openAreas.value(absolutePath).lock();
+    if (!area) {
+        if (!QDir().mkpath(absolutePath)) {
+            cerr << "Error: Can not create staging directory: " << absolutePath << endl;
+        }
+        area = std::shared_ptr<StagingArea>(new StagingArea(absolutePath));
+        openAreas[absolutePath] = area;
+    }
+    return area;
+}
+
+/*!
+ * \brief Creates a file within the staging directory for the file which will be moved to \a targetPath.
+ * \remarks
+ * - If \a expectedSize is positive, that many bytes are preallocated without changing the size of the file. The file
+ *   must not be truncated when opening it again (use ffmpeg's "-truncate 0") to keep the preallocation.
+ * - Reserves \a targetPath until the file has been committed or discarded.
+ * \returns Returns the path of the staged file or an empty string if it could not be created.
+ */
+QString StagingArea::stage(const QString &targetPath, qint64 expectedSize)
+{
+    // the counter is shared by all staging areas so processes using the same directory only need to differ in PID
+    static quint64 stagingCounter = 0;
+    const auto stagingPath
+        = QStringLiteral("%1/%2-%3-%4").arg(m_dirPath).arg(QCoreApplication::applicationPid()).arg(++stagingCounter).arg(QFileInfo(targetPath).fileName());
+    QFile file(stagingPath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        cerr << "Error: Can not create staging file " << stagingPath << ": " << file.errorString() << endl;
+        return QString();
+    }
+    // not all file systems support preallocating; the file is just fragmented then
+    if (expectedSize > 0 && ::fallocate(file.handle(), FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(expectedSize)) && errno != EOPNOTSUPP) {
+        cerr << "Warning: Unable to preallocate " << expectedSize << " bytes for " << stagingPath << endl;
+    }
+    m_targets[stagingPath] = targetPath;
+    m_reservedTargets << targetPath;
+    return stagingPath;
+}
+
+/*!
+ * \brief Removes the staged file at \a stagingPath and releases the reservation of its target path.
+ */
+void StagingArea::discard(const QString &stagingPath)
+{
+    QFile::remove(stagingPath);
+    m_reservedTargets.remove(m_targets.take(stagingPath));
+}
+
+/*!
+ * \brief Moves the staged file at \a stagingPath into its target path in the background.
+ * \remarks The function returns immediately; \a done is invoked from the event loop of the main thread afterwards.
+ *          The staged file is kept if it can not be moved.
+ */
+void StagingArea::commit(const QString &stagingPath, const Callback &done)
+{
+    const auto targetPath = m_targets.value(stagingPath);
+    if (targetPath.isEmpty()) {
+        if (done) {
+            done(false);
+        }
+        return;
+    }
+    // release the reservation only after the file has been moved so the target path is not picked in the meantime
+    const auto handleResult = [area = std::weak_ptr<StagingArea>(shared_from_this()), stagingPath, targetPath, done](bool committed) {
+        if (!committed) {
+            cerr << "Error: Unable to move " << stagingPath << " to " << targetPath << ", keeping staged file" << endl;
+        }
+        const auto self = area.lock();
+        if (self && committed) {
+            self->m_targets.remove(stagingPath);
+            self->m_reservedTargets.remove(targetPath);
+        }
+        if (done) {
+            done(committed);
+        }
+    };
+    m_threadPool.start(new StagingCommitJob([stagingPath, targetPath] { return move(stagingPath, targetPath); }, handleResult));
+}
+
+/*!
+ * \brief Moves the file at \a stagingPath to \a targetPath atomically.
+ * \remarks Space preallocated beyond the end of the file is released first.
+ */
+bool StagingArea::move(const QString &stagingPath, const QString &targetPath)
+{
+    const auto encodedStagingPath = QFile::encodeName(stagingPath);
+    const auto encodedTargetPath = QFile::encodeName(targetPath);
+    const auto size = QFileInfo(stagingPath).size();
+    if (::truncate(encodedStagingPath.data(), static_cast<off_t>(size))) {
+        return false;
+    }
+    if (!::rename(encodedStagingPath.data(), encodedTargetPath.data())) {
+        return true;
+    }
+    if (errno != EXDEV) {
+        return false;
+    }
+    // copy the file next to its target first when it is on another file system so it still appears atomically
+    const QFileInfo targetInfo(targetPath);
+    const auto tempPath = QStringLiteral("%1/.%2.staged").arg(targetInfo.absolutePath(), targetInfo.fileName());
+    if (!copy(stagingPath, tempPath) || ::rename(QFile::encodeName(tempPath).data(), encodedTargetPath.data())) {
+        QFile::remove(tempPath);
+        return false;
+    }
+    QFile::remove(stagingPath);
+    return true;
+}
+
+/*!
+ * \brief Copies the file at \a sourcePath to \a targetPath, allocating the whole target file upfront.
+ */
+bool StagingArea::copy(const QString &sourcePath, const QString &targetPath)
+{
+    QFile source(sourcePath), target(targetPath);
+    if (!source.open(QIODevice::ReadOnly) || !target.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return false;
+    }
+    const auto size = source.size();
+    if (size > 0) {
+        ::posix_fallocate(target.handle(), 0, static_cast<off_t>(size));
+    }
+    for (qint64 copied = 0; copied < size;) {
+        const auto chunk = source.read(min(copyChunkSize, size - copied));
+        if (chunk.isEmpty() || target.write(chunk) != chunk.size()) {
+            return false;
+        }
+        copied += chunk.size();
+    }
+    return target.flush() && !::fsync(target.handle());
+}
+} // namespace DBusSoundRecorder
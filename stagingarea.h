@@ -0,0 +1,64 @@
+#ifndef STAGINGAREA_H
+#define STAGINGAREA_H
+
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QThreadPool>
+
+#include <functional>
+#include <memory>
+
+namespace DBusSoundRecorder {
+
+/*!
+ * \brief The StagingArea class manages a directory files are written into before they are moved into the library.
+ *
+ * So half-written files never show up in the target directory. A staged file is preallocated according to its expected
+ * size so it is not fragmented when written by ffmpeg. When committing, the space preallocated in excess is released
+ * and the file is renamed into its target path. If the staging directory is on another file system (e.g. tmpfs), the
+ * file is copied next to its target path first and then renamed so the target appears atomically as well. Committing
+ * happens on a single background thread.
+ *
+ * The target paths of staged files are reserved until they have been committed or discarded so they are not picked for
+ * another file in the meantime.
+ */
+class StagingArea : public std::enable_shared_from_this<StagingArea> {
+public:
+    using Callback = std::function<void(bool committed)>;
+
+    static std::shared_ptr<StagingArea> open(const QString &dirPath);
+    ~StagingArea();
+
+    const QString &dirPath() const;
+    bool isReserved(const QString &targetPath) const;
+    QString stage(const QString &targetPath, qint64 expectedSize);
+    void discard(const QString &stagingPath);
+    void commit(const QString &stagingPath, const Callback &done = Callback());
+    static bool move(const QString &stagingPath, const QString &targetPath);
+
+private:
+    explicit StagingArea(const QString &dirPath);
+    static bool copy(const QString &sourcePath, const QString &targetPath);
+
+    const QString m_dirPath;
+    QHash<QString, QString> m_targets;
+    QSet<QString> m_reservedTargets;
+    QThreadPool m_threadPool;
+};
+
+inline const QString &StagingArea::dirPath() const
+{
+    return m_dirPath;
+}
+
+/*!
+ * \brief Returns whether \a targetPath is the target of a file which is currently staged.
+ */
+inline bool StagingArea::isReserved(const QString &targetPath) const
+{
+    return m_reservedTargets.contains(targetPath);
+}
+} // namespace DBusSoundRecorder
+
+#endif // STAGINGAREA_H
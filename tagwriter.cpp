@@ -0,0 +1,209 @@
+#include "tagwriter.h"
+
+#include <tagparser/diagnostics.h>
+#include <tagparser/exceptions.h>
+#include <tagparser/mediafileinfo.h>
+#include <tagparser/mp4/mp4tag.h>
+#include <tagparser/positioninset.h>
+#include <tagparser/progressfeedback.h>
+#include <tagparser/tag.h>
+#include <tagparser/tagvalue.h>
+#include <tagparser/vorbis/vorbiscomment.h>
+
+#include <QCoreApplication>
+#include <QFileInfo>
+#include <QRunnable>
+#include <QStringList>
+
+#include <iostream>
+#include <limits>
+
+using namespace std;
+using namespace TagParser;
+
+namespace DBusSoundRecorder {
+
+inline ostream &operator<<(ostream &stream, const QString &str)
+{
+    return stream << str.toLocal8Bit().data();
+}
+
+/*!
+ * \brief The TagWriterJob class writes the tags of one file in the background.
+ */
+class TagWriterJob : public QRunnable {
+public:
+    TagWriterJob(TagWriter &writer, const QString &path, const TagWriter::Fields &fields, const QString &coverDirPath,
+        const TagWriter::Callback &done);
+    void run() override;
+
+private:
+    TagWriter &m_writer;
+    const QString m_path;
+    const TagWriter::Fields m_fields;
+    const QString m_coverDirPath;
+    const TagWriter::Callback m_done;
+};
+
+TagWriterJob::TagWriterJob(
+    TagWriter &writer, const QString &path, const TagWriter::Fields &fields, const QString &coverDirPath, const TagWriter::Callback &done)
+    : m_writer(writer)
+    , m_path(path)
+    , m_fields(fields)
+    , m_coverDirPath(coverDirPath)
+    , m_done(done)
+{
+}
+
+void TagWriterJob::run()
+{
+    m_writer.writeTags(m_path, m_fields, m_coverDirPath);
+    if (m_done) {
+        QMetaObject::invokeMethod(QCoreApplication::instance(), m_done, Qt::QueuedConnection);
+    }
+}
+
+TagWriter::TagWriter()
+{
+    m_threadPool.setMaxThreadCount(1);
+}
+
+/*!
+ * \brief Waits until all enqueued files have been tagged.
+ */
+TagWriter::~TagWriter()
+{
+    m_threadPool.waitForDone();
+}
+
+/*!
+ * \brief Tags the file at the specified \a path with the specified \a fields in the background.
+ * \remarks This function returns immediately. See writeTags() for the supported fields. If specified, \a done is
+ *          invoked from the event loop of the main thread after the file has been tagged (regardless of errors).
+ */
+void TagWriter::enqueue(const QString &path, const Fields &fields, const QString &coverDirPath, const Callback &done)
+{
+    m_threadPool.start(new TagWriterJob(*this, path, fields, coverDirPath, done));
+}
+
+/*!
+ * \brief Returns the field of tagparser corresponding to the specified ffmpeg-style \a field name.
+ */
+inline KnownField knownField(const QString &field)
+{
+    if (field == QLatin1String("title")) {
+        return KnownField::Title;
+    } else if (field == QLatin1String("album")) {
+        return KnownField::Album;
+    } else if (field == QLatin1String("artist")) {
+        return KnownField::Artist;
+    } else if (field == QLatin1String("genre")) {
+        return KnownField::Genre;
+    } else if (field == QLatin1String("year")) {
+        return KnownField::RecordDate;
+    } else if (field == QLatin1String("track")) {
+        return KnownField::TrackPosition;
+    } else if (field == QLatin1String("disk")) {
+        return KnownField::DiskPosition;
+    }
+    return KnownField::Invalid;
+}
+
+/*!
+ * \brief Sets the field with the specified \a name which has no format-independent representation (e.g. ReplayGain).
+ * \remarks Only supported for MP4 tags (as iTunes-style freeform atom) and Vorbis comments. Other tags are left as
+ *          they are.
+ */
+inline void setCustomField(Tag *tag, const QString &name, const QString &value)
+{
+    const auto tagValue = TagValue(value.toStdString(), TagTextEncoding::Utf8, tag->proposedTextEncoding());
+    switch (tag->type()) {
+    case TagType::Mp4Tag:
+        static_cast<Mp4Tag *>(tag)->setValue("com.apple.iTunes", name.toStdString(), tagValue);
+        break;
+    case TagType::VorbisComment:
+        static_cast<VorbisComment *>(tag)->setValue(name.toUpper().toStdString(), tagValue);
+        break;
+    default:;
+    }
+}
+
+/*!
+ * \brief Writes the specified \a fields into the tags of the file at the specified \a path.
+ * \remarks
+ * - The fields are named like ffmpeg's meta data fields: title, album, artist, genre, year, track and disk. The track
+ *   and disk might be specified as "position/total".
+ * - The field cover might be specified as path of a local image. It is embedded and copied into \a coverDirPath or,
+ *   if empty, into the directory of the file (see CoverCache).
+ * - Fields starting with "replaygain_" or "r128_" are written as custom fields (see setCustomField()).
+ * - Tags are created if the file does not contain any yet. Fields not specified are left as they are.
+ * - The tags and the index are kept at their current position and existing padding is used so usually only the tag
+ *   atoms/frames are patched.
+ * \returns Returns whether the tags could be written. Problems are logged to stderr.
+ */
+bool TagWriter::writeTags(const QString &path, const Fields &fields, const QString &coverDirPath)
+{
+    MediaFileInfo file(path.toStdString());
+    Diagnostics diag;
+    AbortableProgressFeedback progress;
+    try {
+        file.open();
+        file.parseContainerFormat(diag, progress);
+        file.parseTags(diag, progress);
+        file.createAppropriateTags();
+        const auto coverPath = fields.value(QStringLiteral("cover"));
+        const auto cover = coverPath.isEmpty() ? Cover() : m_coverCache.cover(coverPath, coverDirPath.isEmpty() ? QFileInfo(path).absolutePath() : coverDirPath);
+        const auto tags = file.tags();
+        if (tags.empty()) {
+            cerr << "Warning: Unable to tag " << path << ": the container format does not support tags" << endl;
+            return false;
+        }
+        for (auto *const tag : tags) {
+            if (!cover.data.isEmpty()) {
+                auto value = TagValue(cover.data.data(), static_cast<std::size_t>(cover.data.size()), TagDataType::Picture);
+                value.setMimeType(cover.mimeType.toStdString());
+                tag->setValue(KnownField::Cover, value);
+            }
+            for (auto i = fields.cbegin(), end = fields.cend(); i != end; ++i) {
+                const auto field = knownField(i.key());
+                if (i.value().isEmpty()) {
+                    continue;
+                }
+                if (field == KnownField::Invalid) {
+                    if (i.key().startsWith(QLatin1String("replaygain_")) || i.key().startsWith(QLatin1String("r128_"))) {
+                        setCustomField(tag, i.key(), i.value());
+                    }
+                    continue;
+                }
+                if (field == KnownField::TrackPosition || field == KnownField::DiskPosition) {
+                    const auto parts = i.value().split(QChar('/'));
+                    tag->setValue(field, TagValue(PositionInSet(parts.at(0).toInt(), parts.size() > 1 ? parts.at(1).toInt() : 0)));
+                } else {
+                    tag->setValue(field, TagValue(i.value().toStdString(), TagTextEncoding::Utf8, tag->proposedTextEncoding()));
+                }
+            }
+        }
+        file.setTagPosition(ElementPosition::Keep);
+        file.setIndexPosition(ElementPosition::Keep);
+        file.setMinPadding(0);
+        file.setMaxPadding(numeric_limits<size_t>::max());
+        file.applyChanges(diag, progress);
+    } catch (const Failure &) {
+        // the cause has already been added to the diagnostic messages
+        diag.emplace_back(DiagLevel::Critical, "Unable to parse or rewrite the file.", "writing tags");
+    } catch (const ios_base::failure &) {
+        diag.emplace_back(DiagLevel::Critical, "An IO error occurred.", "writing tags");
+    }
+    if (diag.level() >= DiagLevel::Critical) {
+        cerr << "Error: Unable to tag " << path << ':' << endl;
+        for (const auto &message : diag) {
+            if (message.level() >= DiagLevel::Warning) {
+                cerr << " - " << message.context() << ": " << message.message() << endl;
+            }
+        }
+        return false;
+    }
+    cerr << "Tagged " << path << endl;
+    return true;
+}
+} // namespace DBusSoundRecorder
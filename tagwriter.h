@@ -0,0 +1,39 @@
+#ifndef TAGWRITER_H
+#define TAGWRITER_H
+
+#include "covercache.h"
+
+#include <QMap>
+#include <QString>
+#include <QThreadPool>
+
+#include <functional>
+
+namespace DBusSoundRecorder {
+
+/*!
+ * \brief The TagWriter class writes the tags of finished recordings in the background.
+ *
+ * The tags are written via tagparser which only patches the tag atoms/frames of the container. The audio data is not
+ * remuxed; the file is only rewritten if the new tags do not fit into the space of the existing tags and padding (and
+ * the tags are not located at the end of the file as usual for files written by ffmpeg). Files are tagged one after
+ * another on a single thread so tagging does not compete with recording. Cover images are embedded via a CoverCache.
+ */
+class TagWriter {
+public:
+    using Fields = QMap<QString, QString>;
+    using Callback = std::function<void()>;
+
+    TagWriter();
+    ~TagWriter();
+
+    void enqueue(const QString &path, const Fields &fields, const QString &coverDirPath = QString(), const Callback &done = Callback());
+    bool writeTags(const QString &path, const Fields &fields, const QString &coverDirPath = QString());
+
+private:
+    CoverCache m_coverCache;
+    QThreadPool m_threadPool;
+};
+} // namespace DBusSoundRecorder
+
+#endif // TAGWRITER_H
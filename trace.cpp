@@ -0,0 +1,248 @@
+#include "trace.h"
+
+#include <QDBusArgument>
+#include <QDBusObjectPath>
+#include <QDBusVariant>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace DBusSoundRecorder {
+
+inline ostream &operator<<(ostream &stream, const QString &str)
+{
+    return stream << str.toLocal8Bit().data();
+}
+
+/*!
+ * \brief Returns the name used for the specified event \a type within trace files.
+ */
+inline QString traceEventTypeName(TraceEvent::Type type)
+{
+    switch (type) {
+    case TraceEvent::Type::Properties:
+        return QStringLiteral("properties");
+    case TraceEvent::Type::Seeked:
+        return QStringLiteral("seeked");
+    default:
+        return QStringLiteral("changed");
+    }
+}
+
+/*!
+ * \brief Encodes the specified \a value as JSON object mapping its D-Bus signature to its value.
+ * \remarks Values of types which are not used by MPRIS are encoded as string.
+ */
+QJsonValue encodeTraceValue(const QVariant &value)
+{
+    const auto type = value.userType();
+    if (type == qMetaTypeId<QDBusVariant>()) {
+        return encodeTraceValue(value.value<QDBusVariant>().variant());
+    } else if (type == qMetaTypeId<QDBusObjectPath>()) {
+        return QJsonObject({ { QStringLiteral("o"), value.value<QDBusObjectPath>().path() } });
+    } else if (type == qMetaTypeId<QDBusArgument>()) {
+        const auto argument = value.value<QDBusArgument>();
+        switch (argument.currentType()) {
+        case QDBusArgument::MapType:
+            return encodeTraceValue(qdbus_cast<QVariantMap>(argument));
+        case QDBusArgument::ArrayType:
+            return encodeTraceValue(qdbus_cast<QStringList>(argument));
+        default:
+            return QJsonValue();
+        }
+    }
+    switch (type) {
+    case QMetaType::Bool:
+        return QJsonObject({ { QStringLiteral("b"), value.toBool() } });
+    case QMetaType::Int:
+        return QJsonObject({ { QStringLiteral("i"), value.toInt() } });
+    case QMetaType::UInt:
+        return QJsonObject({ { QStringLiteral("u"), static_cast<qint64>(value.toUInt()) } });
+    case QMetaType::LongLong:
+        return QJsonObject({ { QStringLiteral("x"), value.toLongLong() } });
+    case QMetaType::ULongLong:
+        return QJsonObject({ { QStringLiteral("t"), static_cast<qint64>(value.toULongLong()) } });
+    case QMetaType::Double:
+        return QJsonObject({ { QStringLiteral("d"), value.toDouble() } });
+    case QMetaType::QStringList:
+        return QJsonObject({ { QStringLiteral("as"), QJsonArray::fromStringList(value.toStringList()) } });
+    case QMetaType::QVariantMap: {
+        QJsonObject map;
+        const auto variantMap = value.toMap();
+        for (auto i = variantMap.cbegin(), end = variantMap.cend(); i != end; ++i) {
+            map.insert(i.key(), encodeTraceValue(i.value()));
+        }
+        return QJsonObject({ { QStringLiteral("a{sv}"), map } });
+    }
+    default:
+        return QJsonObject({ { QStringLiteral("s"), value.toString() } });
+    }
+}
+
+/*!
+ * \brief Decodes a value encoded via encodeTraceValue() so it is marshalled with its original D-Bus type when sent.
+ */
+QVariant decodeTraceValue(const QJsonValue &value)
+{
+    const auto object = value.toObject();
+    if (object.size() != 1) {
+        return QVariant();
+    }
+    const auto signature = object.constBegin().key();
+    const auto data = object.constBegin().value();
+    if (signature == QLatin1String("o")) {
+        return QVariant::fromValue(QDBusObjectPath(data.toString()));
+    } else if (signature == QLatin1String("b")) {
+        return data.toBool();
+    } else if (signature == QLatin1String("i")) {
+        return data.toInt();
+    } else if (signature == QLatin1String("u")) {
+        return static_cast<uint>(data.toDouble());
+    } else if (signature == QLatin1String("x")) {
+        return static_cast<qlonglong>(data.toDouble());
+    } else if (signature == QLatin1String("t")) {
+        return static_cast<qulonglong>(data.toDouble());
+    } else if (signature == QLatin1String("d")) {
+        return data.toDouble();
+    } else if (signature == QLatin1String("as")) {
+        QStringList list;
+        for (const auto &element : data.toArray()) {
+            list << element.toString();
+        }
+        return list;
+    } else if (signature == QLatin1String("a{sv}")) {
+        QVariantMap map;
+        const auto jsonMap = data.toObject();
+        for (auto i = jsonMap.constBegin(), end = jsonMap.constEnd(); i != end; ++i) {
+            map.insert(i.key(), decodeTraceValue(i.value()));
+        }
+        return map;
+    }
+    return data.toString();
+}
+
+/*!
+ * \brief Reads all events from the trace file at the specified \a path.
+ * \throws Throws std::runtime_error if the file can not be read or contains an invalid line.
+ */
+std::vector<TraceEvent> readTrace(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        throw runtime_error("unable to open trace file \"" + path.toStdString() + "\": " + file.errorString().toStdString());
+    }
+    std::vector<TraceEvent> events;
+    for (auto lineNumber = 1u; !file.atEnd(); ++lineNumber) {
+        const auto line = file.readLine().trimmed();
+        if (line.isEmpty()) {
+            continue;
+        }
+        QJsonParseError error;
+        const auto object = QJsonDocument::fromJson(line, &error).object();
+        if (error.error != QJsonParseError::NoError) {
+            throw runtime_error("invalid trace file \"" + path.toStdString() + "\": line " + to_string(lineNumber) + ": "
+                + error.errorString().toStdString());
+        }
+        TraceEvent event;
+        event.time = chrono::microseconds(static_cast<chrono::microseconds::rep>(object.value(QStringLiteral("time")).toDouble()));
+        const auto type = object.value(QStringLiteral("type")).toString();
+        if (type == traceEventTypeName(TraceEvent::Type::Properties)) {
+            event.type = TraceEvent::Type::Properties;
+        } else if (type == traceEventTypeName(TraceEvent::Type::Seeked)) {
+            event.type = TraceEvent::Type::Seeked;
+        } else if (type != traceEventTypeName(TraceEvent::Type::Changed)) {
+            throw runtime_error("invalid trace file \"" + path.toStdString() + "\": line " + to_string(lineNumber) + ": unknown event type");
+        }
+        const auto properties = object.value(QStringLiteral("properties")).toObject();
+        for (auto i = properties.constBegin(), end = properties.constEnd(); i != end; ++i) {
+            event.properties.insert(i.key(), decodeTraceValue(i.value()));
+        }
+        for (const auto &propertyName : object.value(QStringLiteral("invalidated")).toArray()) {
+            event.invalidatedProperties << propertyName.toString();
+        }
+        event.position = static_cast<qlonglong>(object.value(QStringLiteral("position")).toDouble());
+        events.emplace_back(move(event));
+    }
+    return events;
+}
+
+/*!
+ * \brief Opens the trace file at the specified \a path for writing; an existing file is overwritten.
+ * \remarks The timestamps of subsequently written events are relative to the time this function has been called.
+ */
+bool TraceWriter::open(const QString &path)
+{
+    m_file.close();
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        cerr << "Error: Unable to open trace file " << path << ": " << m_file.errorString() << endl;
+        return false;
+    }
+    m_start = chrono::steady_clock::now();
+    return true;
+}
+
+std::chrono::microseconds TraceWriter::elapsed() const
+{
+    return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - m_start);
+}
+
+/*!
+ * \brief Writes the specified \a event; the time of \a event is ignored and the current time is used instead.
+ */
+void TraceWriter::write(const TraceEvent &event)
+{
+    if (!m_file.isOpen()) {
+        return;
+    }
+    QJsonObject object;
+    object.insert(QStringLiteral("time"), static_cast<qint64>(elapsed().count()));
+    object.insert(QStringLiteral("type"), traceEventTypeName(event.type));
+    if (event.type == TraceEvent::Type::Seeked) {
+        object.insert(QStringLiteral("position"), event.position);
+    } else {
+        QJsonObject properties;
+        for (auto i = event.properties.cbegin(), end = event.properties.cend(); i != end; ++i) {
+            properties.insert(i.key(), encodeTraceValue(i.value()));
+        }
+        object.insert(QStringLiteral("properties"), properties);
+        if (!event.invalidatedProperties.isEmpty()) {
+            object.insert(QStringLiteral("invalidated"), QJsonArray::fromStringList(event.invalidatedProperties));
+        }
+    }
+    // flush each event so the trace is usable even if the recorder is not terminated gracefully
+    m_file.write(QJsonDocument(object).toJson(QJsonDocument::Compact));
+    m_file.write("\n");
+    m_file.flush();
+}
+
+void TraceWriter::writeProperties(const QVariantMap &properties)
+{
+    TraceEvent event;
+    event.type = TraceEvent::Type::Properties;
+    event.properties = properties;
+    write(event);
+}
+
+void TraceWriter::writeChanged(const QVariantMap &changedProperties, const QStringList &invalidatedProperties)
+{
+    TraceEvent event;
+    event.type = TraceEvent::Type::Changed;
+    event.properties = changedProperties;
+    event.invalidatedProperties = invalidatedProperties;
+    write(event);
+}
+
+void TraceWriter::writeSeeked(qlonglong position)
+{
+    TraceEvent event;
+    event.type = TraceEvent::Type::Seeked;
+    event.position = position;
+    write(event);
+}
+} // namespace DBusSoundRecorder
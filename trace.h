@@ -0,0 +1,57 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QFile>
+#include <QJsonValue>
+#include <QStringList>
+#include <QVariantMap>
+
+#include <chrono>
+#include <vector>
+
+namespace DBusSoundRecorder {
+
+/*!
+ * \brief The TraceEvent struct represents a D-Bus event seen by the PlayerWatcher.
+ */
+struct TraceEvent {
+    enum class Type {
+        Properties, /**< all properties have been received via GetAll (e.g. initially or after the player restarted) */
+        Changed, /**< the PropertiesChanged signal has been received */
+        Seeked, /**< the Seeked signal has been received */
+    };
+
+    std::chrono::microseconds time = std::chrono::microseconds::zero();
+    Type type = Type::Changed;
+    QVariantMap properties;
+    QStringList invalidatedProperties;
+    qlonglong position = 0;
+};
+
+QJsonValue encodeTraceValue(const QVariant &value);
+QVariant decodeTraceValue(const QJsonValue &value);
+std::vector<TraceEvent> readTrace(const QString &path);
+
+/*!
+ * \brief The TraceWriter class writes D-Bus events into a trace file.
+ *
+ * The trace file contains one JSON object per line. Each event is timestamped relative to the time the trace file
+ * has been opened. Values keep their D-Bus type so they can be sent again exactly as received (see FakePlayer).
+ */
+class TraceWriter {
+public:
+    bool open(const QString &path);
+    void write(const TraceEvent &event);
+    void writeProperties(const QVariantMap &properties);
+    void writeChanged(const QVariantMap &changedProperties, const QStringList &invalidatedProperties);
+    void writeSeeked(qlonglong position);
+
+private:
+    std::chrono::microseconds elapsed() const;
+
+    QFile m_file;
+    std::chrono::steady_clock::time_point m_start;
+};
+} // namespace DBusSoundRecorder
+
+#endif // TRACE_H